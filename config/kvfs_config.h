@@ -36,6 +36,34 @@
 #define KVFS_LINK_MAX 1000
 #endif  // !defined(KVFS_LINK_MAX)
 
+#if !defined(KVFS_DENTRY_CACHE_SIZE)
+#define KVFS_DENTRY_CACHE_SIZE 4096
+#endif  // !defined(KVFS_DENTRY_CACHE_SIZE)
+
+#if !defined(KVFS_DIRECTORY_FILTER)
+#define KVFS_DIRECTORY_FILTER 1
+#endif  // !defined(KVFS_DIRECTORY_FILTER)
+
+#if !defined(KVFS_INODE_LEASE_SIZE)
+#define KVFS_INODE_LEASE_SIZE 1024
+#endif  // !defined(KVFS_INODE_LEASE_SIZE)
+
 #if !defined(KVFS_THREAD_SAFE)
 #define KVFS_THREAD_SAFE 0
 #endif  // !defined(KVFS_THREAD_SAFE)
+
+#if !defined(KVFS_LOCK_STRIPES)
+#define KVFS_LOCK_STRIPES 1024
+#endif  // !defined(KVFS_LOCK_STRIPES)
+
+#if !defined(KVFS_PARALLEL_READ_MIN)
+#define KVFS_PARALLEL_READ_MIN 262144
+#endif  // !defined(KVFS_PARALLEL_READ_MIN)
+
+#if !defined(KVFS_READ_THREADS)
+#define KVFS_READ_THREADS 0
+#endif  // !defined(KVFS_READ_THREADS)
+
+#if !defined(KVFS_STATS)
+#define KVFS_STATS 1
+#endif  // !defined(KVFS_STATS)
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   dentry_cache.cpp
+ */
+
+#include "dentry_cache.h"
+
+namespace kvfs {
+
+namespace {
+// first stage holds this many names, every next stage doubles it
+const size_t kFilterInitialCapacity = 1024;
+// ~10 bits per name and 7 probes give roughly 1% false positives per stage
+const size_t kFilterBitsPerName = 10;
+const size_t kFilterProbes = 7;
+
+inline uint64_t SecondHash(kvfs_file_hash_t hash) {
+  uint64_t h = static_cast<uint64_t>(hash) * 0x9e3779b97f4a7c15ULL;
+  return (h >> 29) | (h << 35) | 1;
+}
+}  // namespace
+
+DirectoryFilter::DirectoryFilter() {
+  AddStage();
+}
+void DirectoryFilter::AddStage() {
+  Stage stage;
+  stage.capacity_ = stages_.empty() ? kFilterInitialCapacity : stages_.back().capacity_ * 2;
+  stage.count_ = 0;
+  stage.bits_.assign((stage.capacity_ * kFilterBitsPerName + 63) / 64, 0);
+  stages_.push_back(std::move(stage));
+}
+void DirectoryFilter::Add(kvfs_file_hash_t hash) {
+  if (stages_.back().count_ >= stages_.back().capacity_) {
+    AddStage();
+  }
+  Stage &stage = stages_.back();
+  uint64_t nbits = stage.bits_.size() * 64;
+  uint64_t h = hash;
+  uint64_t delta = SecondHash(hash);
+  for (size_t i = 0; i < kFilterProbes; ++i) {
+    uint64_t bit = h % nbits;
+    stage.bits_[bit / 64] |= (1ULL << (bit % 64));
+    h += delta;
+  }
+  ++stage.count_;
+}
+bool DirectoryFilter::MayContain(kvfs_file_hash_t hash) const {
+  uint64_t delta = SecondHash(hash);
+  for (const Stage &stage : stages_) {
+    uint64_t nbits = stage.bits_.size() * 64;
+    uint64_t h = hash;
+    bool found = true;
+    for (size_t i = 0; i < kFilterProbes; ++i) {
+      uint64_t bit = h % nbits;
+      if (!(stage.bits_[bit / 64] & (1ULL << (bit % 64)))) {
+        found = false;
+        break;
+      }
+      h += delta;
+    }
+    if (found) {
+      return true;
+    }
+  }
+  return false;
+}
+
+DentryCache::DentryCache(size_t negative_size, size_t positive_size, size_t filter_size)
+    : negative_size_((negative_size + kShards - 1) / kShards),
+      positive_size_((positive_size + kShards - 1) / kShards),
+      filter_size_((filter_size + kShards - 1) / kShards),
+      shards_(std::make_unique<Shard[]>(kShards)) {
+  for (size_t i = 0; i < kShards; ++i) {
+    for (size_t j = 0; j < kGenerations; ++j) {
+      shards_[i].negative_generations_[j].store(0, std::memory_order_relaxed);
+      shards_[i].positive_generations_[j].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+DentryCache::FindResult DentryCache::Find(const kvfsInodeKey &key, kvfsInodeValue *md, uint64_t *generation) {
+  Shard &shard = ShardOf(key.inode_);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  return FindLocked(shard, key, md, generation);
+}
+void DentryCache::FindMany(const std::vector<kvfsInodeKey> &keys,
+                           std::vector<FindResult> *found,
+                           std::vector<kvfsInodeValue> *mds,
+                           std::vector<uint64_t> *generations) {
+  found->assign(keys.size(), kUnknown);
+  mds->resize(keys.size());
+  generations->assign(keys.size(), 0);
+  std::vector<size_t> by_shard[kShards];
+  for (size_t i = 0; i < keys.size(); ++i) {
+    by_shard[ShardIndex(keys[i].inode_)].push_back(i);
+  }
+  for (size_t s = 0; s < kShards; ++s) {
+    if (by_shard[s].empty()) {
+      continue;
+    }
+    Shard &shard = shards_[s];
+    std::lock_guard<std::mutex> lock(shard.mutex_);
+    for (size_t i : by_shard[s]) {
+      (*found)[i] = FindLocked(shard, keys[i], &(*mds)[i], &(*generations)[i]);
+    }
+  }
+}
+DentryCache::FindResult DentryCache::FindLocked(Shard &shard,
+                                                const kvfsInodeKey &key,
+                                                kvfsInodeValue *md,
+                                                uint64_t *generation) {
+  auto fit = shard.filter_lookup_.find(key.inode_);
+  if (fit != shard.filter_lookup_.end() && !fit->second->second.MayContain(key.hash_)) {
+    return kAbsent;
+  }
+  auto it = shard.negative_lookup_.find(key);
+  if (it != shard.negative_lookup_.end()) {
+    // refresh its position in the lru list
+    shard.negative_list_.splice(shard.negative_list_.begin(), shard.negative_list_, it->second);
+    return kAbsent;
+  }
+  auto pit = shard.positive_lookup_.find(key);
+  if (pit != shard.positive_lookup_.end()) {
+    shard.positive_list_.splice(shard.positive_list_.begin(), shard.positive_list_, pit->second);
+    *md = pit->second->second;
+    return kPresent;
+  }
+  *generation = NegativeGenerationOf(shard, key.inode_).load(std::memory_order_relaxed);
+  return kUnknown;
+}
+void DentryCache::InsertPositive(const kvfsInodeKey &key, const kvfsInodeValue &md, uint64_t generation) {
+  Shard &shard = ShardOf(key.inode_);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  if (positive_size_ == 0 || generation != PositiveGenerationOf(shard, key.inode_).load(std::memory_order_relaxed)) {
+    return;
+  }
+  EraseNegative(shard, key);
+  auto it = shard.positive_lookup_.find(key);
+  if (it != shard.positive_lookup_.end()) {
+    it->second->second = md;
+    shard.positive_list_.splice(shard.positive_list_.begin(), shard.positive_list_, it->second);
+    return;
+  }
+  shard.positive_list_.emplace_front(key, md);
+  shard.positive_lookup_[key] = shard.positive_list_.begin();
+  if (shard.positive_list_.size() > positive_size_) {
+    shard.positive_lookup_.erase(shard.positive_list_.back().first);
+    shard.positive_list_.pop_back();
+  }
+}
+void DentryCache::Invalidate(const kvfsInodeKey &key) {
+  Shard &shard = ShardOf(key.inode_);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  // the entry still exists, misses and scans of the directory stay valid
+  PositiveGenerationOf(shard, key.inode_).fetch_add(1, std::memory_order_relaxed);
+  ErasePositive(shard, key);
+}
+uint64_t DentryCache::NegativeGeneration(kvfs_file_inode_t dir) {
+  // the store is read after this, the acquire keeps it from being read first
+  return NegativeGenerationOf(ShardOf(dir), dir).load(std::memory_order_acquire);
+}
+uint64_t DentryCache::PositiveGeneration(kvfs_file_inode_t dir) {
+  return PositiveGenerationOf(ShardOf(dir), dir).load(std::memory_order_acquire);
+}
+size_t DentryCache::InsertNegative(const kvfsInodeKey &key, uint64_t generation) {
+  Shard &shard = ShardOf(key.inode_);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  if (generation != NegativeGenerationOf(shard, key.inode_).load(std::memory_order_relaxed)) {
+    return 0;
+  }
+  return AddNegative(shard, key);
+}
+void DentryCache::Removed(const kvfsInodeKey &key) {
+  Shard &shard = ShardOf(key.inode_);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  PositiveGenerationOf(shard, key.inode_).fetch_add(1, std::memory_order_relaxed);
+  AddNegative(shard, key);
+}
+size_t DentryCache::AddNegative(Shard &shard, const kvfsInodeKey &key) {
+  ErasePositive(shard, key);
+  auto it = shard.negative_lookup_.find(key);
+  if (it != shard.negative_lookup_.end()) {
+    shard.negative_list_.splice(shard.negative_list_.begin(), shard.negative_list_, it->second);
+  } else {
+    shard.negative_list_.push_front(key);
+    shard.negative_lookup_[key] = shard.negative_list_.begin();
+    if (shard.negative_list_.size() > negative_size_) {
+      shard.negative_lookup_.erase(shard.negative_list_.back());
+      shard.negative_list_.pop_back();
+    }
+  }
+  if (shard.filter_lookup_.find(key.inode_) != shard.filter_lookup_.end()) {
+    // the directory has its filter already, these are its false positives
+    return 0;
+  }
+  if (shard.misses_.size() > negative_size_) {
+    // only a hint, start counting again rather than growing without bound
+    shard.misses_.clear();
+  }
+  return ++shard.misses_[key.inode_];
+}
+void DentryCache::Created(const kvfsInodeKey &key) {
+  Shard &shard = ShardOf(key.inode_);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  NegativeGenerationOf(shard, key.inode_).fetch_add(1, std::memory_order_relaxed);
+  PositiveGenerationOf(shard, key.inode_).fetch_add(1, std::memory_order_relaxed);
+  EraseNegative(shard, key);
+  ErasePositive(shard, key);
+  auto fit = shard.filter_lookup_.find(key.inode_);
+  if (fit != shard.filter_lookup_.end()) {
+    fit->second->second.Add(key.hash_);
+  }
+}
+void DentryCache::TrackDirectory(kvfs_file_inode_t dir,
+                                 const std::vector<kvfs_file_hash_t> &hashes,
+                                 uint64_t generation) {
+  Shard &shard = ShardOf(dir);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  // counted anew either way, a dropped scan is tried again after as many misses
+  shard.misses_.erase(dir);
+  if (filter_size_ == 0 || generation != NegativeGenerationOf(shard, dir).load(std::memory_order_relaxed)) {
+    return;
+  }
+  auto fit = shard.filter_lookup_.find(dir);
+  if (fit != shard.filter_lookup_.end()) {
+    shard.filter_list_.erase(fit->second);
+    shard.filter_lookup_.erase(fit);
+  }
+  shard.filter_list_.emplace_front(dir, DirectoryFilter());
+  for (const kvfs_file_hash_t &hash : hashes) {
+    shard.filter_list_.front().second.Add(hash);
+  }
+  shard.filter_lookup_[dir] = shard.filter_list_.begin();
+  if (shard.filter_list_.size() > filter_size_) {
+    shard.filter_lookup_.erase(shard.filter_list_.back().first);
+    shard.filter_list_.pop_back();
+  }
+}
+void DentryCache::ForgetDirectory(kvfs_file_inode_t dir) {
+  Shard &shard = ShardOf(dir);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  auto fit = shard.filter_lookup_.find(dir);
+  if (fit != shard.filter_lookup_.end()) {
+    shard.filter_list_.erase(fit->second);
+    shard.filter_lookup_.erase(fit);
+  }
+  shard.misses_.erase(dir);
+  // reads of its entries still in flight must not be cached either
+  NegativeGenerationOf(shard, dir).fetch_add(1, std::memory_order_relaxed);
+  PositiveGenerationOf(shard, dir).fetch_add(1, std::memory_order_relaxed);
+  for (auto it = shard.negative_list_.begin(); it != shard.negative_list_.end();) {
+    if (it->inode_ == dir) {
+      shard.negative_lookup_.erase(*it);
+      it = shard.negative_list_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = shard.positive_list_.begin(); it != shard.positive_list_.end();) {
+    if (it->first.inode_ == dir) {
+      shard.positive_lookup_.erase(it->first);
+      it = shard.positive_list_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+bool DentryCache::IsTracked(kvfs_file_inode_t dir) {
+  Shard &shard = ShardOf(dir);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  return shard.filter_lookup_.find(dir) != shard.filter_lookup_.end();
+}
+void DentryCache::EraseNegative(Shard &shard, const kvfsInodeKey &key) {
+  auto it = shard.negative_lookup_.find(key);
+  if (it != shard.negative_lookup_.end()) {
+    shard.negative_list_.erase(it->second);
+    shard.negative_lookup_.erase(it);
+  }
+}
+void DentryCache::ErasePositive(Shard &shard, const kvfsInodeKey &key) {
+  auto it = shard.positive_lookup_.find(key);
+  if (it != shard.positive_lookup_.end()) {
+    shard.positive_list_.erase(it->second);
+    shard.positive_lookup_.erase(it);
+  }
+}
+
+}  // namespace kvfs
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   dentry_cache.h
+ */
+
+#ifndef KVFS_DENTRY_CACHE_H
+#define KVFS_DENTRY_CACHE_H
+
+#include <inodes/inode_cache.h>
+#include <kvfs_store/kvfs_store_entry.h>
+#include <kvfs_config.h>
+#include <atomic>
+#include <memory>
+#include <list>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+namespace kvfs {
+
+/**
+ * Approximate membership filter over the name hashes of a single directory.
+ * It is a scalable bloom filter: whenever the current stage is full a new stage with twice
+ * the capacity is appended, so it never has to be rebuilt from the store.
+ * A negative answer proves that the name is not in the directory, a positive one has to be
+ * confirmed against the store.
+ */
+class DirectoryFilter {
+ public:
+  DirectoryFilter();
+
+  void Add(kvfs_file_hash_t hash);
+
+  bool MayContain(kvfs_file_hash_t hash) const;
+
+ private:
+  struct Stage {
+    std::vector<uint64_t> bits_;
+    size_t capacity_;
+    size_t count_;
+  };
+  std::vector<Stage> stages_;
+
+  void AddStage();
+};
+
+/**
+ * Cache of directory entries that are known NOT to exist in the store, keyed by
+ * (parent inode, name hash), plus optional per-directory filters.
+ * Misses are the most expensive lookups in an LSM store since every level has to be probed,
+ * this cache lets the create paths skip the existence check.
+ * Every code path that creates an entry in the store MUST call Created() for its key.
+ *
+ * It also holds the metadata of entries read by directory scans (ReadDirPlus), so the lookups
+ * that usually follow a listing are answered from memory. Every code path that changes the
+ * metadata of an entry in the store MUST call Invalidate() for its key.
+ *
+ * Everything is kept in shards by parent inode, each with a lock of its own, so lookups in
+ * unrelated directories don't contend. What was read from the store without the parent's lock is
+ * only cached if the generation of its parent did not change meanwhile; generations are kept per
+ * parent, directories that share one only lose an insert now and then. Misses and scans only
+ * watch for created entries, metadata reads for any change, so updates of existing entries don't
+ * keep misses from being cached.
+ */
+class DentryCache {
+ public:
+  typedef std::list<kvfsInodeKey> NegativeList;
+  typedef std::unordered_map<kvfsInodeKey, NegativeList::iterator,
+                             InodeCacheHash, InodeCacheComparator> NegativeMap;
+  typedef std::pair<kvfs_file_inode_t, DirectoryFilter> FilterEntry;
+  typedef std::list<FilterEntry> FilterList;
+  typedef std::unordered_map<kvfs_file_inode_t, FilterList::iterator> FilterMap;
+  typedef std::pair<kvfsInodeKey, kvfsInodeValue> PositiveEntry;
+  typedef std::list<PositiveEntry> PositiveList;
+  typedef std::unordered_map<kvfsInodeKey, PositiveList::iterator,
+                             InodeCacheHash, InodeCacheComparator> PositiveMap;
+
+  enum FindResult {
+    // the store has to be asked
+    kUnknown,
+    // known not to exist
+    kAbsent,
+    // read by an earlier scan, its metadata is returned
+    kPresent
+  };
+
+  /**
+   * The sizes are of the whole cache, each shard holds its part of them.
+   */
+  DentryCache(size_t negative_size, size_t positive_size, size_t filter_size);
+
+  /**
+   * Look the entry up in the negative entries, the filter of its directory and the cached metadata.
+   * @param md gets the metadata if it is cached.
+   * @param generation gets NegativeGeneration() of the parent if the store has to be asked, to be
+   * passed to InsertNegative after it was.
+   */
+  FindResult Find(const kvfsInodeKey &key, kvfsInodeValue *md, uint64_t *generation);
+
+  /**
+   * Find() for each of the keys, every shard is locked once for all of its keys.
+   */
+  void FindMany(const std::vector<kvfsInodeKey> &keys,
+                std::vector<FindResult> *found,
+                std::vector<kvfsInodeValue> *mds,
+                std::vector<uint64_t> *generations);
+
+  /**
+   * Cache the metadata of an entry read from the store.
+   * @param generation value of PositiveGeneration() for the parent from before the metadata was
+   * read, the entry is dropped if it changed since then, as the metadata might have been read stale.
+   */
+  void InsertPositive(const kvfsInodeKey &key, const kvfsInodeValue &md, uint64_t generation);
+
+  /**
+   * Drop the cached metadata of an entry that was changed in the store.
+   */
+  void Invalidate(const kvfsInodeKey &key);
+
+  /**
+   * @return counter of the directory, advanced by every entry created in it.
+   */
+  uint64_t NegativeGeneration(kvfs_file_inode_t dir);
+
+  /**
+   * @return counter of the directory, advanced by every change of an entry in it.
+   */
+  uint64_t PositiveGeneration(kvfs_file_inode_t dir);
+
+  /**
+   * Record a lookup that missed in the store.
+   * @param generation value of NegativeGeneration() for the parent from before the store was asked, the miss
+   * is dropped if it changed since then, as the entry might have been created meanwhile.
+   * @return number of misses recorded for the parent directory since it was last reset,
+   * used by the caller to decide when building a directory filter pays off; 0 if dropped or if the
+   * directory already has a filter.
+   */
+  size_t InsertNegative(const kvfsInodeKey &key, uint64_t generation);
+
+  /**
+   * Drop the cached metadata of an entry that was just removed and record it as missing.
+   */
+  void Removed(const kvfsInodeKey &key);
+
+  /**
+   * Invalidate the negative entry of a newly created key and add it to its directory filter.
+   */
+  void Created(const kvfsInodeKey &key);
+
+  /**
+   * Start tracking a filter for the given directory, hashes must contain every entry of it.
+   * Used for newly created (empty) directories and after scanning an existing one.
+   * @param generation value of NegativeGeneration() for dir from before the scan, the filter is dropped if it
+   * changed since then, as the scan might have missed an entry, and the misses are counted anew.
+   */
+  void TrackDirectory(kvfs_file_inode_t dir, const std::vector<kvfs_file_hash_t> &hashes, uint64_t generation);
+
+  /**
+   * Drop any state kept for the directory and its entries, i.e. when it has been removed.
+   */
+  void ForgetDirectory(kvfs_file_inode_t dir);
+
+  bool IsTracked(kvfs_file_inode_t dir);
+
+  ~DentryCache() = default;
+
+ private:
+  static const size_t kShards = 16;
+  // generations per shard, directories of a shard share them by inode
+  static const size_t kGenerations = 64;
+
+  struct alignas(64) Shard {
+    std::mutex mutex_;
+    NegativeList negative_list_;
+    NegativeMap negative_lookup_;
+    FilterList filter_list_;
+    FilterMap filter_lookup_;
+    PositiveList positive_list_;
+    PositiveMap positive_lookup_;
+    std::unordered_map<kvfs_file_inode_t, size_t> misses_;
+    // advanced under mutex_, read without it
+    std::atomic<uint64_t> negative_generations_[kGenerations];
+    std::atomic<uint64_t> positive_generations_[kGenerations];
+  };
+
+  size_t negative_size_;
+  size_t positive_size_;
+  size_t filter_size_;
+  std::unique_ptr<Shard[]> shards_;
+
+  static size_t ShardIndex(kvfs_file_inode_t dir) {
+    return dir % kShards;
+  }
+  Shard &ShardOf(kvfs_file_inode_t dir) {
+    return shards_[ShardIndex(dir)];
+  }
+  static std::atomic<uint64_t> &NegativeGenerationOf(Shard &shard, kvfs_file_inode_t dir) {
+    return shard.negative_generations_[(dir / kShards) % kGenerations];
+  }
+  static std::atomic<uint64_t> &PositiveGenerationOf(Shard &shard, kvfs_file_inode_t dir) {
+    return shard.positive_generations_[(dir / kShards) % kGenerations];
+  }
+  FindResult FindLocked(Shard &shard, const kvfsInodeKey &key, kvfsInodeValue *md, uint64_t *generation);
+  void EraseNegative(Shard &shard, const kvfsInodeKey &key);
+  void ErasePositive(Shard &shard, const kvfsInodeKey &key);
+  size_t AddNegative(Shard &shard, const kvfsInodeKey &key);
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_DENTRY_CACHE_H
@@ -9,60 +9,127 @@
 
 #include "open_files_cache.h"
 
-bool kvfs::OpenFilesCacheComparator::operator()(const int &lhs, const int &rhs) const {
-  return (lhs == rhs);
+kvfs::OpenFilesCache::OpenFilesCache(size_t size)
+    : maxsize_(size), slots_(std::make_unique<Slot[]>(size)), free_head_(kNoSlot) {
+  // lowest descriptors on top
+  for (size_t i = size; i > 0; --i) {
+    PushFree(static_cast<uint32_t>(i - 1));
+  }
 }
-std::size_t kvfs::OpenFilesCacheHash::operator()(const int &x) const {
-  return static_cast<size_t>(x);
+
+uint32_t kvfs::OpenFilesCache::PopFree() {
+  uint64_t head = free_head_.load(std::memory_order_acquire);
+  while (true) {
+    auto index = static_cast<uint32_t>(head);
+    if (index == kNoSlot) {
+      return kNoSlot;
+    }
+    uint64_t next = slots_[index].next_free_.load(std::memory_order_relaxed);
+    uint64_t replaced = ((head >> 32) + 1) << 32 | next;
+    if (free_head_.compare_exchange_weak(head, replaced, std::memory_order_acquire, std::memory_order_acquire)) {
+      return index;
+    }
+  }
 }
 
-kvfs::OpenFilesCache::OpenFilesCache(size_t size)
-    : maxsize_(size), mutex_(std::make_unique<std::mutex>()) {}
+void kvfs::OpenFilesCache::PushFree(uint32_t index) {
+  uint64_t head = free_head_.load(std::memory_order_relaxed);
+  while (true) {
+    slots_[index].next_free_.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+    uint64_t replaced = ((head >> 32) + 1) << 32 | index;
+    if (free_head_.compare_exchange_weak(head, replaced, std::memory_order_release, std::memory_order_relaxed)) {
+      return;
+    }
+  }
+}
 
-bool kvfs::OpenFilesCache::Find(const int &filedes, kvfs::kvfsFileHandle &value) {
-  mutex_->lock();
+int kvfs::OpenFilesCache::Insert(kvfs::kvfsFileHandle handle) {
+  uint32_t index = PopFree();
+  if (index == kNoSlot) {
+    return -1;
+  }
+  Slot &slot = slots_[index];
+  {
+    std::lock_guard<std::mutex> lock(slot.mutex_);
+    slot.handle_ = std::move(handle);
+    slot.open_ = true;
+  }
+  open_count_.fetch_add(1, std::memory_order_relaxed);
+  return static_cast<int>(index);
+}
+
+kvfs::OpenFilesCache::Handle kvfs::OpenFilesCache::Find(int filedes) {
+  if (filedes < 0 || static_cast<size_t>(filedes) >= maxsize_) {
+    return Handle();
+  }
+  Slot &slot = slots_[filedes];
+  slot.mutex_.lock();
+  if (!slot.open_) {
+    slot.mutex_.unlock();
+    return Handle();
+  }
+  return Handle(&slot);
+}
 
-  auto it = lookup_.find(filedes);
-  if (it == lookup_.end()) {
-    mutex_->unlock();
+bool kvfs::OpenFilesCache::Copy(int filedes, kvfs::kvfsFileHandle *handle) {
+  if (filedes < 0 || static_cast<size_t>(filedes) >= maxsize_) {
+    return false;
+  }
+  Slot &slot = slots_[filedes];
+  std::lock_guard<std::mutex> lock(slot.mutex_);
+  if (!slot.open_) {
     return false;
-  } else {
+  }
+  handle->inode_ = slot.handle_.inode_;
+  handle->flags_ = slot.handle_.flags_;
+  handle->offset_ = slot.handle_.offset_;
+  return true;
+}
 
-    value = it->second->second;
-    cache_.push_front(*(it->second));
-    cache_.erase(it->second);
-    lookup_[filedes] = cache_.begin();
-    mutex_->unlock();
-    return true;
+bool kvfs::OpenFilesCache::Evict(int filedes, kvfs::kvfsFileHandle *handle) {
+  if (filedes < 0 || static_cast<size_t>(filedes) >= maxsize_) {
+    return false;
+  }
+  Slot &slot = slots_[filedes];
+  {
+    std::lock_guard<std::mutex> lock(slot.mutex_);
+    if (!slot.open_) {
+      return false;
+    }
+    if (handle) {
+      *handle = std::move(slot.handle_);
+    }
+    slot.handle_ = kvfsFileHandle();
+    slot.open_ = false;
   }
+  open_count_.fetch_sub(1, std::memory_order_relaxed);
+  PushFree(static_cast<uint32_t>(filedes));
+  return true;
 }
-void kvfs::OpenFilesCache::Insert(const int &filedes, kvfs::kvfsFileHandle &value) {
-  mutex_->lock();
 
-  Entry ent(filedes, value);
-  cache_.push_front(ent);
-  lookup_[filedes] = cache_.begin();
-  // not an lru cache
-  /*if (cache_.size() > maxsize_) {
-    lookup_.erase(cache_.back().first);
-    cache_.pop_back();
-  }*/
-  mutex_->unlock();
+size_t kvfs::OpenFilesCache::Size() const {
+  return open_count_.load(std::memory_order_relaxed);
 }
-void kvfs::OpenFilesCache::Evict(const int &filedes) {
-  mutex_->lock();
 
-  auto it = lookup_.find(filedes);
-  if (it != lookup_.end()) {
-    lookup_.erase(it);
-  }
+kvfs::OpenFilesCache::~OpenFilesCache() = default;
+
+kvfs::OpenFilesCache::Handle::Handle(Handle &&other) noexcept : slot_(other.slot_) {
+  other.slot_ = nullptr;
+}
 
-  mutex_->unlock();
+kvfs::OpenFilesCache::Handle &kvfs::OpenFilesCache::Handle::operator=(Handle &&other) noexcept {
+  if (this != &other) {
+    if (slot_) {
+      slot_->mutex_.unlock();
+    }
+    slot_ = other.slot_;
+    other.slot_ = nullptr;
+  }
+  return *this;
 }
-void kvfs::OpenFilesCache::Size(size_t &size_cache_list, size_t &size_cache_map) {
-  size_cache_map = cache_.size();
-  size_cache_list = lookup_.size();
+
+kvfs::OpenFilesCache::Handle::~Handle() {
+  if (slot_) {
+    slot_->mutex_.unlock();
+  }
 }
-kvfs::OpenFilesCache::~OpenFilesCache() {
-  mutex_.reset();
-}
\ No newline at end of file
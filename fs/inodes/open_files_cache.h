@@ -11,57 +11,115 @@
 #define KVFS_DIRECTORY_ENTRY_CACHE_H
 
 #include <kvfs_store/kvfs_store_entry.h>
+#include <inodes/open_inode_table.h>
+#include <filesystem>
 #include <mutex>
-#include <list>
-#include <unordered_map>
+#include <atomic>
 #include <memory>
+#include <cstdint>
 
 namespace kvfs {
 
 struct kvfsFileHandle {
-  kvfsInodeKey key_;
-  kvfsInodeValue md_;
+  // shared with every other descriptor open on the same file
+  std::shared_ptr<kvfsOpenInode> inode_;
   int flags_{};
   kvfs_off_t offset_{};
+  // real absolute path it was opened with, the *At calls resolve relative names from it
+  std::filesystem::path path_;
 
   kvfsFileHandle() = default;
-  kvfsFileHandle(const kvfsInodeKey &key, const kvfsInodeValue &md, int flags)
-      : key_(key), md_(md), flags_(flags) {};
-};
-
-struct OpenFilesCacheComparator {
-  bool operator()(const int &lhs, const int &rhs) const;
-};
-
-struct OpenFilesCacheHash {
-  std::size_t operator()(const int &x) const;
+  kvfsFileHandle(std::shared_ptr<kvfsOpenInode> inode, int flags)
+      : inode_(std::move(inode)), flags_(flags) {};
 };
 
+/**
+ * The open file descriptors, a table of KVFS_MAX_OPEN_FILES slots indexed by the descriptor.
+ *
+ * Slots never move, a handle is used in place while its slot's lock is held, and nothing is allocated
+ * per call. Free descriptors are kept on a lock-free stack threaded through the slots, so
+ * opening and closing only contend on the slot they take.
+ */
 class OpenFilesCache {
+ private:
+  struct alignas(64) Slot {
+    std::mutex mutex_;
+    bool open_{false};
+    // next free descriptor while this one is free
+    std::atomic<uint32_t> next_free_{0};
+    kvfsFileHandle handle_;
+  };
+
  public:
-  typedef std::pair<int, kvfsFileHandle> Entry;
-  typedef std::list<Entry> CacheList;
-  typedef std::unordered_map<int, std::list<Entry>::iterator,
-                             OpenFilesCacheHash, OpenFilesCacheComparator> CacheMap;
+  /**
+   * The handle of an open descriptor, its slot stays locked until this goes out of scope.
+   */
+  class Handle {
+   public:
+    Handle() = default;
+    Handle(Handle &&other) noexcept;
+    Handle &operator=(Handle &&other) noexcept;
+    Handle(const Handle &) = delete;
+    Handle &operator=(const Handle &) = delete;
+    ~Handle();
+
+    explicit operator bool() const { return slot_ != nullptr; }
+    kvfsFileHandle &operator*() const { return slot_->handle_; }
+    kvfsFileHandle *operator->() const { return &slot_->handle_; }
+
+   private:
+    friend class OpenFilesCache;
+    explicit Handle(Slot *slot) : slot_(slot) {}
+    Slot *slot_{nullptr};
+  };
 
   explicit OpenFilesCache(size_t size);
 
-  bool Find(const int &filedes, kvfsFileHandle &value);
-
-  void Insert(const int &filedes, kvfsFileHandle &value);
-
-  void Evict(const int &filedes);
-
-  void Size(size_t &size_cache_list, size_t &size_cache_map);
-
-  ~OpenFilesCache();;
+  /**
+   * Take a free descriptor for the handle.
+   * @return the descriptor, or -1 if all of them are open.
+   */
+  int Insert(kvfsFileHandle handle);
+
+  /**
+   * @return the handle of filedes locked for the caller, empty if filedes is not open.
+   * For the calls that move the offset, others use Copy so they do not wait for each other.
+   */
+  Handle Find(int filedes);
+
+  /**
+   * Copy the inode, flags and offset of filedes into handle, its path is left out.
+   * The slot is only locked while copying; the inode is shared, so the copy works on the same file.
+   * @return false if filedes is not open.
+   */
+  bool Copy(int filedes, kvfsFileHandle *handle);
+
+  /**
+   * Close filedes and free it for reuse.
+   * @param handle if not nullptr, gets the handle it had.
+   * @return false if filedes was not open.
+   */
+  bool Evict(int filedes, kvfsFileHandle *handle = nullptr);
+
+  /**
+   * @return the number of open descriptors.
+   */
+  size_t Size() const;
+
+  ~OpenFilesCache();
 
  private:
-  size_t maxsize_;
-  CacheList cache_;
-  CacheMap lookup_;
-  std::unique_ptr<std::mutex> mutex_;
+  static const uint32_t kNoSlot = UINT32_MAX;
 
+  size_t maxsize_;
+  std::unique_ptr<Slot[]> slots_;
+  // top of the free stack in the low half, a count bumped by every change in the high half,
+  // so a slot popped and pushed back in between is not mistaken for an unchanged stack
+  std::atomic<uint64_t> free_head_;
+  std::atomic<size_t> open_count_{0};
+
+  uint32_t PopFree();
+  void PushFree(uint32_t index);
 };
 }  // namespace kvfs
 #endif //KVFS_DIRECTORY_ENTRY_CACHE_H
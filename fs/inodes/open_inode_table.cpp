@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   open_inode_table.cpp
+ */
+
+#include "open_inode_table.h"
+
+namespace kvfs {
+
+OpenInodeTable::OpenInodeTable() : mutex_(std::make_unique<std::mutex>()) {}
+
+std::shared_ptr<kvfsOpenInode> OpenInodeTable::Acquire(const kvfsInodeKey &key) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  auto it = table_.find(key);
+  if (it == table_.end()) {
+    return nullptr;
+  }
+  ++it->second->refs_;
+  return it->second;
+}
+
+std::shared_ptr<kvfsOpenInode> OpenInodeTable::Insert(const kvfsInodeKey &key, const kvfsInodeValue &md) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  auto it = table_.find(key);
+  if (it == table_.end()) {
+    it = table_.emplace(key, std::make_shared<kvfsOpenInode>(key, md)).first;
+  }
+  ++it->second->refs_;
+  return it->second;
+}
+
+bool OpenInodeTable::Release(const std::shared_ptr<kvfsOpenInode> &inode) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  if (inode->refs_ == 0) {
+    return false;
+  }
+  return --inode->refs_ == 0 && inode->attached_;
+}
+
+void OpenInodeTable::Forget(const std::shared_ptr<kvfsOpenInode> &inode) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  auto it = table_.find(inode->key_);
+  if (it != table_.end() && it->second == inode && inode->refs_ == 0) {
+    table_.erase(it);
+  }
+}
+
+bool OpenInodeTable::Attached(const std::shared_ptr<kvfsOpenInode> &inode) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  return inode->attached_;
+}
+
+void OpenInodeTable::Detach(const kvfsInodeKey &key) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  auto it = table_.find(key);
+  if (it != table_.end()) {
+    it->second->attached_ = false;
+    table_.erase(it);
+  }
+}
+
+void OpenInodeTable::Rekey(const kvfsInodeKey &old_key, const kvfsInodeKey &new_key, const kvfsInodeValue &md) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  auto it = table_.find(old_key);
+  if (it == table_.end()) {
+    return;
+  }
+  std::shared_ptr<kvfsOpenInode> inode = it->second;
+  table_.erase(it);
+  inode->key_ = new_key;
+  inode->md_ = md;
+  table_[new_key] = inode;
+}
+
+void OpenInodeTable::Update(const kvfsInodeKey &key, const kvfsInodeValue &md) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  auto it = table_.find(key);
+  if (it != table_.end()) {
+    it->second->md_ = md;
+  }
+}
+
+void OpenInodeTable::Overlay(const kvfsInodeKey &key, kvfsInodeValue *md) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  auto it = table_.find(key);
+  if (it != table_.end() && (it->second->dirty_ || it->second->times_dirty_)) {
+    *md = it->second->md_;
+  }
+}
+
+std::vector<std::shared_ptr<kvfsOpenInode>> OpenInodeTable::Snapshot() {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  std::vector<std::shared_ptr<kvfsOpenInode>> inodes;
+  inodes.reserve(table_.size());
+  for (const auto &entry : table_) {
+    inodes.push_back(entry.second);
+  }
+  return inodes;
+}
+
+size_t OpenInodeTable::Size() {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  return table_.size();
+}
+
+}  // namespace kvfs
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   open_inode_table.h
+ */
+
+#ifndef KVFS_OPEN_INODE_TABLE_H
+#define KVFS_OPEN_INODE_TABLE_H
+
+#include <inodes/inode_cache.h>
+#include <kvfs_store/kvfs_store_entry.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+namespace kvfs {
+
+/**
+ * The in memory inode of an open file, shared by every descriptor open on it.
+ * Its fields change under the inode's lock, see InodeLocks, refs_ and attached_ under the table's mutex.
+ */
+struct kvfsOpenInode {
+  kvfsInodeKey key_;
+  kvfsInodeValue md_;
+  // the inode was changed through one of the descriptors, it is written back on the last close or a sync
+  bool dirty_{false};
+  // only the times of the inode changed, when they are written depends on the time policy
+  bool times_dirty_{false};
+  // blocks or the inode were written to the store since the file was last synced, a loaded inode may
+  // have been written through descriptors closed before, so it starts out unsynced
+  bool unsynced_{true};
+  // size of the file as of its last sync, fdatasync writes the inode back only when it differs
+  kvfs_off_t synced_size_;
+  // readers update the access time holding the inode's lock shared, this orders them
+  std::mutex times_mutex_;
+  // descriptors open on it
+  size_t refs_{0};
+  // false once its entry is removed, it is not written back any more
+  bool attached_{true};
+
+  kvfsOpenInode(const kvfsInodeKey &key, const kvfsInodeValue &md)
+      : key_(key), md_(md), synced_size_(md.fstat_.st_size) {}
+};
+
+/**
+ * Inodes of the open files by the key of their entry, counted by the descriptors open on them.
+ *
+ * The first open loads the inode from the store, the others share it and don't read the store at all.
+ * On the last close the caller writes it back and then Forget()s it, it stays in the table until then so
+ * an open in between takes the in memory inode instead of reading one that is not written yet.
+ * Operations on the entry by path keep it current: Update() after changing it, Rekey() after a rename
+ * and Detach() after removing it.
+ */
+class OpenInodeTable {
+ public:
+  OpenInodeTable();
+
+  /**
+   * @return the open inode of key with a reference taken on it, nullptr if it is not open.
+   */
+  std::shared_ptr<kvfsOpenInode> Acquire(const kvfsInodeKey &key);
+
+  /**
+   * Open md as the inode of key and take a reference on it. If it was opened in the meantime, that one is
+   * taken and md is dropped.
+   */
+  std::shared_ptr<kvfsOpenInode> Insert(const kvfsInodeKey &key, const kvfsInodeValue &md);
+
+  /**
+   * Drop a reference.
+   * @return true if it was the last one and the inode is still attached, the caller writes it back
+   * and calls Forget().
+   */
+  bool Release(const std::shared_ptr<kvfsOpenInode> &inode);
+
+  /**
+   * Remove the inode, unless it was acquired again after its last Release().
+   */
+  void Forget(const std::shared_ptr<kvfsOpenInode> &inode);
+
+  /**
+   * @return false if the entry of the inode was removed since it was opened.
+   */
+  bool Attached(const std::shared_ptr<kvfsOpenInode> &inode);
+
+  /**
+   * The entry of key was removed, its descriptors keep their inode but it is never written back.
+   */
+  void Detach(const kvfsInodeKey &key);
+
+  /**
+   * The entry of old_key was renamed to new_key with md, its descriptors follow it.
+   */
+  void Rekey(const kvfsInodeKey &old_key, const kvfsInodeKey &new_key, const kvfsInodeValue &md);
+
+  /**
+   * The entry of key was changed to md by path, the caller holds the inode's lock.
+   */
+  void Update(const kvfsInodeKey &key, const kvfsInodeValue &md);
+
+  /**
+   * Replace md with the open inode of key if that has changes not written yet, the caller holds
+   * the inode's lock.
+   */
+  void Overlay(const kvfsInodeKey &key, kvfsInodeValue *md);
+
+  /**
+   * @return every open inode, i.e. to write them back on a sync.
+   */
+  std::vector<std::shared_ptr<kvfsOpenInode>> Snapshot();
+
+  size_t Size();
+
+  ~OpenInodeTable() = default;
+
+ private:
+  std::unordered_map<kvfsInodeKey, std::shared_ptr<kvfsOpenInode>, InodeCacheHash, InodeCacheComparator> table_;
+  std::unique_ptr<std::mutex> mutex_;
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_OPEN_INODE_TABLE_H
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   timestamp_cache.cpp
+ */
+
+#include "timestamp_cache.h"
+
+namespace kvfs {
+
+namespace {
+inline bool Later(const struct timespec &a, const struct timespec &b) {
+  return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+}  // namespace
+
+TimestampCache::TimestampCache() : oldest_(0), mutex_(std::make_unique<std::mutex>()) {}
+
+void TimestampCache::Record(const kvfsInodeKey &key, const kvfs_stat &stat) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  time_t now = std::time(nullptr);
+  auto it = times_.find(key);
+  if (it == times_.end()) {
+    if (times_.empty()) {
+      oldest_ = now;
+    }
+    times_.emplace(key, Times{stat.st_atim, stat.st_mtim});
+    return;
+  }
+  if (Later(stat.st_atim, it->second.atim_)) {
+    it->second.atim_ = stat.st_atim;
+  }
+  if (Later(stat.st_mtim, it->second.mtim_)) {
+    it->second.mtim_ = stat.st_mtim;
+  }
+}
+
+bool TimestampCache::Apply(const kvfsInodeKey &key, kvfs_stat *stat) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  auto it = times_.find(key);
+  if (it == times_.end()) {
+    return false;
+  }
+  ApplyTimes(it->second, stat);
+  return true;
+}
+
+void TimestampCache::Forget(const kvfsInodeKey &key) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  times_.erase(key);
+}
+
+bool TimestampCache::Due(time_t max_age, size_t max_entries) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  if (times_.empty()) {
+    return false;
+  }
+  return times_.size() >= max_entries || std::time(nullptr) - oldest_ >= max_age;
+}
+
+bool TimestampCache::Empty() {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  return times_.empty();
+}
+
+TimestampCache::TimesMap TimestampCache::Take() {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  TimesMap taken;
+  taken.swap(times_);
+  return taken;
+}
+
+void TimestampCache::ApplyTimes(const Times &times, kvfs_stat *stat) {
+  if (Later(times.atim_, stat->st_atim)) {
+    stat->st_atim = times.atim_;
+  }
+  if (Later(times.mtim_, stat->st_mtim)) {
+    stat->st_mtim = times.mtim_;
+  }
+}
+
+}  // namespace kvfs
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   timestamp_cache.h
+ */
+
+#ifndef KVFS_TIMESTAMP_CACHE_H
+#define KVFS_TIMESTAMP_CACHE_H
+
+#include <inodes/inode_cache.h>
+#include <kvfs_store/kvfs_store_entry.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+namespace kvfs {
+
+/**
+ * Timestamps of entries that changed nothing but their times, held in memory by the lazytime policy
+ * until they are written to the store in one batch.
+ * Only the times are kept and they are applied on top of what is in the store when written, so an entry
+ * that was rewritten in between keeps its other changes and the later of each time.
+ * Lookups of an entry MUST go through Apply() so they see the times that are not written yet.
+ */
+class TimestampCache {
+ public:
+  struct Times {
+    struct timespec atim_;
+    struct timespec mtim_;
+  };
+  typedef std::unordered_map<kvfsInodeKey, Times, InodeCacheHash, InodeCacheComparator> TimesMap;
+
+  TimestampCache();
+
+  /**
+   * Record the times of an entry, the later of each time is kept.
+   */
+  void Record(const kvfsInodeKey &key, const kvfs_stat &stat);
+
+  /**
+   * Move the recorded times of an entry onto stat if they are later.
+   * @return true if the entry has recorded times.
+   */
+  bool Apply(const kvfsInodeKey &key, kvfs_stat *stat);
+
+  /**
+   * Drop the recorded times of an entry, i.e. when its times are set explicitly.
+   */
+  void Forget(const kvfsInodeKey &key);
+
+  /**
+   * @return true if the oldest recorded entry is at least max_age seconds old or there are
+   * at least max_entries of them.
+   */
+  bool Due(time_t max_age, size_t max_entries);
+
+  bool Empty();
+
+  /**
+   * Remove every recorded entry and return them, the caller writes them.
+   */
+  TimesMap Take();
+
+  /**
+   * Move times onto stat where they are later.
+   */
+  static void ApplyTimes(const Times &times, kvfs_stat *stat);
+
+  ~TimestampCache() = default;
+
+ private:
+  TimesMap times_;
+  // when the first of the recorded entries was recorded
+  time_t oldest_;
+  std::unique_ptr<std::mutex> mutex_;
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_TIMESTAMP_CACHE_H
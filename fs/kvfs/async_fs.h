@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   async_fs.h
+ */
+
+#ifndef KVFS_ASYNC_FS_H
+#define KVFS_ASYNC_FS_H
+
+#if !defined(__cpp_impl_coroutine)
+#error "kvfs/async_fs.h needs C++20 coroutines"
+#endif
+
+#include <kvfs/async_queue.h>
+#include <coroutine>
+#include <cstdint>
+
+namespace kvfs {
+
+/**
+ * Awaitable file system calls for coroutines, e.g. ssize_t read = co_await fs.ReadAsync(fd, buf, n, off).
+ *
+ * The calls are run by the workers of an AsyncQueue and the awaiting coroutine is resumed on the worker
+ * as soon as its call is done, there is no hop back to another thread. The awaiter lives in the frame of
+ * the coroutine and is the user_data of its request, nothing is allocated per call; opens and stats
+ * copy their path as with AsyncQueue::Submit. When the queue is full the call runs on the awaiting
+ * thread instead and the coroutine is not suspended.
+ *
+ * Each call resumes with what the synchronous call would have returned, or -errno if it failed.
+ * Relative paths are resolved against the working directory of the thread the coroutine awaits on,
+ * which after the first call is a worker at "/", so coroutines are best given absolute paths.
+ * This header is for C++20 callers only, the library itself is built as C++17.
+ */
+class AsyncFS {
+ public:
+  class Awaiter {
+   public:
+    Awaiter(AsyncQueue *queue, const kvfs_io_request &request) : queue_(queue), request_(request) {}
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      handle_ = handle;
+      request_.user_data = reinterpret_cast<uintptr_t>(this);
+      if (queue_->Submit(&request_, 1) == 1) {
+        // the worker may already have resumed the coroutine, this must not be touched from here on
+        return true;
+      }
+      result_ = queue_->ExecuteNow(request_);
+      return false;
+    }
+
+    ssize_t await_resume() const noexcept {
+      return result_;
+    }
+
+   private:
+    friend class AsyncFS;
+    AsyncQueue *queue_;
+    kvfs_io_request request_;
+    std::coroutine_handle<> handle_;
+    ssize_t result_ = 0;
+  };
+
+  /**
+   * options.on_complete is replaced, see AsyncQueue for the rest. Leave options.entries at least as
+   * large as the number of coroutines that await at once, or the calls beyond it block their threads.
+   */
+  explicit AsyncFS(FS *fs, kvfs_async_options options = kvfs_async_options())
+      : queue_(fs, WithResume(options)) {}
+
+  Awaiter ReadAsync(int fd, void *buffer, size_t size, off_t offset) {
+    kvfs_io_request request;
+    request.opcode = KVFS_IO_READ;
+    request.fd = fd;
+    request.buffer = buffer;
+    request.size = size;
+    request.offset = offset;
+    return Awaiter(&queue_, request);
+  }
+
+  Awaiter WriteAsync(int fd, const void *buffer, size_t size, off_t offset) {
+    kvfs_io_request request;
+    request.opcode = KVFS_IO_WRITE;
+    request.fd = fd;
+    request.buffer = const_cast<void *>(buffer);
+    request.size = size;
+    request.offset = offset;
+    return Awaiter(&queue_, request);
+  }
+
+  Awaiter OpenAsync(const char *path, int flags, mode_t mode = 0) {
+    kvfs_io_request request;
+    request.opcode = KVFS_IO_OPEN;
+    request.path = path;
+    request.flags = flags;
+    request.mode = mode;
+    return Awaiter(&queue_, request);
+  }
+
+  Awaiter CloseAsync(int fd) {
+    kvfs_io_request request;
+    request.opcode = KVFS_IO_CLOSE;
+    request.fd = fd;
+    return Awaiter(&queue_, request);
+  }
+
+  Awaiter StatAsync(const char *path, kvfs_stat *buf) {
+    kvfs_io_request request;
+    request.opcode = KVFS_IO_STAT;
+    request.path = path;
+    request.stat = buf;
+    return Awaiter(&queue_, request);
+  }
+
+  Awaiter FSyncAsync(int fd) {
+    kvfs_io_request request;
+    request.opcode = KVFS_IO_FSYNC;
+    request.fd = fd;
+    return Awaiter(&queue_, request);
+  }
+
+  Awaiter FDataSyncAsync(int fd) {
+    kvfs_io_request request;
+    request.opcode = KVFS_IO_FDATASYNC;
+    request.fd = fd;
+    return Awaiter(&queue_, request);
+  }
+
+ private:
+  AsyncQueue queue_;
+
+  static kvfs_async_options WithResume(kvfs_async_options options) {
+    options.on_complete = &AsyncFS::Resume;
+    return options;
+  }
+
+  static void Resume(const kvfs_io_completion &completion) {
+    auto *awaiter = reinterpret_cast<Awaiter *>(completion.user_data);
+    awaiter->result_ = completion.result;
+    awaiter->handle_.resume();
+  }
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_ASYNC_FS_H
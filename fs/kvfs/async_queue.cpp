@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   async_queue.cpp
+ */
+
+#include <kvfs/async_queue.h>
+#include <kvfs/fs_error.h>
+#include <kvfs/session.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+
+namespace kvfs {
+
+namespace {
+// most requests a worker takes off the submission queue at once
+const size_t kMaxBatch = 32;
+}  // namespace
+
+AsyncQueue::AsyncQueue(FS *fs, const kvfs_async_options &options)
+    : fs_(fs),
+      entries_(std::max(options.entries, 1u)),
+      on_complete_(options.on_complete),
+      event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      in_flight_(0),
+      stop_(false) {
+  if (event_fd_ < 0) {
+    throw FSError(FSErrorType::FS_EIO, "cannot create the completion eventfd");
+  }
+  std::shared_ptr<kvfsSession> session = fs_->GetSession();
+  uid_ = session->uid_;
+  gid_ = session->gid_;
+  unsigned threads = options.threads ? options.threads : std::max(std::thread::hardware_concurrency(), 1u);
+#if !KVFS_THREAD_SAFE
+  threads = 1;
+#endif
+  threads_ = threads;
+  for (unsigned i = 0; i < threads; ++i) {
+    workers_.emplace_back(&AsyncQueue::Run, this);
+  }
+}
+
+AsyncQueue::~AsyncQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+  close(event_fd_);
+}
+
+size_t AsyncQueue::Submit(const kvfs_io_request *requests, size_t count) {
+  size_t room;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    room = entries_ - in_flight_;
+  }
+  count = std::min(count, room);
+  if (count == 0) {
+    return 0;
+  }
+
+  std::vector<Request> copies(count);
+  std::string cwd;
+  for (size_t i = 0; i < count; ++i) {
+    copies[i].io_ = requests[i];
+    const char *path = requests[i].path;
+    if (path == nullptr) {
+      continue;
+    }
+    if (path[0] != '/' && path[0] != '\0') {
+      if (cwd.empty()) {
+        cwd = fs_->GetCurrentDirName();
+      }
+      copies[i].path_ = cwd == "/" ? cwd + path : cwd + "/" + path;
+    } else {
+      copies[i].path_ = path;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // another thread may have submitted in between
+  count = std::min(count, entries_ - in_flight_);
+  for (size_t i = 0; i < count; ++i) {
+    submitted_.push_back(std::move(copies[i]));
+  }
+  in_flight_ += count;
+  if (count > 1) {
+    work_cv_.notify_all();
+  } else if (count == 1) {
+    work_cv_.notify_one();
+  }
+  return count;
+}
+
+size_t AsyncQueue::Poll(kvfs_io_completion *completions, size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return Reap(completions, count);
+}
+
+size_t AsyncQueue::Wait(kvfs_io_completion *completions, size_t count, size_t min_complete) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  min_complete = std::min(min_complete, count);
+  done_cv_.wait(lock, [&] { return completed_.size() >= min_complete || completed_.size() == in_flight_; });
+  return Reap(completions, count);
+}
+
+ssize_t AsyncQueue::ExecuteNow(const kvfs_io_request &request) {
+  Request copy{request, request.path ? request.path : ""};
+  return Execute(copy, fs_->GetSession().get());
+}
+
+int AsyncQueue::EventFD() const {
+  return event_fd_;
+}
+
+size_t AsyncQueue::InFlight() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return in_flight_;
+}
+
+size_t AsyncQueue::Reap(kvfs_io_completion *completions, size_t count) {
+  size_t reaped = std::min(count, completed_.size());
+  std::copy(completed_.begin(), completed_.begin() + reaped, completions);
+  completed_.erase(completed_.begin(), completed_.begin() + reaped);
+  in_flight_ -= reaped;
+  if (reaped > 0 && completed_.empty()) {
+    // posted under the same lock, so the eventfd is readable exactly while completed_ is not empty
+    uint64_t value;
+    ssize_t ignored = read(event_fd_, &value, sizeof(value));
+    (void) ignored;
+  }
+  return reaped;
+}
+
+void AsyncQueue::Run() {
+  std::shared_ptr<kvfsSession> session = fs_->NewSession(uid_, gid_);
+  fs_->AttachSession(session);
+  std::vector<Request> batch;
+  std::vector<kvfs_io_completion> completions;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this] { return !submitted_.empty() || stop_; });
+      if (submitted_.empty()) {
+        return;
+      }
+      // an even share of what is queued, the other workers take the rest
+      size_t share = std::min((submitted_.size() + threads_ - 1) / threads_, kMaxBatch);
+      for (size_t i = 0; i < share; ++i) {
+        batch.push_back(std::move(submitted_.front()));
+        submitted_.pop_front();
+      }
+    }
+    Execute(&batch, &completions, session.get());
+    if (on_complete_ != nullptr) {
+      for (const kvfs_io_completion &completion : completions) {
+        on_complete_(completion);
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_ -= completions.size();
+    } else {
+      std::lock_guard<std::mutex> lock(mutex_);
+      bool was_empty = completed_.empty();
+      completed_.insert(completed_.end(), completions.begin(), completions.end());
+      if (was_empty) {
+        uint64_t one = 1;
+        ssize_t ignored = write(event_fd_, &one, sizeof(one));
+        (void) ignored;
+      }
+    }
+    done_cv_.notify_all();
+    batch.clear();
+    completions.clear();
+  }
+}
+
+void AsyncQueue::Execute(std::vector<Request> *requests,
+                         std::vector<kvfs_io_completion> *completions,
+                         kvfsSession *session) {
+  // a sync covers the whole file, one call covers every fsync or fdatasync of a descriptor in the batch
+  std::map<std::pair<int, kvfs_io_opcode>, ssize_t> synced;
+  for (const Request &request : *requests) {
+    ssize_t result;
+    if (request.io_.opcode == KVFS_IO_FSYNC || request.io_.opcode == KVFS_IO_FDATASYNC) {
+      auto key = std::make_pair(request.io_.fd, request.io_.opcode);
+      auto it = synced.find(key);
+      if (it == synced.end()) {
+        it = synced.emplace(key, Execute(request, session)).first;
+      }
+      result = it->second;
+    } else {
+      result = Execute(request, session);
+    }
+    completions->push_back(kvfs_io_completion{request.io_.user_data, result});
+  }
+}
+
+ssize_t AsyncQueue::Execute(const Request &request, kvfsSession *session) {
+  const kvfs_io_request &io = request.io_;
+  session->errorno_ = 0;
+  ssize_t result;
+  try {
+    switch (io.opcode) {
+      case KVFS_IO_READ:
+        result = io.offset == -1 ? fs_->Read(io.fd, io.buffer, io.size)
+                                 : fs_->PRead(io.fd, io.buffer, io.size, io.offset);
+        break;
+      case KVFS_IO_WRITE:
+        result = io.offset == -1 ? fs_->Write(io.fd, io.buffer, io.size)
+                                 : fs_->PWrite(io.fd, io.buffer, io.size, io.offset);
+        break;
+      case KVFS_IO_OPEN:
+        if (io.path == nullptr) {
+          return -EFAULT;
+        }
+        result = fs_->Open(request.path_.c_str(), io.flags, io.mode);
+        break;
+      case KVFS_IO_CLOSE:
+        result = fs_->Close(io.fd);
+        break;
+      case KVFS_IO_STAT:
+        if (io.path == nullptr || io.stat == nullptr) {
+          return -EFAULT;
+        }
+        result = fs_->Stat(request.path_.c_str(), io.stat);
+        break;
+      case KVFS_IO_FSYNC:
+        result = fs_->FSync(io.fd);
+        break;
+      case KVFS_IO_FDATASYNC:
+        result = fs_->FDataSync(io.fd);
+        break;
+      default:
+        return -EINVAL;
+    }
+  } catch (FSError &) {
+    return session->errorno_ < 0 ? session->errorno_ : -EIO;
+  } catch (...) {
+    // anything else, from the allocator or the host file system, must not end the worker
+    return -EIO;
+  }
+  if (result == -1 && session->errorno_ < 0) {
+    result = session->errorno_;
+  }
+  return result;
+}
+
+}  // namespace kvfs
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   async_queue.h
+ */
+
+#ifndef KVFS_ASYNC_QUEUE_H
+#define KVFS_ASYNC_QUEUE_H
+
+#include <kvfs/fs.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace kvfs {
+
+/**
+ * Runs file system calls in the background, in the manner of io_uring.
+ *
+ * Requests are copied onto a submission queue by Submit and a pool of worker threads runs them against
+ * the file system with the ordinary calls, every worker on a session with the credentials of the thread
+ * that created the queue. Their results are put on a completion queue, which is reaped with Poll or Wait,
+ * and the eventfd returned by EventFD is readable whenever it is not empty, so it can be watched with
+ * poll or epoll next to other descriptors.
+ *
+ * A worker takes its share of what is queued at once and posts the completions of all of it together
+ * with a single wake up, and fsync requests taken together run once per descriptor.
+ * Requests run in no particular order and independent ones overlap, a request that needs the result of
+ * another, e.g. a read of the descriptor an open returns, is submitted once that one has completed.
+ * With options.on_complete the completions are handed to it on the worker instead, the way the
+ * coroutines of AsyncFS are resumed, and a request counts as reaped once it returns.
+ *
+ * Without KVFS_THREAD_SAFE there is a single worker and the file system must not be called from other
+ * threads while requests are in flight. The queue must be destroyed before the file system.
+ */
+class AsyncQueue {
+ public:
+  AsyncQueue(FS *fs, const kvfs_async_options &options = kvfs_async_options());
+
+  /**
+   * Queue up to count requests. Relative paths are resolved against the working directory of the
+   * calling thread.
+   * @return The number of requests queued from the start of requests, fewer than count if the queue
+   * holds options.entries requests that are not yet reaped.
+   */
+  size_t Submit(const kvfs_io_request *requests, size_t count);
+
+  /**
+   * Reap up to count completions without blocking.
+   * @return The number of completions stored in completions.
+   */
+  size_t Poll(kvfs_io_completion *completions, size_t count);
+
+  /**
+   * Reap up to count completions, blocking until at least min_complete of them are there or nothing
+   * is left in flight.
+   * @return The number of completions stored in completions.
+   */
+  size_t Wait(kvfs_io_completion *completions, size_t count, size_t min_complete = 1);
+
+  /**
+   * Run a request on the calling thread, as a worker would.
+   * @return The result its completion would have.
+   */
+  ssize_t ExecuteNow(const kvfs_io_request &request);
+
+  /**
+   * @return An eventfd that is readable while completions are waiting to be reaped.
+   */
+  int EventFD() const;
+
+  /**
+   * @return The number of requests submitted and not yet reaped.
+   */
+  size_t InFlight();
+
+  /**
+   * Waits for the requests in flight, their completions that are not reaped are dropped.
+   */
+  ~AsyncQueue();
+
+ private:
+  struct Request {
+    kvfs_io_request io_;
+    std::string path_;
+  };
+
+  FS *fs_;
+  uid_t uid_;
+  gid_t gid_;
+  size_t entries_;
+  size_t threads_;
+  kvfs_io_callback on_complete_;
+  int event_fd_;
+  std::deque<Request> submitted_;
+  std::deque<kvfs_io_completion> completed_;
+  // submitted and not yet reaped
+  size_t in_flight_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::vector<std::thread> workers_;
+
+  void Run();
+  void Execute(std::vector<Request> *requests,
+               std::vector<kvfs_io_completion> *completions,
+               kvfsSession *session);
+  ssize_t Execute(const Request &request, kvfsSession *session);
+  size_t Reap(kvfs_io_completion *completions, size_t count);
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_ASYNC_QUEUE_H
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   block_fetcher.cpp
+ */
+
+#include <kvfs/block_fetcher.h>
+#include <kvfs_config.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace kvfs {
+
+namespace {
+// blocks fetched by one MultiGet
+const size_t kChunkBlocks = 32;
+}  // namespace
+
+BlockFetcher::BlockFetcher(std::shared_ptr<KVStore> store, unsigned threads)
+    : store_(std::move(store)), stop_(false) {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  for (unsigned i = 0; i < threads; ++i) {
+    workers_.emplace_back(&BlockFetcher::Run, this);
+  }
+}
+
+BlockFetcher::~BlockFetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+}
+
+ssize_t BlockFetcher::Read(kvfs_file_inode_t inode,
+                           kvfs_off_t offset,
+                           size_t size,
+                           void *buffer,
+                           const KVStore::Snapshot *snapshot) {
+  if (size == 0) {
+    return 0;
+  }
+  auto job = std::make_shared<Job>();
+  job->inode_ = inode;
+  job->offset_ = offset;
+  job->size_ = size;
+  job->buffer_ = static_cast<char *>(buffer);
+  job->snapshot_ = snapshot;
+  size_t first = offset / KVFS_DEF_BLOCK_SIZE;
+  size_t last = (offset + size - 1) / KVFS_DEF_BLOCK_SIZE;
+  job->chunks_ = (last - first) / kChunkBlocks + 1;
+  job->read_.assign(job->chunks_, 0);
+
+  if (job->chunks_ > 1) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(job);
+    if (job->chunks_ - 1 >= workers_.size()) {
+      work_cv_.notify_all();
+    } else {
+      for (size_t i = 0; i + 1 < job->chunks_; ++i) {
+        work_cv_.notify_one();
+      }
+    }
+  }
+  Work(job.get());
+  if (job->chunks_ > 1) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find(jobs_.begin(), jobs_.end(), job);
+    if (it != jobs_.end()) {
+      jobs_.erase(it);
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lock(job->mutex_);
+    job->done_cv_.wait(lock, [&job] { return job->done_.load() == job->chunks_; });
+    if (job->error_) {
+      std::rethrow_exception(job->error_);
+    }
+  }
+
+  // the read ends at the first chunk that came back short
+  ssize_t read = 0;
+  for (size_t chunk = 0; chunk < job->chunks_; ++chunk) {
+    size_t start = chunk == 0 ? 0 : (first + chunk * kChunkBlocks) * KVFS_DEF_BLOCK_SIZE - offset;
+    size_t end = std::min(size, (first + (chunk + 1) * kChunkBlocks) * KVFS_DEF_BLOCK_SIZE - offset);
+    read += job->read_[chunk];
+    if (job->read_[chunk] < end - start) {
+      break;
+    }
+  }
+  return read;
+}
+
+void BlockFetcher::Run() {
+  while (true) {
+    std::shared_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this] { return !jobs_.empty() || stop_; });
+      if (stop_) {
+        return;
+      }
+      job = jobs_.front();
+      if (job->next_.load() >= job->chunks_) {
+        // every chunk is taken, the threads holding them finish the job
+        jobs_.pop_front();
+        continue;
+      }
+    }
+    Work(job.get());
+  }
+}
+
+void BlockFetcher::Work(Job *job) {
+  while (true) {
+    size_t chunk = job->next_.fetch_add(1);
+    if (chunk >= job->chunks_) {
+      return;
+    }
+    try {
+      job->read_[chunk] = FetchChunk(*job, chunk);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(job->mutex_);
+      if (!job->error_) {
+        job->error_ = std::current_exception();
+      }
+    }
+    if (job->done_.fetch_add(1) + 1 == job->chunks_) {
+      std::lock_guard<std::mutex> lock(job->mutex_);
+      job->done_cv_.notify_all();
+    }
+  }
+}
+
+size_t BlockFetcher::FetchChunk(const Job &job, size_t chunk) {
+  size_t first = job.offset_ / KVFS_DEF_BLOCK_SIZE + chunk * kChunkBlocks;
+  size_t position = chunk == 0 ? 0 : first * KVFS_DEF_BLOCK_SIZE - job.offset_;
+  size_t end = std::min(job.size_, (first + kChunkBlocks) * KVFS_DEF_BLOCK_SIZE - job.offset_);
+
+  std::vector<std::string> keys;
+  keys.reserve(kChunkBlocks);
+  for (size_t offset = position; offset < end;) {
+    size_t block = (job.offset_ + offset) / KVFS_DEF_BLOCK_SIZE;
+    keys.push_back(kvfsBlockKey(job.inode_, block).pack());
+    offset = (block + 1) * KVFS_DEF_BLOCK_SIZE - job.offset_;
+  }
+  std::vector<KVStoreResult> results = store_->MultiGet(keys, job.snapshot_);
+
+  size_t read = 0;
+  for (const KVStoreResult &result : results) {
+    if (!result.isValid() || result.asString().size() != sizeof(kvfsBlockValue)) {
+      break;
+    }
+    // the data is copied straight out of the value, as in ReadFilesMany
+    const char *value = result.asString().data();
+    size_t block_size;
+    memcpy(&block_size, value + offsetof(kvfsBlockValue, size_), sizeof(block_size));
+    size_t in_block = (job.offset_ + position) % KVFS_DEF_BLOCK_SIZE;
+    size_t want = std::min(end - position, KVFS_DEF_BLOCK_SIZE - in_block);
+    size_t have = block_size > in_block ? block_size - in_block : 0;
+    size_t copied = std::min(want, have);
+    memcpy(job.buffer_ + position, value + offsetof(kvfsBlockValue, data) + in_block, copied);
+    position += copied;
+    read += copied;
+    if (copied < want) {
+      break;
+    }
+  }
+  return read;
+}
+
+}  // namespace kvfs
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   block_fetcher.h
+ */
+
+#ifndef KVFS_BLOCK_FETCHER_H
+#define KVFS_BLOCK_FETCHER_H
+
+#include <kvfs_store/kvfs_store.h>
+#include <kvfs/kvfs_dirent.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kvfs {
+
+/**
+ * Reads the blocks of large reads concurrently.
+ *
+ * A read is cut into chunks of consecutive blocks, each fetched with one MultiGet and copied straight into
+ * its place in the caller's buffer. The chunks are shared out between a fixed pool of threads and the
+ * calling thread, which takes chunks as well and returns once all of them are done, so several reads can
+ * be running at once and none of them waits for a thread to be free.
+ */
+class BlockFetcher {
+ public:
+  /**
+   * @param threads number of pool threads, 0 for one per core.
+   */
+  BlockFetcher(std::shared_ptr<KVStore> store, unsigned threads);
+
+  /**
+   * Read size bytes of the file inode starting at offset into buffer, from snapshot unless it is nullptr.
+   * @return The number of bytes read, up to the first block that is missing or short.
+   */
+  ssize_t Read(kvfs_file_inode_t inode,
+               kvfs_off_t offset,
+               size_t size,
+               void *buffer,
+               const KVStore::Snapshot *snapshot);
+
+  ~BlockFetcher();
+
+ private:
+  struct Job {
+    kvfs_file_inode_t inode_;
+    kvfs_off_t offset_;
+    size_t size_;
+    char *buffer_;
+    const KVStore::Snapshot *snapshot_;
+    size_t chunks_;
+    // next chunk to take and chunks finished
+    std::atomic<size_t> next_{0};
+    std::atomic<size_t> done_{0};
+    // bytes read by each chunk
+    std::vector<size_t> read_;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable done_cv_;
+  };
+
+  std::shared_ptr<KVStore> store_;
+  std::deque<std::shared_ptr<Job>> jobs_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::vector<std::thread> workers_;
+
+  void Run();
+  // take chunks of job until there are none left
+  void Work(Job *job);
+  size_t FetchChunk(const Job &job, size_t chunk);
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_BLOCK_FETCHER_H
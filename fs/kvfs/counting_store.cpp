@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   counting_store.cpp
+ */
+
+#include <kvfs/counting_store.h>
+
+namespace kvfs {
+
+namespace {
+
+class CountingWriteBatch : public KVStore::WriteBatch {
+ public:
+  CountingWriteBatch(std::unique_ptr<KVStore::WriteBatch> batch, std::shared_ptr<Stats> stats)
+      : batch_(std::move(batch)), stats_(std::move(stats)), pending_(0) {}
+
+  void Put(const std::string &key, const std::string &value) override {
+    batch_->Put(key, value);
+    stats_->Add(KVFS_COUNTER_STORE_KEYS_WRITTEN, 1);
+    stats_->Add(KVFS_COUNTER_STORE_BYTES_WRITTEN, key.size() + value.size());
+    ++pending_;
+  }
+  void Delete(const std::string &key) override {
+    batch_->Delete(key);
+    stats_->Add(KVFS_COUNTER_STORE_KEYS_DELETED, 1);
+    stats_->Add(KVFS_COUNTER_STORE_BYTES_WRITTEN, key.size());
+    ++pending_;
+  }
+  void Flush() override {
+    // flushing an empty batch writes nothing
+    if (pending_ == 0) {
+      batch_->Flush();
+      return;
+    }
+    Stats::Timer timer(stats_.get(), KVFS_OP_STORE_WRITE_BATCH);
+    batch_->Flush();
+    pending_ = 0;
+  }
+
+ private:
+  std::unique_ptr<KVStore::WriteBatch> batch_;
+  std::shared_ptr<Stats> stats_;
+  size_t pending_;
+};
+
+class CountingIterator : public KVStore::Iterator {
+ public:
+  CountingIterator(std::unique_ptr<KVStore::Iterator> iterator, std::shared_ptr<Stats> stats)
+      : iterator_(std::move(iterator)), stats_(std::move(stats)) {}
+
+  bool Valid() const override {
+    return iterator_->Valid();
+  }
+  void SeekToFirst() override {
+    Stats::Timer timer(stats_.get(), KVFS_OP_STORE_SEEK);
+    iterator_->SeekToFirst();
+  }
+  void SeekToLast() override {
+    Stats::Timer timer(stats_.get(), KVFS_OP_STORE_SEEK);
+    iterator_->SeekToLast();
+  }
+  void Seek(const std::string &target) override {
+    Stats::Timer timer(stats_.get(), KVFS_OP_STORE_SEEK);
+    iterator_->Seek(target);
+  }
+  void SeekForPrev(const std::string &target) override {
+    Stats::Timer timer(stats_.get(), KVFS_OP_STORE_SEEK);
+    iterator_->SeekForPrev(target);
+  }
+  void Next() override {
+    Stats::Timer timer(stats_.get(), KVFS_OP_STORE_NEXT);
+    iterator_->Next();
+  }
+  void Prev() override {
+    Stats::Timer timer(stats_.get(), KVFS_OP_STORE_NEXT);
+    iterator_->Prev();
+  }
+  std::string key() const override {
+    return iterator_->key();
+  }
+  KVStoreResult value() const override {
+    KVStoreResult value = iterator_->value();
+    if (value.isValid()) {
+      stats_->Add(KVFS_COUNTER_STORE_BYTES_READ, value.asString().size());
+    }
+    return value;
+  }
+  std::string_view key_view() const override {
+    return iterator_->key_view();
+  }
+  std::string_view value_view() const override {
+    std::string_view value = iterator_->value_view();
+    stats_->Add(KVFS_COUNTER_STORE_BYTES_READ, value.size());
+    return value;
+  }
+  bool status() const override {
+    return iterator_->status();
+  }
+  bool Refresh() override {
+    return iterator_->Refresh();
+  }
+
+ private:
+  std::unique_ptr<KVStore::Iterator> iterator_;
+  std::shared_ptr<Stats> stats_;
+};
+
+}  // namespace
+
+CountingStore::CountingStore(std::shared_ptr<KVStore> store, std::shared_ptr<Stats> stats)
+    : store_(std::move(store)), stats_(std::move(stats)) {}
+
+void CountingStore::Close() {
+  store_->Close();
+}
+
+bool CountingStore::Put(const std::string &key, const std::string &value) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_PUT);
+  timer.Add(KVFS_COUNTER_STORE_KEYS_WRITTEN, 1);
+  timer.Add(KVFS_COUNTER_STORE_BYTES_WRITTEN, key.size() + value.size());
+  return timer.Done(store_->Put(key, value));
+}
+
+bool CountingStore::Merge(const std::string &key, const std::string &value) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_MERGE);
+  timer.Add(KVFS_COUNTER_STORE_KEYS_WRITTEN, 1);
+  timer.Add(KVFS_COUNTER_STORE_BYTES_WRITTEN, key.size() + value.size());
+  return timer.Done(store_->Merge(key, value));
+}
+
+KVStoreResult CountingStore::Get(const std::string &key) {
+  return Get(key, nullptr);
+}
+
+std::vector<KVStoreResult> CountingStore::MultiGet(const std::vector<std::string> &keys) {
+  return MultiGet(keys, nullptr);
+}
+
+bool CountingStore::Delete(const std::string &key) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_DELETE);
+  timer.Add(KVFS_COUNTER_STORE_KEYS_DELETED, 1);
+  timer.Add(KVFS_COUNTER_STORE_BYTES_WRITTEN, key.size());
+  return timer.Done(store_->Delete(key));
+}
+
+bool CountingStore::DeleteRange(const std::string &start, const std::string &end) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_DELETE_RANGE);
+  timer.Add(KVFS_COUNTER_STORE_KEYS_DELETED, 1);
+  timer.Add(KVFS_COUNTER_STORE_BYTES_WRITTEN, start.size() + end.size());
+  return timer.Done(store_->DeleteRange(start, end));
+}
+
+std::vector<KVStoreResult> CountingStore::GetChildren(const std::string &key) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_GET_CHILDREN);
+  std::vector<KVStoreResult> children = store_->GetChildren(key);
+  for (const KVStoreResult &child : children) {
+    timer.Add(KVFS_COUNTER_STORE_BYTES_READ, child.isValid() ? child.asString().size() : 0);
+  }
+  return children;
+}
+
+KVStoreResult CountingStore::GetParent(const std::string &key) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_GET_PARENT);
+  KVStoreResult parent = store_->GetParent(key);
+  timer.Add(KVFS_COUNTER_STORE_BYTES_READ, parent.isValid() ? parent.asString().size() : 0);
+  return parent;
+}
+
+bool CountingStore::Sync() {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_SYNC);
+  return timer.Done(store_->Sync());
+}
+
+bool CountingStore::Compact() {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_COMPACT);
+  return timer.Done(store_->Compact());
+}
+
+bool CountingStore::Destroy() {
+  return store_->Destroy();
+}
+
+std::unique_ptr<KVStore::WriteBatch> CountingStore::GetWriteBatch() {
+  return std::make_unique<CountingWriteBatch>(store_->GetWriteBatch(), stats_);
+}
+
+std::unique_ptr<KVStore::Iterator> CountingStore::GetIterator() {
+  return GetIterator(nullptr);
+}
+
+std::shared_ptr<const KVStore::Snapshot> CountingStore::GetSnapshot() {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_SNAPSHOT);
+  return store_->GetSnapshot();
+}
+
+std::unique_ptr<KVStore::Iterator> CountingStore::GetIterator(const Snapshot *snapshot) {
+  return std::make_unique<CountingIterator>(store_->GetIterator(snapshot), stats_);
+}
+
+KVStoreResult CountingStore::Get(const std::string &key, const Snapshot *snapshot) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_GET);
+  timer.Add(KVFS_COUNTER_STORE_KEYS_READ, 1);
+  KVStoreResult value = store_->Get(key, snapshot);
+  if (value.isValid()) {
+    timer.Add(KVFS_COUNTER_STORE_BYTES_READ, value.asString().size());
+  }
+  return value;
+}
+
+std::vector<KVStoreResult> CountingStore::MultiGet(const std::vector<std::string> &keys, const Snapshot *snapshot) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STORE_MULTIGET);
+  timer.Add(KVFS_COUNTER_STORE_KEYS_READ, keys.size());
+  std::vector<KVStoreResult> values = store_->MultiGet(keys, snapshot);
+  uint64_t bytes = 0;
+  for (const KVStoreResult &value : values) {
+    bytes += value.isValid() ? value.asString().size() : 0;
+  }
+  timer.Add(KVFS_COUNTER_STORE_BYTES_READ, bytes);
+  return values;
+}
+
+}  // namespace kvfs
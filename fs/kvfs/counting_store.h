@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   counting_store.h
+ */
+
+#ifndef KVFS_COUNTING_STORE_H
+#define KVFS_COUNTING_STORE_H
+
+#include <kvfs_store/kvfs_store.h>
+#include <kvfs/stats.h>
+#include <memory>
+
+namespace kvfs {
+
+/**
+ * A store that passes the calls made to it on to another one and records them in stats, with their
+ * latency and the keys and bytes they read and write; the write batches and iterators it hands out
+ * record theirs as well.
+ */
+class CountingStore : public KVStore {
+ public:
+  CountingStore(std::shared_ptr<KVStore> store, std::shared_ptr<Stats> stats);
+
+ protected:
+  void Close() override;
+
+  bool Put(const std::string &key, const std::string &value) override;
+  bool Merge(const std::string &key, const std::string &value) override;
+
+  KVStoreResult Get(const std::string &key) override;
+  std::vector<KVStoreResult> MultiGet(const std::vector<std::string> &keys) override;
+
+  bool Delete(const std::string &key) override;
+  bool DeleteRange(const std::string &start, const std::string &end) override;
+
+  std::vector<KVStoreResult> GetChildren(const std::string &key) override;
+  KVStoreResult GetParent(const std::string &key) override;
+
+  bool Sync() override;
+
+  bool Compact() override;
+
+  bool Destroy() override;
+
+  std::unique_ptr<WriteBatch> GetWriteBatch() override;
+
+  std::unique_ptr<Iterator> GetIterator() override;
+
+  std::shared_ptr<const Snapshot> GetSnapshot() override;
+
+  std::unique_ptr<Iterator> GetIterator(const Snapshot *snapshot) override;
+
+  KVStoreResult Get(const std::string &key, const Snapshot *snapshot) override;
+  std::vector<KVStoreResult> MultiGet(const std::vector<std::string> &keys, const Snapshot *snapshot) override;
+
+ private:
+  std::shared_ptr<KVStore> store_;
+  // shared with the write batches and iterators, which may outlive the store
+  std::shared_ptr<Stats> stats_;
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_COUNTING_STORE_H
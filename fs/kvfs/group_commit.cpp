@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   group_commit.cpp
+ */
+
+#include <kvfs/group_commit.h>
+#include <algorithm>
+#include <thread>
+
+namespace kvfs {
+
+GroupCommit::GroupCommit(std::shared_ptr<KVStore> store, std::chrono::microseconds window)
+    : store_(std::move(store)), window_(window), ticket_(0), synced_(0), failed_(0), syncing_(false), syncs_(0) {}
+
+bool GroupCommit::Sync() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t ticket = ++ticket_;
+  while (synced_ < ticket && failed_ < ticket) {
+    if (syncing_) {
+      // the running sync may have started before the ticket was taken, it does not count
+      synced_cv_.wait(lock);
+      continue;
+    }
+    syncing_ = true;
+    if (window_.count() > 0) {
+      lock.unlock();
+      std::this_thread::sleep_for(window_);
+      lock.lock();
+    }
+    // every ticket taken so far belongs to a write that has finished, the sync covers them all
+    uint64_t covered = ticket_;
+    lock.unlock();
+    bool ok = false;
+    try {
+      ok = store_->Sync();
+    } catch (...) {
+      lock.lock();
+      syncing_ = false;
+      failed_ = std::max(failed_, covered);
+      synced_cv_.notify_all();
+      throw;
+    }
+    lock.lock();
+    syncing_ = false;
+    ++syncs_;
+    if (ok) {
+      synced_ = std::max(synced_, covered);
+    } else {
+      failed_ = std::max(failed_, covered);
+    }
+    synced_cv_.notify_all();
+  }
+  // a later sync that succeeded covers the ticket as well
+  return synced_ >= ticket;
+}
+
+uint64_t GroupCommit::Syncs() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return syncs_;
+}
+
+}  // namespace kvfs
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   group_commit.h
+ */
+
+#ifndef KVFS_GROUP_COMMIT_H
+#define KVFS_GROUP_COMMIT_H
+
+#include <kvfs_store/kvfs_store.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace kvfs {
+
+/**
+ * Shares one store sync between the callers that need one at the same time.
+ *
+ * A sync of the store makes every write that came before it durable, not only those of its caller.
+ * Each caller takes a ticket; the first one finding no sync running leads, waits out the window for
+ * others to join, and syncs once for every ticket taken until then. Callers that arrive while a sync
+ * is running wait for it and then for the next one, which the first of them leads, so n threads syncing
+ * at once need about two syncs between them rather than n.
+ * A caller returns only once a sync that began after its ticket was taken has finished.
+ */
+class GroupCommit {
+ public:
+  /**
+   * @param window how long a leader waits for more callers before it syncs, 0 to sync at once.
+   */
+  GroupCommit(std::shared_ptr<KVStore> store, std::chrono::microseconds window);
+
+  /**
+   * Make every write to the store that finished before the call durable.
+   * @return false if the sync covering the call failed.
+   */
+  bool Sync();
+
+  /**
+   * Number of store syncs done so far.
+   */
+  uint64_t Syncs();
+
+ private:
+  std::shared_ptr<KVStore> store_;
+  std::chrono::microseconds window_;
+  // last ticket taken, last ticket covered by a finished sync and by a failed one
+  uint64_t ticket_;
+  uint64_t synced_;
+  uint64_t failed_;
+  bool syncing_;
+  uint64_t syncs_;
+  std::mutex mutex_;
+  std::condition_variable synced_cv_;
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_GROUP_COMMIT_H
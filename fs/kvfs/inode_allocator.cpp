@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   inode_allocator.cpp
+ */
+
+#include <kvfs/inode_allocator.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace kvfs {
+
+namespace {
+const char *kAllocStateKey = "inodealloc";
+// allocators are told apart by id in the thread local leases, ids are never reused
+std::atomic<uint64_t> next_allocator_id{1};
+// a thread keeps leases of this many allocators before dropping the oldest
+const size_t kMaxThreadLeases = 8;
+// next_ of a lease while it is refilled, so ReturnLeases never pairs its old next_ with its new end_
+const kvfs_file_inode_t kRefilling = std::numeric_limits<kvfs_file_inode_t>::max();
+
+std::string FreedKey(kvfs_file_inode_t first) {
+  kvfsFreedInodesKey key{"freeinodes", first};
+  return key.pack();
+}
+std::string FreedValue(kvfs_file_inode_t count) {
+  kvfsFreedInodesValue value;
+  value.count_ = count;
+  return value.pack();
+}
+}  // namespace
+
+InodeAllocator::InodeAllocator(std::shared_ptr<KVStore> store, kvfs_file_inode_t lease_size)
+    : store_(std::move(store)),
+      lease_size_(std::max<kvfs_file_inode_t>(lease_size, 1)),
+      id_(next_allocator_id.fetch_add(1)),
+      high_water_(0),
+      freed_count_(0),
+      mutex_(std::make_unique<std::mutex>()) {}
+
+void InodeAllocator::Load(kvfs_file_inode_t first_inode) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  KVStoreResult sr = store_->Get(kAllocStateKey);
+  if (sr.isValid()) {
+    kvfsInodeAllocState state;
+    state.parse(sr);
+    high_water_ = state.high_water_;
+  } else {
+    high_water_ = first_inode;
+  }
+  high_water_ = std::max(high_water_, first_inode);
+
+  // only the freed runs are read, never the inodes themselves
+  RangeMap found;
+  std::string prefix = FreedKey(0).substr(0, sizeof(kvfsFreedInodesKey::name));
+  std::unique_ptr<KVStore::Iterator> it = store_->GetIterator();
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    std::string key_str = it->key();
+    if (key_str.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+    KVStoreResult value = it->value();
+    if (key_str.size() != prefix.size() + sizeof(kvfs_file_inode_t)
+        || value.asString().size() != sizeof(kvfsFreedInodesValue)) {
+      // written by the old fixed size freed inode lists, leave those numbers unused
+      continue;
+    }
+    kvfsFreedInodesKey key{};
+    key.parse(key_str);
+    kvfsFreedInodesValue fi_v;
+    fi_v.parse(value);
+    found[key.number_] = fi_v.count_;
+  }
+  it.reset();
+
+  // merge adjacent runs and rewrite them, so the records stay compact across mounts
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+  reusable_.clear();
+  for (const auto &run : found) {
+    if (!reusable_.empty()) {
+      auto last = std::prev(reusable_.end());
+      if (last->first + last->second == run.first) {
+        last->second += run.second;
+        batch->Delete(FreedKey(run.first));
+        batch->Put(FreedKey(last->first), FreedValue(last->second));
+        continue;
+      }
+    }
+    reusable_[run.first] = run.second;
+  }
+  batch->Flush();
+}
+
+kvfs_file_inode_t InodeAllocator::Allocate() {
+  Lease &lease = ThreadLease();
+  // the compare exchange only fails if ReturnLeases took the rest of the lease meanwhile
+  kvfs_file_inode_t next = lease.next_.load(std::memory_order_relaxed);
+  for (;;) {
+    if (next >= lease.end_.load(std::memory_order_relaxed)) {
+      Refill(lease);
+      next = lease.next_.load(std::memory_order_relaxed);
+      continue;
+    }
+    if (lease.next_.compare_exchange_weak(next, next + 1, std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  lease.allocated_count_.fetch_add(1, std::memory_order_relaxed);
+  return next;
+}
+
+void InodeAllocator::Free(kvfs_file_inode_t inode, KVStore::WriteBatch *batch) {
+  batch->Put(FreedKey(inode), FreedValue(1));
+  freed_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void InodeAllocator::ReturnLeases() {
+  // Refill takes mutex_, the leases are copied so a thread refilling is not held up by the puts
+  std::vector<std::shared_ptr<Lease>> leases;
+  {
+    std::lock_guard<std::mutex> lock(*mutex_);
+    leases = leases_;
+  }
+  for (const std::shared_ptr<Lease> &lease : leases) {
+    // the rest of the range is taken by moving next_ to end_, a thread allocating from the lease
+    // meanwhile either gets its number first or refills
+    kvfs_file_inode_t next = lease->next_.load();
+    kvfs_file_inode_t end = lease->end_.load();
+    while (next < end && !lease->next_.compare_exchange_weak(next, end)) {
+      end = lease->end_.load();
+    }
+    if (next >= end) {
+      // used up, or being refilled by a thread that is still allocating
+      continue;
+    }
+    if (!store_->Put(FreedKey(next), FreedValue(end - next))) {
+      throw FSError(FSErrorType::FS_EIO, "Failed to put freed inodes in store");
+    }
+  }
+}
+
+void InodeAllocator::UpdateSuperBlock(kvfsSuperBlock *super_block) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  uint64_t allocated = 0;
+  for (const std::shared_ptr<Lease> &lease : leases_) {
+    allocated += lease->allocated_count_.exchange(0);
+  }
+  uint64_t freed = freed_count_.exchange(0);
+  super_block->next_free_inode_ = high_water_;
+  super_block->total_inode_count_ += allocated;
+  super_block->total_inode_count_ -= std::min<uint64_t>(freed, super_block->total_inode_count_);
+  super_block->freed_inodes_count_ += freed;
+}
+
+InodeAllocator::Lease &InodeAllocator::ThreadLease() {
+  // the leases of this thread by allocator id, given up when the thread ends
+  thread_local struct ThreadLeases {
+    std::vector<std::pair<uint64_t, std::shared_ptr<Lease>>> leases_;
+    ~ThreadLeases() {
+      for (auto &lease : leases_) {
+        lease.second->in_use_.store(false);
+      }
+    }
+  } thread_leases;
+  auto &leases = thread_leases.leases_;
+  for (auto &lease : leases) {
+    if (lease.first == id_) {
+      return *lease.second;
+    }
+  }
+  if (leases.size() == kMaxThreadLeases) {
+    leases.front().second->in_use_.store(false);
+    leases.erase(leases.begin());
+  }
+  leases.emplace_back(id_, NewLease());
+  return *leases.back().second;
+}
+
+std::shared_ptr<InodeAllocator::Lease> InodeAllocator::NewLease() {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  for (const std::shared_ptr<Lease> &lease : leases_) {
+    bool in_use = false;
+    if (lease->in_use_.compare_exchange_strong(in_use, true)) {
+      // left by a thread, with what remains of its range
+      return lease;
+    }
+  }
+  leases_.push_back(std::make_shared<Lease>());
+  return leases_.back();
+}
+
+void InodeAllocator::Refill(Lease &lease) {
+  std::lock_guard<std::mutex> lock(*mutex_);
+  // only the owning thread refills, end_ is moved while next_ says there is nothing to take
+  lease.next_.store(kRefilling);
+  if (!reusable_.empty()) {
+    // the run is shrunk in the store before any of it is handed out
+    auto run = reusable_.begin();
+    kvfs_file_inode_t first = run->first;
+    kvfs_file_inode_t count = std::min(run->second, lease_size_);
+    kvfs_file_inode_t rest = run->second - count;
+    reusable_.erase(run);
+    std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+    batch->Delete(FreedKey(first));
+    if (rest > 0) {
+      reusable_[first + count] = rest;
+      batch->Put(FreedKey(first + count), FreedValue(rest));
+    }
+    batch->Flush();
+    lease.end_.store(first + count);
+    lease.next_.store(first);
+    return;
+  }
+  // the new high water mark is persisted before any number below it is handed out
+  kvfsInodeAllocState state;
+  state.high_water_ = high_water_ + lease_size_;
+  if (!store_->Put(kAllocStateKey, state.pack())) {
+    throw FSError(FSErrorType::FS_EIO, "Failed to put inode allocator state in store");
+  }
+  lease.end_.store(state.high_water_);
+  lease.next_.store(high_water_);
+  high_water_ = state.high_water_;
+}
+
+}  // namespace kvfs
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   inode_allocator.h
+ */
+
+#ifndef KVFS_INODE_ALLOCATOR_H
+#define KVFS_INODE_ALLOCATOR_H
+
+#include <kvfs_store/kvfs_store.h>
+#include <kvfs/super.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace kvfs {
+
+/**
+ * Hands out inode numbers from ranges leased to each thread, so an allocation is an increment
+ * on a lease no other thread allocates from, without a lock, and only every lease_size allocations
+ * touch the store. Every lease is registered with the allocator, so unmount gives back the unused
+ * numbers of all threads; a lease left by a thread that ended is taken over by the next thread
+ * that needs one.
+ *
+ * Persistent state, none of which needs a scan of the inodes to recover:
+ *  - "inodealloc" holds the high water mark, it is written before a lease above it is used,
+ *    so a crash can only leak numbers that were leased but not used, never hand one out twice.
+ *  - {"freeinodes", first} -> {count} records hold runs of freed inodes. Free() adds a record to the
+ *    write batch of the operation that frees the inode, so it commits together with that operation.
+ *
+ * Inodes freed during a mount become reusable at the next one, where Load() merges adjacent records
+ * into runs. Reusing them earlier could cut a lease out of a record whose batch is not written yet.
+ */
+class InodeAllocator {
+ public:
+  InodeAllocator(std::shared_ptr<KVStore> store, kvfs_file_inode_t lease_size);
+
+  /**
+   * Read the allocator state from the store.
+   * @param first_inode first number to hand out on a store that has no allocator state yet.
+   */
+  void Load(kvfs_file_inode_t first_inode);
+
+  kvfs_file_inode_t Allocate();
+
+  void Free(kvfs_file_inode_t inode, KVStore::WriteBatch *batch);
+
+  /**
+   * Give the unused part of every thread's lease back, called at unmount.
+   */
+  void ReturnLeases();
+
+  /**
+   * Record the high water mark and the inodes allocated and freed since the last call in the superblock.
+   */
+  void UpdateSuperBlock(kvfsSuperBlock *super_block);
+
+  ~InodeAllocator() = default;
+
+ private:
+  struct alignas(64) Lease {
+    // only advanced by the owning thread, ReturnLeases moves it to end_ to take what remains
+    std::atomic<kvfs_file_inode_t> next_{0};
+    // only written by the owning thread, while refilling
+    std::atomic<kvfs_file_inode_t> end_{0};
+    // allocations from this lease since the last UpdateSuperBlock
+    std::atomic<uint64_t> allocated_count_{0};
+    // held by a thread, cleared when the thread ends or drops it
+    std::atomic<bool> in_use_{true};
+  };
+  typedef std::map<kvfs_file_inode_t, kvfs_file_inode_t> RangeMap;
+
+  std::shared_ptr<KVStore> store_;
+  kvfs_file_inode_t lease_size_;
+  // identifies this allocator in the thread local leases
+  uint64_t id_;
+  kvfs_file_inode_t high_water_;
+  // runs found at mount, leases are cut from these first
+  RangeMap reusable_;
+  // every lease handed to a thread, guarded by mutex_
+  std::vector<std::shared_ptr<Lease>> leases_;
+  std::atomic<uint64_t> freed_count_;
+  std::unique_ptr<std::mutex> mutex_;
+
+  Lease &ThreadLease();
+  std::shared_ptr<Lease> NewLease();
+  void Refill(Lease &lease);
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_INODE_ALLOCATOR_H
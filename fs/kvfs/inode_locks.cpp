@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   inode_locks.cpp
+ */
+
+#include <kvfs/inode_locks.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace kvfs {
+
+InodeLocks::InodeLocks(size_t stripes)
+    : stripes_(stripes), table_(stripes ? std::make_unique<Stripe[]>(stripes) : nullptr) {}
+
+bool InodeLocks::Enabled() const {
+  return stripes_ != 0;
+}
+
+InodeLocks::Guard InodeLocks::Shared(kvfs_file_inode_t inode) {
+  return Lock({inode}, true);
+}
+
+InodeLocks::Guard InodeLocks::Exclusive(std::initializer_list<kvfs_file_inode_t> inodes) {
+  return Lock(inodes, false);
+}
+
+InodeLocks::Guard InodeLocks::ExclusiveAll() {
+  Guard guard;
+  if (!Enabled()) {
+    return guard;
+  }
+  for (size_t i = 0; i < stripes_; ++i) {
+    table_[i].mutex_.lock();
+  }
+  guard.all_ = this;
+  return guard;
+}
+
+InodeLocks::Guard InodeLocks::Lock(std::initializer_list<kvfs_file_inode_t> inodes, bool shared) {
+  Guard guard;
+  if (!Enabled()) {
+    return guard;
+  }
+  if (inodes.size() > kMaxGuardInodes) {
+    throw std::invalid_argument("too many inodes for one lock guard");
+  }
+  std::array<size_t, kMaxGuardInodes> stripes{};
+  size_t count = 0;
+  for (kvfs_file_inode_t inode : inodes) {
+    // consecutive inode numbers land on different stripes
+    stripes[count++] = static_cast<size_t>((inode * 0x9e3779b97f4a7c15ULL) >> 32) % stripes_;
+  }
+  std::sort(stripes.begin(), stripes.begin() + count);
+  count = std::unique(stripes.begin(), stripes.begin() + count) - stripes.begin();
+  guard.shared_ = shared;
+  for (size_t i = 0; i < count; ++i) {
+    std::shared_mutex *mutex = &table_[stripes[i]].mutex_;
+    if (shared) {
+      mutex->lock_shared();
+    } else {
+      mutex->lock();
+    }
+    guard.locks_[guard.count_++] = mutex;
+  }
+  return guard;
+}
+
+InodeLocks::Guard::Guard(Guard &&other) noexcept
+    : locks_(other.locks_), count_(other.count_), shared_(other.shared_), all_(other.all_) {
+  other.count_ = 0;
+  other.all_ = nullptr;
+}
+
+InodeLocks::Guard &InodeLocks::Guard::operator=(Guard &&other) noexcept {
+  if (this != &other) {
+    Unlock();
+    locks_ = other.locks_;
+    count_ = other.count_;
+    shared_ = other.shared_;
+    all_ = other.all_;
+    other.count_ = 0;
+    other.all_ = nullptr;
+  }
+  return *this;
+}
+
+InodeLocks::Guard::~Guard() {
+  Unlock();
+}
+
+void InodeLocks::Guard::Unlock() {
+  if (all_) {
+    for (size_t i = all_->stripes_; i > 0; --i) {
+      all_->table_[i - 1].mutex_.unlock();
+    }
+    all_ = nullptr;
+  }
+  while (count_ > 0) {
+    std::shared_mutex *mutex = locks_[--count_];
+    if (shared_) {
+      mutex->unlock_shared();
+    } else {
+      mutex->unlock();
+    }
+  }
+}
+
+}  // namespace kvfs
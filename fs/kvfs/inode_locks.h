@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   inode_locks.h
+ */
+
+#ifndef KVFS_INODE_LOCKS_H
+#define KVFS_INODE_LOCKS_H
+
+#include <kvfs_store/kvfs_store_entry.h>
+#include <array>
+#include <initializer_list>
+#include <memory>
+#include <shared_mutex>
+
+namespace kvfs {
+
+/**
+ * Reader-writer locks on inode numbers, striped over a fixed table.
+ *
+ * An operation locks the inodes whose records it reads, changes and writes back: exclusively for
+ * namespace changes, metadata updates and writes, shared for reads that span several blocks.
+ * Path resolution, lookups and directory scans take no lock, each is a single Get or runs on a
+ * store iterator.
+ *
+ * Namespace operations name the parent before the child, but two unrelated inodes may share a stripe,
+ * so a guard takes its distinct stripes in ascending order instead. That is one order for every
+ * operation, so none of them wait on each other in a cycle, as long as an operation takes all of its
+ * locks through a single guard.
+ */
+class InodeLocks {
+ public:
+  // the most inodes one guard locks, rename needs both parents, the entry and the one it replaces
+  static const size_t kMaxGuardInodes = 4;
+
+  /**
+   * @param stripes number of locks, 0 for none at all when the filesystem is used by a single thread.
+   */
+  explicit InodeLocks(size_t stripes);
+
+  bool Enabled() const;
+
+  class Guard {
+   public:
+    Guard() = default;
+    Guard(Guard &&other) noexcept;
+    Guard &operator=(Guard &&other) noexcept;
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+    ~Guard();
+
+    /**
+     * Release the locks before the guard goes out of scope.
+     */
+    void Unlock();
+
+   private:
+    friend class InodeLocks;
+    std::array<std::shared_mutex *, kMaxGuardInodes> locks_{};
+    size_t count_{0};
+    bool shared_{false};
+    // set when the guard holds every stripe
+    InodeLocks *all_{nullptr};
+  };
+
+  Guard Shared(kvfs_file_inode_t inode);
+
+  Guard Exclusive(std::initializer_list<kvfs_file_inode_t> inodes);
+
+  /**
+   * Lock every stripe, for writing back records of more inodes than a guard holds.
+   * The caller must not hold any other guard.
+   */
+  Guard ExclusiveAll();
+
+  ~InodeLocks() = default;
+
+ private:
+  // a stripe per cache line, so threads on neighbouring stripes don't contend on the line
+  struct alignas(64) Stripe {
+    std::shared_mutex mutex_;
+  };
+  size_t stripes_;
+  std::unique_ptr<Stripe[]> table_;
+
+  Guard Lock(std::initializer_list<kvfs_file_inode_t> inodes, bool shared);
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_INODE_LOCKS_H
@@ -9,71 +9,127 @@
 
 #include <kvfs/kvfs.h>
 #include <utime.h>
+#include <fstream>
+#include <future>
 
 namespace kvfs {
-kvfs::KVFS::KVFS(const std::string &mount_path)
+
+#if KVFS_DIRECTORY_FILTER
+// number of misses in one directory after which a filter is built for it
+static const size_t kDirectoryFilterThreshold = 64;
+#endif
+// CreateFilesBatch flushes its write batch once it holds about this many bytes
+static const size_t kCreateBatchBytes = 4 << 20;
+// blocks fetched per multi-get by ReadFilesMany
+static const size_t kReadManyBatch = 1024;
+
+// the store, recording its calls in stats when built with them
+static std::shared_ptr<KVStore> CountCalls(std::shared_ptr<KVStore> store, const std::shared_ptr<Stats> &stats) {
+#if KVFS_STATS
+  return std::make_shared<CountingStore>(std::move(store), stats);
+#else
+  (void) stats;
+  return store;
+#endif
+}
+
+kvfs::KVFS::KVFS(const std::string &mount_path, const kvfs_mount_options &options)
     : root_path(mount_path),
+      stats_(std::make_shared<Stats>()),
 #if KVFS_HAVE_ROCKSDB
-    store_(std::make_shared<kvfsRocksDBStore>(mount_path)),
+    store_(CountCalls(std::make_shared<kvfsRocksDBStore>(mount_path), stats_)),
 #endif
 #if KVFS_HAVE_LEVELDB
-      store_(std::make_shared<kvfsLevelDBStore>(mount_path)),
+      store_(CountCalls(std::make_shared<kvfsLevelDBStore>(mount_path), stats_)),
 #endif
 //      inode_cache_(std::make_unique<InodeCache>(KVFS_MAX_OPEN_FILES, store_)),
       open_fds_(std::make_unique<OpenFilesCache>(KVFS_MAX_OPEN_FILES)),
-      cwd_name_(""),
-      pwd_("/"),
-      errorno_(0),
-      current_key_{},
-      current_md_{},
-      next_free_fd_(0)
-#if KVFS_THREAD_SAFE
-,mutex_(std::make_unique<std::mutex>())
-#endif
-{
+      dentry_cache_(std::make_unique<DentryCache>(KVFS_DENTRY_CACHE_SIZE,
+                                                  KVFS_DENTRY_CACHE_SIZE,
+                                                  KVFS_DIRECTORY_FILTER ? KVFS_CACHE_SIZE : 0)),
+      inode_allocator_(std::make_unique<InodeAllocator>(store_, KVFS_INODE_LEASE_SIZE)),
+      tree_reclaimer_(std::make_unique<TreeReclaimer>(store_, inode_allocator_.get())),
+      options_(options),
+      timestamps_(std::make_unique<TimestampCache>()),
+      open_inodes_(std::make_unique<OpenInodeTable>()),
+      sessions_(std::make_unique<SessionTable>()),
+      locks_(std::make_unique<InodeLocks>(KVFS_THREAD_SAFE ? KVFS_LOCK_STRIPES : 0)),
+      block_fetcher_(KVFS_PARALLEL_READ_MIN ? std::make_unique<BlockFetcher>(store_, KVFS_READ_THREADS) : nullptr),
+      group_commit_(std::make_unique<GroupCommit>(store_, std::chrono::microseconds(options_.sync_window_usec))) {
   FSInit();
 }
 kvfs::KVFS::KVFS()
     : root_path("/tmp/db/"),
+      stats_(std::make_shared<Stats>()),
 #if KVFS_HAVE_ROCKSDB
-    store_(std::make_shared<kvfsRocksDBStore>(root_path)),
+    store_(CountCalls(std::make_shared<kvfsRocksDBStore>(root_path), stats_)),
 #endif
 #if KVFS_HAVE_LEVELDB
-      store_(std::make_shared<kvfsLevelDBStore>(root_path)),
+      store_(CountCalls(std::make_shared<kvfsLevelDBStore>(root_path), stats_)),
 #endif
 //      inode_cache_(std::make_unique<InodeCache>(KVFS_MAX_OPEN_FILES, store_)),
       open_fds_(std::make_unique<OpenFilesCache>(KVFS_MAX_OPEN_FILES)),
-      cwd_name_(""),
-      pwd_("/"),
-      errorno_(0),
-      current_key_{},
-      current_md_{},
-      next_free_fd_(0)
-#if KVFS_THREAD_SAFE
-,mutex_(std::make_unique<std::mutex>())
-#endif
-{
+      dentry_cache_(std::make_unique<DentryCache>(KVFS_DENTRY_CACHE_SIZE,
+                                                  KVFS_DENTRY_CACHE_SIZE,
+                                                  KVFS_DIRECTORY_FILTER ? KVFS_CACHE_SIZE : 0)),
+      inode_allocator_(std::make_unique<InodeAllocator>(store_, KVFS_INODE_LEASE_SIZE)),
+      tree_reclaimer_(std::make_unique<TreeReclaimer>(store_, inode_allocator_.get())),
+      timestamps_(std::make_unique<TimestampCache>()),
+      open_inodes_(std::make_unique<OpenInodeTable>()),
+      sessions_(std::make_unique<SessionTable>()),
+      locks_(std::make_unique<InodeLocks>(KVFS_THREAD_SAFE ? KVFS_LOCK_STRIPES : 0)),
+      block_fetcher_(KVFS_PARALLEL_READ_MIN ? std::make_unique<BlockFetcher>(store_, KVFS_READ_THREADS) : nullptr),
+      group_commit_(std::make_unique<GroupCommit>(store_, std::chrono::microseconds(options_.sync_window_usec))) {
   FSInit();
 }
 
 kvfs::KVFS::~KVFS() {
-#if KVFS_THREAD_SAFE
-  mutex_.reset();
-#endif
 //  inode_cache_.reset();
+  block_fetcher_.reset();
+  tree_reclaimer_.reset();
+  inode_allocator_.reset();
+  dentry_cache_.reset();
   open_fds_.reset();
   store_.reset();
 }
+kvfs_store_calls kvfs::KVFS::StoreCalls() const {
+  kvfs_store_calls calls;
+  calls.gets = stats_->Total(KVFS_COUNTER_STORE_KEYS_READ);
+  calls.seeks = stats_->Calls(KVFS_OP_STORE_SEEK) + stats_->Calls(KVFS_OP_STORE_GET_CHILDREN)
+      + stats_->Calls(KVFS_OP_STORE_GET_PARENT);
+  calls.nexts = stats_->Calls(KVFS_OP_STORE_NEXT);
+  calls.puts = stats_->Total(KVFS_COUNTER_STORE_KEYS_WRITTEN);
+  calls.deletes = stats_->Total(KVFS_COUNTER_STORE_KEYS_DELETED);
+  calls.writes = stats_->Calls(KVFS_OP_STORE_PUT) + stats_->Calls(KVFS_OP_STORE_MERGE)
+      + stats_->Calls(KVFS_OP_STORE_DELETE) + stats_->Calls(KVFS_OP_STORE_DELETE_RANGE)
+      + stats_->Calls(KVFS_OP_STORE_WRITE_BATCH);
+  calls.syncs = stats_->Calls(KVFS_OP_STORE_SYNC);
+  return calls;
+}
+
+kvfs_stats kvfs::KVFS::GetStats(const char *path, kvfs_stats_format format) {
+  kvfs_stats stats = stats_->Snapshot();
+  if (path != nullptr) {
+    std::ofstream out(path, std::ios::trunc);
+    stats.Write(out, format);
+    if (!out.flush()) {
+      CurrentSession()->errorno_ = -EIO;
+      throw FSError(FSErrorType::FS_EIO, "The stats could not be written to the file.");
+    }
+  }
+  return stats;
+}
+
 char *kvfs::KVFS::GetCWD(char *buffer, size_t size) {
   std::string result;
   if (size == 0 && buffer != nullptr) {
-    errorno_ = -EINVAL;
+    CurrentSession()->errorno_ = -EINVAL;
     std::string msg = "The size argument is zero and buffer is not a null pointer.";
     throw FSError(FSErrorType::FS_EINVAL, msg);
   }
-  std::string str = pwd_.string();
+  std::string str = CurrentSession()->pwd_.string();
   if (str.size() > size) {
-    errorno_ = -ERANGE;
+    CurrentSession()->errorno_ = -ERANGE;
     std::string msg = "The size argument is less than the length of the working directory name.\n"
                       "You need to allocate a bigger array and try again.";
     throw FSError(FSErrorType::FS_ERANGE, msg);
@@ -89,13 +145,37 @@ char *kvfs::KVFS::GetCWD(char *buffer, size_t size) {
 }
 
 std::string kvfs::KVFS::GetCurrentDirName() {
-  return pwd_;
+  return CurrentSession()->pwd_;
+}
+
+std::shared_ptr<kvfsSession> kvfs::KVFS::NewSession(uid_t uid, gid_t gid) {
+  return std::make_shared<kvfsSession>(uid, gid);
+}
+
+void kvfs::KVFS::AttachSession(std::shared_ptr<kvfsSession> session) {
+  sessions_->Attach(std::move(session));
+}
+
+std::shared_ptr<kvfsSession> kvfs::KVFS::GetSession() {
+  return sessions_->CurrentShared();
+}
+
+kvfsSession *kvfs::KVFS::CurrentSession() {
+  return sessions_->Current();
+}
+
+void kvfs::KVFS::SetOwner(kvfsInodeValue *md) {
+  kvfsSession *session = CurrentSession();
+  md->fstat_.st_uid = session->uid_;
+  md->fstat_.st_gid = session->gid_;
 }
 
 int kvfs::KVFS::ChDir(const char *path) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_CHDIR);
+  kvfsSession *session = CurrentSession();
   std::filesystem::path orig_ = std::filesystem::path(path);
   if (orig_ == "..") {
-    pwd_ = pwd_.parent_path();
+    session->pwd_ = session->pwd_.parent_path();
     return 0;
   }
   if (orig_ == ".") {
@@ -105,9 +185,7 @@ int kvfs::KVFS::ChDir(const char *path) {
 
   if (orig_.is_relative()) {
     // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+    orig_ = CurrentSession()->pwd_ / orig_;
   }
   if (orig_.is_absolute()) {
     // must start with single "/"
@@ -132,13 +210,7 @@ int kvfs::KVFS::ChDir(const char *path) {
   kvfsInodeKey key_ = {resolved.second.second.fstat_.st_ino, hash};
   std::string key_str = key_.pack();
   std::string value_str;
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (sr.isValid()) {
     // found the file, check if it is a directory
     kvfsInodeValue md_;
@@ -146,39 +218,32 @@ int kvfs::KVFS::ChDir(const char *path) {
     if (S_ISLNK(md_.fstat_.st_mode)) {
       // it is symbolic link get the symlink contents
       const std::filesystem::path &sym_link_contents_path = GetSymLinkContentsPath(md_);
-      cwd_name_ = sym_link_contents_path.filename();
-      pwd_ = sym_link_contents_path;
+      session->cwd_name_ = sym_link_contents_path.filename();
+      session->pwd_ = sym_link_contents_path;
       return 0;
     }
     if (!S_ISDIR(md_.fstat_.st_mode)) {
-      errorno_ = -ENOTDIR;
+      CurrentSession()->errorno_ = -ENOTDIR;
       throw FSError(FSErrorType::FS_ENOTDIR, "A component of the pathname names an existing file that is neither "
                                              "a directory nor a symbolic link to a directory.");
     }
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    current_md_ = md_;
-    current_key_ = key_;
-    cwd_name_ = orig_.filename();
-    pwd_ = orig_;
+    session->cwd_md_ = md_;
+    session->cwd_key_ = key_;
+    session->cwd_name_ = orig_.filename();
+    session->pwd_ = orig_;
 
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
     return 0;
   }
-  errorno_ = -ENONET;
-  return errorno_;
+  CurrentSession()->errorno_ = -ENONET;
+  return CurrentSession()->errorno_;
 }
 kvfsDIR *KVFS::OpenDir(const char *path) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_OPENDIR);
   std::filesystem::path orig_ = std::filesystem::path(path);
   CheckNameLength(orig_);
   if (orig_.is_relative()) {
     // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+    orig_ = CurrentSession()->pwd_ / orig_;
   }
   if (orig_.is_absolute()) {
     // must start with single "/"
@@ -193,10 +258,6 @@ kvfsDIR *KVFS::OpenDir(const char *path) {
   resolved.first.append(orig_.filename().string());
   orig_ = resolved.first.lexically_normal();
 
-#if KVFS_THREAD_SAFE
-  // lock
-    mutex_->lock();
-#endif
   kvfs_file_hash_t hash = 0;
 
   if (orig_ != "/") {
@@ -215,26 +276,24 @@ kvfsDIR *KVFS::OpenDir(const char *path) {
 
     // check if it is a directory
     if (!S_ISDIR(md_.fstat_.st_mode)) {
-      errorno_ = -ENOTDIR;
+      CurrentSession()->errorno_ = -ENOTDIR;
       throw FSError(FSErrorType::FS_ENOTDIR, "A component of dirname names an existing file that "
                                              "is neither a directory nor a symbolic link to a directory.");
     }
 
     // insert it into open_fds
-    uint32_t fd_ = GetFreeFD();
-    kvfsFileHandle fh_ = kvfsFileHandle();
-    fh_.md_ = md_;
-    fh_.key_ = key;
-    open_fds_->Insert(fd_, fh_);
-
-#if KVFS_THREAD_SAFE
-    //unlock
-        mutex_->unlock();
-#endif
+    kvfsFileHandle fh_ = kvfsFileHandle(open_inodes_->Insert(key, md_), O_RDONLY);
+    fh_.path_ = orig_;
+    int fd_ = InsertOpenFile(std::move(fh_));
+
     //success
     kvfsDIR *result = new kvfsDIR();
     result->file_descriptor_ = fd_;
-    result->ptr_ = store_->GetIterator();
+    result->inode_ = md_.fstat_.st_ino;
+    result->generation_ = dentry_cache_->PositiveGeneration(md_.fstat_.st_ino);
+    // the stream lists the directory as it was when it was opened, SeekDir included
+    result->snapshot_ = store_->GetSnapshot();
+    result->ptr_ = store_->GetIterator(result->snapshot_.get());
     kvfsInodeKey seek_key = {md_.fstat_.st_ino, 0};
     key_str = seek_key.pack();
     result->ptr_->Seek(key_str);
@@ -242,35 +301,23 @@ kvfsDIR *KVFS::OpenDir(const char *path) {
   }
   if (!sr.isValid()) {
     // does not exist return error
-    errorno_ = -ENONET;
+    CurrentSession()->errorno_ = -ENONET;
     throw FSError(FSErrorType::FS_ENOENT, "A component of dirname does not name an existing directory "
                                           "or dirname is an empty string.");
   }
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   return nullptr;
 }
 int kvfs::KVFS::Open(const char *filename, int flags, mode_t mode) {
+  return OpenAt(AT_FDCWD, filename, flags, mode);
+}
+int kvfs::KVFS::OpenAt(int dirfd, const char *filename, int flags, mode_t mode) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_OPEN);
   std::filesystem::path orig_ = std::filesystem::path(filename);
   CheckNameLength(orig_);
-  if (orig_.is_relative()) {
-    // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
-  }
-  if (orig_.is_absolute()) {
-    // must start with single "/"
-    if (orig_.root_path() != "/") {
-      throw FSError(FSErrorType::FS_EINVAL, "Given name is not in the correct format");
-    }
-  }
 
   // Attempt to resolve the real path from given path
-  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = RealPath(orig_.parent_path());
-  resolved.first.append(orig_.filename().string());
-  orig_ = resolved.first.lexically_normal();
+  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = ResolveAt(dirfd, orig_);
+  orig_ = resolved.first;
   // now the path components all exist and resolved
   if ((flags & O_ACCMODE) == O_RDONLY || (flags & O_ACCMODE) == O_WRONLY || (flags & O_ACCMODE) == O_RDWR) {
   } else {
@@ -287,105 +334,96 @@ int kvfs::KVFS::Open(const char *filename, int flags, mode_t mode) {
   std::string key_str = key.pack();
   std::string value_str;
   if (flags & O_CREAT) {
+    // the existence check and the create are one step for other threads creating in the directory
+    InodeLocks::Guard guard = locks_->Exclusive({resolved.second.second.fstat_.st_ino});
+    Reload(resolved.second.first, &resolved.second.second);
     // If set, the file will be created if it doesn’t already exist.
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
+    // an open file is not looked up in the store again, with O_EXCL it is not opened at all
+    std::shared_ptr<kvfsOpenInode> inode;
+    if (!(flags & O_EXCL)) {
+      inode = open_inodes_->Acquire(key);
+    }
+    KVStoreResult sr;
+    if (!inode) {
+      sr = LookupEntry(key);
+    }
     // ensure sr is valid
-    if (sr.isValid()) {
+    if (inode || sr.isValid()) {
       if (flags & O_EXCL) {
         // If both O_CREAT and O_EXCL are set, then open fails if the specified file already exists.
         // This is guaranteed to never clobber an existing file.
-        errorno_ = -EEXIST;
+        CurrentSession()->errorno_ = -EEXIST;
         throw FSError(FSErrorType::FS_EEXIST, "Flags O_CREAT and O_EXCL are set but the file already exists");
       }
-      kvfsInodeValue md_ = kvfsInodeValue();
-      md_.parse(sr);
-      kvfsFileHandle fh_ = kvfsFileHandle(key, md_, flags);
-      uint32_t fd_ = GetFreeFD();
+      if (!inode) {
+        kvfsInodeValue md_ = kvfsInodeValue();
+        md_.parse(sr);
+        inode = open_inodes_->Insert(key, md_);
+      }
+      kvfsFileHandle fh_ = kvfsFileHandle(inode, flags);
+      fh_.path_ = orig_;
       // add it to open_fds
-      open_fds_->Insert(fd_, fh_);
-      return fd_;
+      return InsertOpenFile(std::move(fh_));
     }
 
     // create a new file
     // check if there is room for more open files
-    uint32_t fd_ = GetFreeFD();
+    if (open_fds_->Size() >= KVFS_MAX_OPEN_FILES) {
+      CurrentSession()->errorno_ = -ENFILE;
+      throw FSError(FSErrorType::FS_ENFILE, "Too many files are currently open in the system.");
+    }
+    // the new inode, the parent and the allocator state are committed as one write
+    std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
     // file doesn't exist so create new one
     std::filesystem::path name = orig_.filename().string();
     kvfsInodeValue md_ = kvfsInodeValue(name, GetFreeInode(), mode, key);
-
-    // generate a file descriptor
-    kvfsFileHandle fh_ = kvfsFileHandle(key, md_, flags);
-
+    SetOwner(&md_);
 
     // insert into store
     value_str = md_.pack();
-#if KVFS_THREAD_SAFE
-    // Acquire lock
-          mutex_->lock();
-#endif
-    store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-    // release lock
-    mutex_->unlock();
-#endif
-    // write it back if flag O_SYNC
-    if (flags & O_SYNC) {
-      store_->Sync();
-    }
-    // add it to open_fds
-    open_fds_->Insert(fd_, fh_);
+    batch->Put(key_str, value_str);
 
     // update the parent
     ++resolved.second.second.fstat_.st_nlink;
     resolved.second.second.fstat_.st_mtim.tv_sec = time_now;
     key_str = resolved.second.first.pack();
     value_str = resolved.second.second.pack();
-#if KVFS_THREAD_SAFE
-    // Acquire lock
-    mutex_->lock();
-#endif
-    store_->Merge(key_str, value_str);
-#if KVFS_THREAD_SAFE
-    // release lock
-    mutex_->unlock();
-#endif
-    return fd_;
+    batch->Put(key_str, value_str);
+    batch->Flush();
+    EntryCreated(key);
+    EntryUpdated(resolved.second.first);
+    batch.reset();
+    // write it back if flag O_SYNC
+    if (flags & O_SYNC) {
+      group_commit_->Sync();
+    }
+    // generate a file descriptor
+    kvfsFileHandle fh_ = kvfsFileHandle(open_inodes_->Insert(key, md_), flags);
+    fh_.path_ = orig_;
+    // add it to open_fds
+    return InsertOpenFile(std::move(fh_));
   }
 
-  // flag is not O_CREAT so open existing file
-#if KVFS_THREAD_SAFE
-  // Acquire lock
-  mutex_->lock();
-#endif
-  KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  // release lock
-  mutex_->unlock();
-#endif
-  if (!sr.isValid()) {
-    errorno_ = -EIO;
-    return errorno_;
+  // flag is not O_CREAT so open existing file, an open file is not looked up in the store again
+  std::shared_ptr<kvfsOpenInode> inode = open_inodes_->Acquire(key);
+  if (!inode) {
+    KVStoreResult sr = LookupEntry(key);
+    if (!sr.isValid()) {
+      CurrentSession()->errorno_ = -EIO;
+      return CurrentSession()->errorno_;
+    }
+    kvfsInodeValue md_ = kvfsInodeValue();
+    md_.parse(sr);
+    inode = open_inodes_->Insert(key, md_);
   }
-  kvfsInodeValue md_ = kvfsInodeValue();
-  md_.parse(sr);
-  kvfsFileHandle fh_ = kvfsFileHandle(key, md_, flags);
-  uint32_t fd_ = GetFreeFD();
+  kvfsFileHandle fh_ = kvfsFileHandle(inode, flags);
+  fh_.path_ = orig_;
   // add it to open_fds
-  open_fds_->Insert(fd_, fh_);
-  return fd_;
+  return InsertOpenFile(std::move(fh_));
 }
 
 void kvfs::KVFS::FSInit() {
   if (store_ != nullptr) {
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
     const KVStoreResult &sb = store_->Get("superblock");
     if (sb.isValid()) {
       super_block_.parse(sb);
@@ -403,6 +441,8 @@ void kvfs::KVFS::FSInit() {
         throw FSError(FSErrorType::FS_EIO, "Failed to put superblock in store");
       }
     }
+    inode_allocator_->Load(super_block_.next_free_inode_);
+    tree_reclaimer_->Start();
     kvfsInodeKey root_key = {0, std::filesystem::hash_value("/")};
     std::string key_str = root_key.pack();
     std::string value_str;
@@ -412,9 +452,6 @@ void kvfs::KVFS::FSInit() {
       value_str = root_md.pack();
       store_->Put(key_str, value_str);
     }
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
   } else {
     throw FSError(FSErrorType::FS_EIO, "Failed to initialise the file system");
   }
@@ -426,7 +463,7 @@ bool kvfs::KVFS::CheckNameLength(const std::filesystem::path &path) {
     throw FSError(FSErrorType::FS_EINVAL, "Given path name is empty!");
   }
   if (path.filename().string().length() > NAME_MAX) {
-    errorno_ = -ENAMETOOLONG;
+    CurrentSession()->errorno_ = -ENAMETOOLONG;
     throw FSError(FSErrorType::FS_ENAMETOOLONG, "Given file name is longer than NAME_MAX");
   }
   return true;
@@ -458,14 +495,11 @@ std::pair<std::filesystem::path,
     }
     // check if name is not too long
     if (!CheckNameLength(e)) {
-      errorno_ = -ENAMETOOLONG;
+      CurrentSession()->errorno_ = -ENAMETOOLONG;
       throw FSError(FSErrorType::FS_ENAMETOOLONG, "File name is longer than POSIX NAME_MAX");
     }
     // Request the metadata from store
     {
-#if KVFS_THREAD_SAFE
-      mutex_->lock();
-#endif
       kvfsInodeKey key = {inode, std::filesystem::hash_value(e)};
       key_str = key.pack();
       KVStoreResult sr = store_->Get(key_str);
@@ -476,9 +510,6 @@ std::pair<std::filesystem::path,
         if (is_link) {
           // we occurred a symbolic link, prefix the path with the contents
           // of this link
-#if KVFS_THREAD_SAFE
-          mutex_->unlock();
-#endif
           output = GetSymLinkContentsPath(md_);
           prv_k = parent_key_;
           parent_key_ = md_.real_key_;
@@ -492,13 +523,10 @@ std::pair<std::filesystem::path,
         parent_md_ = md_;
       } else {
         // the path component must exists
-        errorno_ = -ENONET;
+        CurrentSession()->errorno_ = -ENONET;
         std::string msg = e.string() + " No such file or directory found under inode: #" + std::to_string(inode);
         throw FSError(FSErrorType::FS_ENOENT, msg);
       }
-#if KVFS_THREAD_SAFE
-      mutex_->unlock();
-#endif
     }
     // append normally
     output.append(e.string());
@@ -509,126 +537,63 @@ std::filesystem::path kvfs::KVFS::GetSymLinkContentsPath(const kvfs::kvfsInodeVa
   std::filesystem::path output;
   std::list<std::filesystem::path> path_list;
   kvfsBlockKey blck_key = {data.fstat_.st_ino, 0};
-  errorno_ = 0;
+  CurrentSession()->errorno_ = 0;
   // read contents of the symlink block and convert it to a path
   void *buffer = malloc(static_cast<size_t>(data.fstat_.st_size));
   size_t blcks_to_read = data.fstat_.st_size / KVFS_DEF_BLOCK_SIZE
       + ((data.fstat_.st_size % KVFS_DEF_BLOCK_SIZE) ? 1 : 0);
-  ssize_t read = ReadBlocks(blck_key, blcks_to_read, static_cast<size_t>(data.fstat_.st_size), buffer);
+  ssize_t read = ReadBlocks(blck_key, blcks_to_read, static_cast<size_t>(data.fstat_.st_size), buffer, nullptr);
   output = (char *) buffer;
   free(buffer);
   return output;
 }
-bool kvfs::KVFS::FreeUpInodeNumber(const kvfs_file_inode_t &inode) {
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  std::string key_str;
-  std::string value_str;
-
-  uint64_t free_inodes_key_number = super_block_.freed_inodes_count_ / 512;
-  free_inodes_key_number += (super_block_.freed_inodes_count_ % 512) ? 1 : 0;
-  kvfsFreedInodesKey fi_key = {"freeinodes", free_inodes_key_number};
-  key_str = fi_key.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
-  if (sr.isValid()) {
-    kvfsFreedInodesValue fi_v;
-    fi_v.parse(sr);
-    ++fi_v.count_;
-    fi_v.inodes[super_block_.freed_inodes_count_ % 512] = inode;
-    value_str = fi_v.pack();
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    bool status = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    ++super_block_.freed_inodes_count_;
-    --super_block_.total_inode_count_;
-    return status;
-  } else {
-    kvfsFreedInodesValue fi_v;
-    ++fi_v.count_;
-    fi_v.inodes[super_block_.freed_inodes_count_ % 512] = inode;
-    value_str = fi_v.pack();
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    bool status = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    ++super_block_.freed_inodes_count_;
-    --super_block_.total_inode_count_;
-    return status;
-  }
+bool kvfs::KVFS::FreeUpInodeNumber(const kvfs_file_inode_t &inode, KVStore::WriteBatch *batch) {
+  // recorded in the same batch as the operation that frees it
+  inode_allocator_->Free(inode, batch);
+  return true;
 }
 ssize_t kvfs::KVFS::Read(int filedes, void *buffer, size_t size) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_READ);
   // read from offset in the file descriptor
   // if offset is at eof then return 0 else try to pread with filedes offset
-  kvfsFileHandle fh_;
-  bool status = open_fds_->Find(filedes, fh_);
-  if (!status) {
-    errorno_ = -EBADFD;
+  OpenFilesCache::Handle fh_ = open_fds_->Find(filedes);
+  if (!fh_) {
+    CurrentSession()->errorno_ = -EBADFD;
     throw FSError(FSErrorType::FS_EBADFD, "The file descriptor doesn't name a opened file, invalid fd");
   }
 
-  // check flags first
-
-  if (fh_.offset_ == fh_.md_.fstat_.st_size) {
-    // eof
-
-    // update stats and return
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    if (!(fh_.flags_ & O_NOATIME)) {
-      // update accesstimes on the file
-      fh_.md_.fstat_.st_atim.tv_sec = time_now;
-    }
-    open_fds_->Insert(filedes, fh_);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    return 0;
-  } else {
-    // try to read the file at the file descriptor position
-    // then modify filedes offset by amount read
-    ssize_t read = PRead(filedes, buffer, size, fh_.offset_);
-    fh_.offset_ += read;
-    open_fds_->Insert(filedes, fh_);
-    return read;
-  }
+  // read the file at the file descriptor position, at eof that reads nothing,
+  // then modify filedes offset by amount read
+  ssize_t read = PReadHandle(&*fh_, buffer, size, fh_->offset_);
+  fh_->offset_ += read;
+  timer.Add(KVFS_COUNTER_FS_BYTES_READ, read);
+  return read;
 }
 ssize_t kvfs::KVFS::Write(int filedes, const void *buffer, size_t size) {
-  kvfsFileHandle fh_;
-  bool status = open_fds_->Find(filedes, fh_);
+  Stats::Timer timer(stats_.get(), KVFS_OP_WRITE);
+  OpenFilesCache::Handle handle = open_fds_->Find(filedes);
   ssize_t written = 0;
-  if (!status) {
-    errorno_ = -EBADFD;
+  if (!handle) {
+    CurrentSession()->errorno_ = -EBADFD;
     throw FSError(FSErrorType::FS_EBADFD, "The file descriptor doesn't name a opened file, invalid fd");
   }
   // check flags first
 
+  kvfsFileHandle &fh_ = *handle;
+  kvfsOpenInode &inode = *fh_.inode_;
   // check if O_APPEND is set, then always append
   bool append_only = (fh_.flags_ & O_APPEND) > 0;
   if (append_only) {
     // ignore offset and append only
+    InodeLocks::Guard guard = locks_->Exclusive({inode.md_.fstat_.st_ino});
 
     // determine which block to write from, then
     // pass that to blocks writer.
 
     kvfsBlockKey blck_key_;
-    blck_key_.inode_ = fh_.md_.fstat_.st_ino;
-    blck_key_.block_number_ = fh_.md_.fstat_.st_size / KVFS_DEF_BLOCK_SIZE;
-    kvfs_off_t blck_offset = fh_.md_.fstat_.st_size % KVFS_DEF_BLOCK_SIZE;
+    blck_key_.inode_ = inode.md_.fstat_.st_ino;
+    blck_key_.block_number_ = inode.md_.fstat_.st_size / KVFS_DEF_BLOCK_SIZE;
+    kvfs_off_t blck_offset = inode.md_.fstat_.st_size % KVFS_DEF_BLOCK_SIZE;
     const void *idx = buffer;
     std::string key_str = blck_key_.pack();
     std::string value_str;
@@ -639,15 +604,9 @@ ssize_t kvfs::KVFS::Write(int filedes, const void *buffer, size_t size) {
       auto pair = FillBlock(&bv_, buffer, size, blck_offset);
       written += pair.first;
       idx = pair.second;
-#if KVFS_THREAD_SAFE
-      mutex_->lock();
-#endif
       value_str = bv_.pack();
       store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-      mutex_->unlock();
-#endif
-      blck_key_ = kvfsBlockKey(fh_.md_.fstat_.st_ino, blck_key_.block_number_ + 1);
+      blck_key_ = kvfsBlockKey(inode.md_.fstat_.st_ino, blck_key_.block_number_ + 1);
     }
 
     size_t size_left = size - written;
@@ -658,232 +617,215 @@ ssize_t kvfs::KVFS::Write(int filedes, const void *buffer, size_t size) {
     written += result;
 
     // update stats
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    fh_.md_.fstat_.st_size += written;
-    fh_.offset_ = fh_.md_.fstat_.st_size;
+    inode.md_.fstat_.st_size += written;
+    fh_.offset_ = inode.md_.fstat_.st_size;
+    inode.dirty_ = true;
     if ((fh_.flags_ & O_NOATIME) == 0)
-      fh_.md_.fstat_.st_mtim.tv_sec = time_now;
-    // update this filedes in cache
-    open_fds_->Insert(filedes, fh_);
+      inode.md_.fstat_.st_mtim.tv_sec = time_now;
+    inode.unsynced_ = true;
+    if (fh_.flags_ & O_DSYNC) {
+      SyncInode(&inode, &guard, (fh_.flags_ & O_SYNC) == O_SYNC);
+    }
+    timer.Add(KVFS_COUNTER_FS_BYTES_WRITTEN, written);
     // finished
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
     return written;
   } else {
     // call to PWrite to write from offset
-    return PWrite(filedes, buffer, size, fh_.offset_);
+    return PWriteHandle(&fh_, buffer, size, fh_.offset_);
   }
 }
 kvfs_file_inode_t kvfs::KVFS::GetFreeInode() {
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  std::string key_str;
-  std::string value_str;
-  kvfs_file_inode_t result;
-  if (super_block_.freed_inodes_count_ > 0) {
-    uint64_t free_inodes_key_number = super_block_.freed_inodes_count_ / 512;
-    kvfsFreedInodesKey fi_key = {"freeinodes", free_inodes_key_number};
-    key_str = fi_key.pack();
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    if (sr.isValid()) {
-      kvfsFreedInodesValue fi_v;
-      fi_v.parse(sr);
-      result = fi_v.inodes[fi_v.count_];
-      --fi_v.count_;
-      value_str = fi_v.pack();
-#if KVFS_THREAD_SAFE
-      mutex_->lock();
-#endif
-      bool status = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-      mutex_->unlock();
-#endif
-      --super_block_.freed_inodes_count_;
-      ++super_block_.total_inode_count_;
-      return result;
-    }
-  }
-  result = super_block_.next_free_inode_;
-  ++super_block_.next_free_inode_;
-  ++super_block_.total_inode_count_;
-  return result;
+  return inode_allocator_->Allocate();
 }
 int KVFS::Close(int filedes) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_CLOSE);
   // check filedes exists
   try {
+    // release it from open_fds first, the descriptor is gone for other threads from here on
     kvfsFileHandle fh_;
-#if KVFS_THREAD_SAFE
-    mutex_->lock(); // lock
-#endif
-    bool status = open_fds_->Find(filedes, fh_);
-    if (!status) {
-      errorno_ = -EBADFD;
+    if (!open_fds_->Evict(filedes, &fh_)) {
+      CurrentSession()->errorno_ = -EBADFD;
       throw FSError(FSErrorType::FS_EBADFD, "The given file des does not match any open files");
     }
-    // Close just update the store anyways, and its upto the caller
-    //  to correctly call close on deleted files.
-
-    std::string key_str = fh_.key_.pack();
-    std::string value_str = fh_.md_.pack();
-    store_->Merge(key_str, value_str);
-    // release it from open_fds
-    open_fds_->Evict(filedes);
-    FreeUpFD(filedes);
+    // the inode is written back by the last descriptor closed on it and only if it changed,
+    // one whose entry was removed meanwhile is dropped
+    {
+      InodeLocks::Guard guard = locks_->Exclusive({fh_.inode_->md_.fstat_.st_ino});
+      if (open_inodes_->Release(fh_.inode_)) {
+        WriteBackInode(fh_.inode_.get());
+        open_inodes_->Forget(fh_.inode_);
+      }
+    }
+    if (timestamps_->Due(options_.lazytime_flush_seconds, options_.lazytime_flush_entries)) {
+      FlushTimestamps();
+    }
     // success
-#if KVFS_THREAD_SAFE
-    mutex_->unlock(); //unlock
-#endif
     return 0;
   } catch (...) {
-    errorno_ = -EINTR;
+    CurrentSession()->errorno_ = -EINTR;
     throw FSError(FSErrorType::FS_EINTR, "The close() function was interrupted by a signal.");
   }
 }
 kvfs_dirent *KVFS::ReadDir(kvfsDIR *dirstream) {
-  // check if the fd is in open_fds
-  kvfsFileHandle fh_;
-
+  Stats::Timer timer(stats_.get(), KVFS_OP_READDIR);
   if (!dirstream) {
-    errorno_ = -EINVAL;
+    CurrentSession()->errorno_ = -EINVAL;
     throw FSError(FSErrorType::FS_EINVAL, "The dirp argument is a nullptr");
   }
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  if (!open_fds_->Find(dirstream->file_descriptor_, fh_)) {
-    errorno_ = -EBADFD;
-    throw FSError(FSErrorType::FS_EBADFD, "The dirp argument does not refer to an open directory stream.");
+  // the stream has its own iterator, nothing shared is touched
+  kvfsInodeValue md_;
+  if (!ReadDirEntry(dirstream, &md_)) {
+    // eof
+    return nullptr;
   }
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
-  try {
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    if (dirstream->ptr_->Valid()) {
-      dirstream->ptr_->Next();
-      if (dirstream->ptr_->key().size() == sizeof(kvfsInodeKey)
-          && dirstream->ptr_->value().asString().size() == sizeof(kvfsInodeValue)) {
-        kvfsInodeKey key;
-        key.parse(dirstream->ptr_->key());
-        kvfsInodeValue md_;
-        md_.parse(dirstream->ptr_->value());
-
-        if (key.inode_ == fh_.md_.dirent_.d_ino) {
-          kvfs_dirent *result = new kvfs_dirent();
-          *result = md_.dirent_;
-#if KVFS_THREAD_SAFE
-          mutex_->unlock();
-#endif
-          return result;
-        }
+  dirstream->entry_ = md_.dirent_;
+  dirstream->ptr_->Next();
+  dirstream->entry_.d_off = DirPosition(dirstream);
+  return &dirstream->entry_;
+}
+ssize_t KVFS::ReadDirBatch(kvfsDIR *dirstream, void *buffer, size_t bytes) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_READDIR_BATCH);
+  if (!dirstream) {
+    CurrentSession()->errorno_ = -EINVAL;
+    throw FSError(FSErrorType::FS_EINVAL, "The dirp argument is a nullptr");
+  }
+  auto *out = static_cast<char *>(buffer);
+  size_t written = 0;
+  kvfsInodeValue md_;
+  while (ReadDirEntry(dirstream, &md_)) {
+    size_t name_length = strnlen(md_.dirent_.d_name, sizeof(md_.dirent_.d_name) - 1);
+    // records are cut after the name and padded to keep the next one aligned
+    size_t record_length = offsetof(kvfs_dirent, d_name) + name_length + 1;
+    record_length = (record_length + alignof(kvfs_dirent) - 1) & ~(alignof(kvfs_dirent) - 1);
+    if (written + record_length > bytes) {
+      if (written == 0) {
+        CurrentSession()->errorno_ = -EINVAL;
+        throw FSError(FSErrorType::FS_EINVAL, "Result buffer is too small.");
       }
+      break;
+    }
+    auto *entry = reinterpret_cast<kvfs_dirent *>(out + written);
+    entry->d_ino = md_.dirent_.d_ino;
+    entry->d_type = IFTODT(md_.fstat_.st_mode);
+    entry->d_reclen = static_cast<unsigned short>(record_length);
+    memcpy(entry->d_name, md_.dirent_.d_name, name_length);
+    entry->d_name[name_length] = '\0';
+    dirstream->ptr_->Next();
+    entry->d_off = DirPosition(dirstream);
+    written += record_length;
+  }
+  return written;
+}
+ssize_t KVFS::ReadDirPlus(kvfsDIR *dirstream, kvfs_dirent_plus *entries, size_t count, bool warm_cache) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_READDIR_PLUS);
+  if (!dirstream) {
+    CurrentSession()->errorno_ = -EINVAL;
+    throw FSError(FSErrorType::FS_EINVAL, "The dirp argument is a nullptr");
+  }
+  size_t filled = 0;
+  kvfsInodeValue md_;
+  bool lazy_times = !timestamps_->Empty();
+  while (filled < count && ReadDirEntry(dirstream, &md_)) {
+    // the iterator still points at the entry, its position is the hash of the name
+    kvfsInodeKey key = {dirstream->inode_, static_cast<kvfs_file_hash_t>(DirPosition(dirstream))};
+    if (warm_cache) {
+      dentry_cache_->InsertPositive(key, md_, dirstream->generation_);
+    }
+    kvfs_dirent_plus &entry = entries[filled++];
+    entry.d_entry = md_.dirent_;
+    entry.d_entry.d_type = IFTODT(md_.fstat_.st_mode);
+    entry.d_stat = md_.fstat_;
+    if (lazy_times) {
+      timestamps_->Apply(key, &entry.d_stat);
+    }
+    dirstream->ptr_->Next();
+    entry.d_entry.d_off = DirPosition(dirstream);
+  }
+  return filled;
+}
+long KVFS::TellDir(kvfsDIR *dirstream) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_TELLDIR);
+  return DirPosition(dirstream);
+}
+long KVFS::DirPosition(kvfsDIR *dirstream) {
+  // the position is the name hash of the next entry, entries are ordered by it within the directory
+  KVStore::Iterator *it = dirstream->ptr_.get();
+  if (!it->Valid()) {
+    return -1;
+  }
+  std::string_view key = it->key_view();
+  if (key.size() < sizeof(kvfsInodeKey)
+      || memcmp(key.data(), &dirstream->inode_, sizeof(kvfs_file_inode_t)) != 0) {
+    return -1;
+  }
+  kvfs_file_hash_t hash;
+  memcpy(&hash, key.data() + offsetof(kvfsInodeKey, hash_), sizeof(hash));
+  return static_cast<long>(hash);
+}
+void KVFS::SeekDir(kvfsDIR *dirstream, long pos) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_SEEKDIR);
+  kvfsInodeKey seek_key = {dirstream->inode_, static_cast<kvfs_file_hash_t>(pos)};
+  dirstream->ptr_->Seek(seek_key.pack());
+  if (pos == -1 && dirstream->ptr_->Valid()) {
+    std::string_view key = dirstream->ptr_->key_view();
+    if (key.size() >= sizeof(kvfs_file_inode_t)
+        && memcmp(key.data(), &dirstream->inode_, sizeof(kvfs_file_inode_t)) == 0) {
+      // an entry whose hash happens to be the end position, step over it
+      dirstream->ptr_->Next();
     }
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    // eof
-    return nullptr;
-  } catch (...) {
-    errorno_ = -EINTR;
-    throw FSError(FSErrorType::FS_EINTR, "The ReadDir() function was interrupted by a signal.");
   }
 }
 int KVFS::CloseDir(kvfsDIR *dirstream) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_CLOSEDIR);
   // check if the fd is in open_fds
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  kvfsFileHandle fh_;
-
   if (!dirstream) {
-    errorno_ = -EINVAL;
+    CurrentSession()->errorno_ = -EINVAL;
     throw FSError(FSErrorType::FS_EINVAL, "The dirp argument is a nullptr");
   }
 
-  if (!open_fds_->Find(dirstream->file_descriptor_, fh_)) {
-    errorno_ = -EBADFD;
+  // reading a directory does not change it, nothing is written back.
+  // release it from open_fds
+  kvfsFileHandle fh_;
+  if (!open_fds_->Evict(dirstream->file_descriptor_, &fh_)) {
+    CurrentSession()->errorno_ = -EBADFD;
     throw FSError(FSErrorType::FS_EBADFD, "The dirp argument does not refer to an open directory stream.");
   }
+  if (open_inodes_->Release(fh_.inode_)) {
+    open_inodes_->Forget(fh_.inode_);
+  }
   try {
-    // CloseDir update the file in store, and delete the dirstream
-    std::string key_str = fh_.key_.pack();
-    std::string value_str = fh_.md_.pack();
-    // file is new or updated
-    store_->Merge(key_str, value_str);
-    // release it from open_fds
-    open_fds_->Evict(dirstream->file_descriptor_);
     dirstream->ptr_.reset();
     delete dirstream;
 
     // success
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
     return 0;
   } catch (...) {
-    errorno_ = -EINTR;
+    CurrentSession()->errorno_ = -EINTR;
     throw FSError(FSErrorType::FS_EINTR, "The closedir() function was interrupted by a signal.");
   }
 }
 int KVFS::Link(const char *oldname, const char *newname) {
+  return LinkAt(AT_FDCWD, oldname, AT_FDCWD, newname);
+}
+int KVFS::LinkAt(int olddirfd, const char *oldname, int newdirfd, const char *newname) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_LINK);
 
   std::string key_str;
   std::string value_str;
 
   std::filesystem::path orig_old = std::filesystem::path(oldname);
-  std::filesystem::path orig_new = std::filesystem::path(oldname);
+  std::filesystem::path orig_new = std::filesystem::path(newname);
   CheckNameLength(orig_old);
   CheckNameLength(orig_new);
 
-  if (orig_old.is_relative()) {
-    // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_old = pwd_.append(orig_old.string());
-    pwd_ = prv_;
-  }
-  if (orig_old.is_absolute()) {
-    // must start with single "/"
-    if (orig_old.root_path() != "/") {
-      throw FSError(FSErrorType::FS_EINVAL, "Given name is not in the correct format");
-    }
-  }
-  if (orig_new.is_relative()) {
-    // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_new = pwd_.append(orig_new.string());
-    pwd_ = prv_;
-  }
-  if (orig_new.is_absolute()) {
-    // must start with single "/"
-    if (orig_new.root_path() != "/") {
-      throw FSError(FSErrorType::FS_EINVAL, "Given name is not in the correct format");
-    }
-  }
-
   // Attemp to resolve the real path from given path
-  std::filesystem::path input = orig_old.parent_path();
   std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved_old =
-      RealPath(input);
-  resolved_old.first.append(orig_old.filename().string());
-  orig_old = resolved_old.first.lexically_normal();
+      ResolveAt(olddirfd, orig_old);
+  orig_old = resolved_old.first;
 
-  input = orig_new.parent_path();
   std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved_new =
-      RealPath(input);
-  resolved_new.first.append(orig_new.filename().string());
-  orig_new = resolved_new.first.lexically_normal();
+      ResolveAt(newdirfd, orig_new);
+  orig_new = resolved_new.first;
 
   // create a new link (directory entry) for the existing file
 
@@ -899,20 +841,17 @@ int KVFS::Link(const char *oldname, const char *newname) {
   kvfsInodeKey
       old_key = {resolved_old.second.second.fstat_.st_ino, old_hash};
   key_str = old_key.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (!sr.isValid()) {
-    errorno_ = -ENONET;
+    CurrentSession()->errorno_ = -ENONET;
     throw FSError(FSErrorType::FS_ENOENT, "A component of either path prefix does not exist; "
                                           "the file named by path1 does not exist; or path1 or path2 points to an empty string.");
   }
   kvfsInodeValue old_md_;
   old_md_.parse(sr);
+  // the new entry goes into its directory and the links of the file are updated
+  InodeLocks::Guard guard = locks_->Exclusive({resolved_new.second.second.fstat_.st_ino, old_md_.fstat_.st_ino});
+  Reload(old_key, &old_md_);
   kvfs_file_hash_t new_hash;
   if (orig_new != "/") {
     new_hash = std::filesystem::hash_value(orig_new.filename());
@@ -921,6 +860,7 @@ int KVFS::Link(const char *oldname, const char *newname) {
   }
   kvfsInodeKey
       new_key = {resolved_new.second.second.fstat_.st_ino, new_hash};
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
   // set the inode of this new link to the inode of the original file
   kvfsInodeValue new_md_ = kvfsInodeValue((orig_new == "/" ? orig_new : orig_new.filename()),
                                           old_md_.fstat_.st_ino,
@@ -930,13 +870,7 @@ int KVFS::Link(const char *oldname, const char *newname) {
   if (old_md_.real_key_ != old_key) {
     // check if original exists, if it doesn't exist then make the old one original
     key_str = old_md_.real_key_.pack();
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
     KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
     if (!sr.isValid()) {
       old_md_.real_key_ = old_key;
       --old_md_.fstat_.st_nlink;
@@ -945,13 +879,7 @@ int KVFS::Link(const char *oldname, const char *newname) {
       original_md_.parse(sr);
       ++original_md_.fstat_.st_nlink;
       value_str = original_md_.pack();
-#if KVFS_THREAD_SAFE
-      mutex_->lock();
-#endif
-      store_->Merge(key_str, value_str);
-#if KVFS_THREAD_SAFE
-      mutex_->unlock();
-#endif
+      batch->Put(key_str, value_str);
     }
   }
   new_md_.real_key_ = old_md_.real_key_; // set real key to old key, needed to resolve links and avoid infinite loops
@@ -959,40 +887,29 @@ int KVFS::Link(const char *oldname, const char *newname) {
   ++old_md_.fstat_.st_nlink;
   old_md_.fstat_.st_atim.tv_sec = time_now;
   old_md_.fstat_.st_mtim.tv_sec = time_now;
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   key_str = old_key.pack();
   value_str = old_md_.pack();
-  bool status1 = store_->Merge(key_str, value_str);
+  batch->Put(key_str, value_str);
   key_str = new_key.pack();
   value_str = new_md_.pack();
-  bool status2 = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
-  return status1 & status2;
+  batch->Put(key_str, value_str);
+  batch->Flush();
+  EntryCreated(new_key);
+  EntryUpdated(old_key);
+  EntryUpdated(old_md_.real_key_);
+  return 0;
 }
 int KVFS::SymLink(const char *path1, const char *path2) {
-  std::filesystem::path orig_path2 = std::filesystem::path(path1);
+  return SymLinkAt(path1, AT_FDCWD, path2);
+}
+int KVFS::SymLinkAt(const char *path1, int dirfd, const char *path2) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_SYMLINK);
+  std::filesystem::path orig_path2 = std::filesystem::path(path2);
   CheckNameLength(orig_path2);
-  if (orig_path2.is_relative()) {
-    // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_path2 = pwd_.append(orig_path2.string());
-    pwd_ = prv_;
-  }
-  if (orig_path2.is_absolute()) {
-    // must start with single "/"
-    if (orig_path2.root_path() != "/") {
-      throw FSError(FSErrorType::FS_EINVAL, "Given name is not in the correct format");
-    }
-  }
 
-  std::filesystem::path input = orig_path2.parent_path();
-  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved_path_2 = RealPath(input);
-  resolved_path_2.first.append(orig_path2.filename().string());
-  orig_path2 = resolved_path_2.first.lexically_normal();
+  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved_path_2 =
+      ResolveAt(dirfd, orig_path2);
+  orig_path2 = resolved_path_2.first;
   // The symlink() function shall create a symbolic link called path2 that contains the string pointed to by path1
   // (path2 is the name of the symbolic link created, path1 is the string contained in the symbolic link).
   //The string pointed to by path1 shall be treated only as a string and shall not be validated as a pathname.
@@ -1008,40 +925,34 @@ int KVFS::SymLink(const char *path1, const char *path2) {
 
   std::string key_str = slkey_.pack();
   std::string value_str;
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
+  InodeLocks::Guard guard = locks_->Exclusive({resolved_path_2.second.second.fstat_.st_ino});
+  KVStoreResult sr = LookupEntry(slkey_);
   if (sr.isValid()) {
     // return error EEXISTS
-    errorno_ = -EEXIST;
+    CurrentSession()->errorno_ = -EEXIST;
     throw FSError(FSErrorType::FS_EEXIST, "The path2 argument names an existing file.");
   }
-  // create the symlink
+  // create the symlink, its contents and the allocator state in one write
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
   kvfsInodeValue slmd_ =
       kvfsInodeValue((orig_path2 == "/" ? orig_path2 : orig_path2.filename()),
                      GetFreeInode(),
-                     S_IFLNK | resolved_path_2.second.second.fstat_.st_mode, slkey_);
+                     S_IFLNK | (resolved_path_2.second.second.fstat_.st_mode & ~S_IFMT), slkey_);
+  SetOwner(&slmd_);
 
   kvfsBlockKey sl_blck_key = kvfsBlockKey(slmd_.fstat_.st_ino, 0);
   size_t blcks_to_write = strlen(path1) / KVFS_DEF_BLOCK_SIZE;
   blcks_to_write += (strlen(path1) % KVFS_DEF_BLOCK_SIZE) ? 1 : 0;
-  ssize_t size = WriteBlocks(sl_blck_key, blcks_to_write, path1, strlen(path1));
+  ssize_t size = PackBlocks(batch.get(), sl_blck_key, blcks_to_write, path1, strlen(path1));
   slmd_.fstat_.st_size = size;
   value_str = slmd_.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  bool status1 = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
-  return status1;
+  batch->Put(key_str, value_str);
+  batch->Flush();
+  EntryCreated(slkey_);
+  return 0;
 }
 ssize_t KVFS::ReadLink(const char *filename, char *buffer, size_t size) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_READLINK);
   // The readlink() function shall place the contents of the symbolic link referred to by path in the buffer buf which
   // has size bufsize. If the number of bytes in the symbolic link is less than bufsize, the contents of the remainder
   // of buf are unspecified. If the buf argument is not large enough to contain the link content, the first bufsize
@@ -1051,9 +962,7 @@ ssize_t KVFS::ReadLink(const char *filename, char *buffer, size_t size) {
   CheckNameLength(orig_);
   if (orig_.is_relative()) {
     // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+    orig_ = CurrentSession()->pwd_ / orig_;
   }
   if (orig_.is_absolute()) {
     // must start with single "/"
@@ -1076,15 +985,9 @@ ssize_t KVFS::ReadLink(const char *filename, char *buffer, size_t size) {
 
   std::string key_str = key.pack();
   // check if the key names an existing file
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (!sr.isValid()) {
-    errorno_ = -ENONET;
+    CurrentSession()->errorno_ = -ENONET;
     throw FSError(FSErrorType::FS_ENOENT,
                   "A component of path does not name an existing file or path is an empty string.");
   }
@@ -1093,46 +996,36 @@ ssize_t KVFS::ReadLink(const char *filename, char *buffer, size_t size) {
   // check if it is a symlink
   if (!S_ISLNK(md_.fstat_.st_mode)) {
     // not a symlink
-    errorno_ = -ENOLINK;
-    return errorno_;
+    CurrentSession()->errorno_ = -ENOLINK;
+    return CurrentSession()->errorno_;
   }
   kvfsBlockKey blck_key_ = kvfsBlockKey(md_.fstat_.st_ino, 0);
   ssize_t size_to_read = (size > md_.fstat_.st_size ? md_.fstat_.st_size : size);
   size_t blcks_to_read = size_to_read / KVFS_DEF_BLOCK_SIZE;
   blcks_to_read += (size_to_read % KVFS_DEF_BLOCK_SIZE) ? 1 : 0;
-  ssize_t pair = ReadBlocks(blck_key_, blcks_to_read, size, buffer);
+  ssize_t pair = ReadBlocks(blck_key_, blcks_to_read, size, buffer, nullptr);
   return pair;
 }
 int KVFS::UnLink(const char *filename) {
+  return UnLinkAt(AT_FDCWD, filename, 0);
+}
+int KVFS::UnLinkAt(int dirfd, const char *filename, int flags) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_UNLINK);
   // decrease file's link count by one, if it reaches zero then delete the file from store
   std::filesystem::path orig_ = std::filesystem::path(filename);
   if (orig_.filename() == "." || orig_.filename() == "..") {
-    errorno_ = -EINVAL;
+    CurrentSession()->errorno_ = -EINVAL;
     throw FSError(FSErrorType::FS_EINVAL, "The path argument contains a last component that is dot.");
   }
   CheckNameLength(orig_);
   if (orig_ == "/") {
-    errorno_ = -EINVAL;
+    CurrentSession()->errorno_ = -EINVAL;
     throw FSError(FSErrorType::FS_EINVAL, "The path argument refers to the root directory,"
                                           " it is not possible to remove root directory.");
   }
-  if (orig_.is_relative()) {
-    // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
-  }
-  if (orig_.is_absolute()) {
-    // must start with single "/"
-    if (orig_.root_path() != "/") {
-      throw FSError(FSErrorType::FS_EINVAL, "Given name is not in the correct format");
-    }
-  }
   // Attemp to resolve the real path from given path
-
-  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = RealPath(orig_.parent_path());
-  resolved.first.append(orig_.filename().string());
-  orig_ = resolved.first.lexically_normal();
+  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = ResolveAt(dirfd, orig_);
+  orig_ = resolved.first;
 
   kvfs_file_hash_t hash = std::filesystem::hash_value(orig_.filename());
   kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
@@ -1140,83 +1033,62 @@ int KVFS::UnLink(const char *filename) {
   std::string key_str = key.pack();
   std::string value_str;
 
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (!sr.isValid()) {
-    errorno_ = -ENOENT;
+    CurrentSession()->errorno_ = -ENOENT;
     throw FSError(FSErrorType::FS_ENOENT, "No such file or directory!");
   }
   // found the file
   kvfsInodeValue md_;
   md_.parse(sr);
+  InodeLocks::Guard guard = locks_->Exclusive({resolved.second.second.fstat_.st_ino, md_.fstat_.st_ino});
+  Reload(resolved.second.first, &resolved.second.second);
+  Reload(key, &md_);
+  if ((flags & AT_REMOVEDIR) && !S_ISDIR(md_.fstat_.st_mode)) {
+    CurrentSession()->errorno_ = -ENOTDIR;
+    throw FSError(FSErrorType::FS_ENOTDIR, "AT_REMOVEDIR is set but the path argument is not a directory.");
+  }
+  // the entry, its parent and the allocator state are committed as one write
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
   if (S_ISLNK(md_.fstat_.st_mode)) {
     // just delete it
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    bool status = store_->Delete(key_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    status &= FreeUpInodeNumber(md_.fstat_.st_ino);
-    return status;
+    batch->Delete(key_str);
+    FreeUpInodeNumber(md_.fstat_.st_ino, batch.get());
+    batch->Flush();
+    EntryRemoved(key);
+    return 0;
   }
   // decrease link count
   --md_.fstat_.st_nlink;
   if (md_.fstat_.st_nlink <= 0) {
     // remove it from store
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    bool status = store_->Delete(key_str);
-    status &= FreeUpInodeNumber(md_.dirent_.d_ino);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    // update the parent
-    --resolved.second.second.fstat_.st_nlink;
-    resolved.second.second.fstat_.st_mtim.tv_sec = time_now;
-    key_str = resolved.second.first.pack();
-    value_str = resolved.second.second.pack();
-
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    bool status2 = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    return status & status2;
+    batch->Delete(key_str);
+    FreeUpInodeNumber(md_.dirent_.d_ino, batch.get());
+  } else {
+    md_.fstat_.st_mtim.tv_sec = time_now;
+    // update it in store
+    value_str = md_.pack();
+    batch->Put(key_str, value_str);
   }
-  md_.fstat_.st_mtim.tv_sec = time_now;
-  // update it in store
-  value_str = md_.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  bool status1 = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
 
   // update the parent
   --resolved.second.second.fstat_.st_nlink;
   resolved.second.second.fstat_.st_mtim.tv_sec = time_now;
   key_str = resolved.second.first.pack();
   value_str = resolved.second.second.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  bool status2 = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
-  return status1 & status2;
+  batch->Put(key_str, value_str);
+  batch->Flush();
+  if (md_.fstat_.st_nlink <= 0) {
+    EntryRemoved(key);
+    if (S_ISDIR(md_.fstat_.st_mode)) {
+      dentry_cache_->ForgetDirectory(md_.fstat_.st_ino);
+    }
+  } else {
+    open_inodes_->Update(key, md_);
+    EntryUpdated(key);
+  }
+  EntryUpdated(resolved.second.first);
+  return 0;
 }
 int KVFS::RmDir(const char *filename) {
   return this->UnLink(filename);
@@ -1224,7 +1096,90 @@ int KVFS::RmDir(const char *filename) {
 int KVFS::Remove(const char *filename) {
   return this->UnLink(filename);
 }
+int KVFS::RemoveTree(const char *filename) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_REMOVE_TREE);
+  std::filesystem::path orig_ = std::filesystem::path(filename);
+  if (orig_.filename() == "." || orig_.filename() == "..") {
+    CurrentSession()->errorno_ = -EINVAL;
+    throw FSError(FSErrorType::FS_EINVAL, "The path argument contains a last component that is dot.");
+  }
+  CheckNameLength(orig_);
+  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = ResolveAt(AT_FDCWD, orig_);
+  orig_ = resolved.first;
+  if (orig_ == "/") {
+    CurrentSession()->errorno_ = -EINVAL;
+    throw FSError(FSErrorType::FS_EINVAL, "The path argument refers to the root directory,"
+                                          " it is not possible to remove root directory.");
+  }
+
+  kvfs_file_hash_t hash = std::filesystem::hash_value(orig_.filename());
+  kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
+  KVStoreResult sr = LookupEntry(key);
+  if (!sr.isValid()) {
+    CurrentSession()->errorno_ = -ENOENT;
+    throw FSError(FSErrorType::FS_ENOENT, "No such file or directory!");
+  }
+  kvfsInodeValue md_;
+  md_.parse(sr);
+  InodeLocks::Guard guard = locks_->Exclusive({resolved.second.second.fstat_.st_ino, md_.fstat_.st_ino});
+  Reload(resolved.second.first, &resolved.second.second);
+  Reload(key, &md_);
+
+  // detach: the entry, the orphan record and the parent are committed as one write,
+  // everything below the entry is left to the reclaimer
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+  batch->Delete(key.pack());
+  TreeReclaimer::Detach(md_, batch.get());
+  --resolved.second.second.fstat_.st_nlink;
+  resolved.second.second.fstat_.st_mtim.tv_sec = time_now;
+  batch->Put(resolved.second.first.pack(), resolved.second.second.pack());
+  batch->Flush();
+  EntryRemoved(key);
+  EntryUpdated(resolved.second.first);
+  if (S_ISDIR(md_.fstat_.st_mode)) {
+    dentry_cache_->ForgetDirectory(md_.fstat_.st_ino);
+  }
+  tree_reclaimer_->Reclaim(md_);
+  return 0;
+}
+int KVFS::WalkTree(const char *root, const kvfs_walk_visitor &visitor, const kvfs_walk_options &options) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_WALK_TREE);
+  std::filesystem::path orig_ = std::filesystem::path(root);
+  CheckNameLength(orig_);
+  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = ResolveAt(AT_FDCWD, orig_);
+  orig_ = resolved.first;
+  kvfs_file_hash_t hash;
+  kvfs_file_inode_t parent;
+  if (orig_ == "/") {
+    hash = std::filesystem::hash_value(orig_);
+    parent = 0;
+  } else {
+    hash = std::filesystem::hash_value(orig_.filename());
+    parent = resolved.second.second.fstat_.st_ino;
+  }
+  kvfsInodeKey key = {parent, hash};
+
+  // the root is read from the same snapshot as the rest of the walk
+  std::shared_ptr<const KVStore::Snapshot> snapshot = store_->GetSnapshot();
+  std::string key_str = key.pack();
+  std::unique_ptr<KVStore::Iterator> it = store_->GetIterator(snapshot.get());
+  it->Seek(key_str);
+  if (!it->Valid() || it->key_view() != key_str || it->value_view().size() != sizeof(kvfsInodeValue)) {
+    CurrentSession()->errorno_ = -ENOENT;
+    throw FSError(FSErrorType::FS_ENOENT, "No such file or directory!");
+  }
+  kvfsInodeValue md_;
+  memcpy(static_cast<void *>(&md_), it->value_view().data(), sizeof(kvfsInodeValue));
+  it.reset();
+
+  TreeWalker walker(store_, snapshot.get(), visitor, options);
+  return walker.Walk(parent, md_);
+}
 int KVFS::Rename(const char *oldname, const char *newname) {
+  return RenameAt(AT_FDCWD, oldname, AT_FDCWD, newname);
+}
+int KVFS::RenameAt(int olddirfd, const char *oldname, int newdirfd, const char *newname) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_RENAME);
 
   std::string key_str;
   std::string value_str;
@@ -1234,32 +1189,20 @@ int KVFS::Rename(const char *oldname, const char *newname) {
   CheckNameLength(oldname_orig);
   CheckNameLength(newname_orig);
   if (oldname_orig.lexically_normal() == "/") {
-    errorno_ = -EINVAL;
+    CurrentSession()->errorno_ = -EINVAL;
     throw FSError(FSErrorType::FS_EINVAL, "Root directory cannot be renamed");
   }
   if (newname_orig.lexically_normal() == "/") {
-    errorno_ = -EINVAL;
+    CurrentSession()->errorno_ = -EINVAL;
     throw FSError(FSErrorType::FS_EINVAL, "Root directory cannot be renamed");
   }
   // check each for parents to exist, then rename
-  if (oldname_orig.is_relative()) {
-    std::filesystem::path prv_ = pwd_;
-    oldname_orig = pwd_.append(oldname_orig.string());
-    pwd_ = prv_;
-  }
-  if (newname_orig.is_relative()) {
-    std::filesystem::path prv_ = pwd_;
-    newname_orig = pwd_.append(newname_orig.string());
-    pwd_ = prv_;
-  }
   std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>>
-      oldname_resolved = RealPath(oldname_orig.parent_path());
-  oldname_resolved.first.append(oldname_orig.filename().string());
-  oldname_orig = oldname_resolved.first.lexically_normal();
+      oldname_resolved = ResolveAt(olddirfd, oldname_orig);
+  oldname_orig = oldname_resolved.first;
   std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>>
-      newname_resolved = RealPath(newname_orig.parent_path());
-  newname_resolved.first.append(newname_orig.filename().string());
-  newname_orig = newname_resolved.first.lexically_normal();
+      newname_resolved = ResolveAt(newdirfd, newname_orig);
+  newname_orig = newname_resolved.first;
   // check if oldname exists and newname doesn't exist
   kvfs_file_hash_t old_hash = std::filesystem::hash_value(oldname_orig.filename());
   kvfs_file_hash_t new_hash = std::filesystem::hash_value(newname_orig.filename());
@@ -1268,21 +1211,21 @@ int KVFS::Rename(const char *oldname, const char *newname) {
   kvfsInodeKey new_key =
       {newname_resolved.second.second.fstat_.st_ino, new_hash};
   key_str = old_key.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult old_sr = store_->Get(key_str);
-  key_str = new_key.pack();
-  bool new_exists = store_->Get(key_str).isValid();
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (!old_sr.isValid()) {
-    errorno_ = -ENOENT;
+    CurrentSession()->errorno_ = -ENOENT;
     throw FSError(FSErrorType::FS_ENOENT, "The oldname argument doesn't name a existing entry");
   }
+  kvfsInodeValue old_md_;
+  old_md_.parse(old_sr);
+  InodeLocks::Guard guard = locks_->Exclusive({oldname_resolved.second.second.fstat_.st_ino,
+                                               newname_resolved.second.second.fstat_.st_ino,
+                                               old_md_.fstat_.st_ino});
+  Reload(oldname_resolved.second.first, &oldname_resolved.second.second);
+  Reload(old_key, &old_md_);
+  bool new_exists = LookupEntry(new_key).isValid();
   if (new_exists) {
-    errorno_ = -EEXIST;
+    CurrentSession()->errorno_ = -EEXIST;
     throw FSError(FSErrorType::FS_EEXIST, "The newname argument already exists");
   }
   auto batch = store_->GetWriteBatch();
@@ -1296,8 +1239,7 @@ int KVFS::Rename(const char *oldname, const char *newname) {
   batch->Delete(key_str);
   batch->Put(key_str, value_str);
   // copy over old metadata under new key
-  kvfsInodeValue new_md_;
-  new_md_.parse(old_sr);
+  kvfsInodeValue new_md_ = old_md_;
   std::string new_name = newname_resolved.first.filename();
   kvfs_dirent new_dirent{};
   new_dirent.d_ino = new_md_.dirent_.d_ino;
@@ -1308,31 +1250,27 @@ int KVFS::Rename(const char *oldname, const char *newname) {
   batch->Put(key_str, value_str);
   batch->Flush();
   batch.reset();
+  // descriptors open on it follow it to the new name
+  open_inodes_->Rekey(old_key, new_key, new_md_);
+  EntryRemoved(old_key);
+  EntryCreated(new_key);
+  EntryUpdated(oldname_resolved.second.first);
   return 0;
 }
 int KVFS::MkDir(const char *filename, mode_t mode) {
+  return MkDirAt(AT_FDCWD, filename, mode);
+}
+int KVFS::MkDirAt(int dirfd, const char *filename, mode_t mode) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_MKDIR);
   std::filesystem::path orig_ = std::filesystem::path(filename);
   CheckNameLength(orig_);
-  if (orig_.is_relative()) {
-    // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
-  }
-  if (orig_.is_absolute()) {
-    // must start with single "/"
-    if (orig_.root_path() != "/") {
-      throw FSError(FSErrorType::FS_EINVAL, "Given name is not in the correct format");
-    }
-  }
   if (orig_.lexically_normal() == "/") {
-    errorno_ = -EINVAL;
+    CurrentSession()->errorno_ = -EINVAL;
     throw FSError(FSErrorType::FS_EINVAL, "Cannot create a directory with name (\"/\") !");
   }
   // Attemp to resolve the real path from given path
-  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = RealPath(orig_.parent_path());
-  resolved.first.append(orig_.filename().string());
-  orig_ = resolved.first.lexically_normal();
+  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = ResolveAt(dirfd, orig_);
+  orig_ = resolved.first;
 
   // now try to make dir at that parent directory
   // resolver does set current md and key to the parent of this file so use those and then update it in store.
@@ -1340,62 +1278,135 @@ int KVFS::MkDir(const char *filename, mode_t mode) {
   kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
   std::string key_str = key.pack();
   std::string value_str;
-#if KVFS_THREAD_SAFE
-  // lock
-  mutex_->lock();
-#endif
-  if (store_->Get(key_str).isValid()) {
+  InodeLocks::Guard guard = locks_->Exclusive({resolved.second.second.fstat_.st_ino});
+  Reload(resolved.second.first, &resolved.second.second);
+  if (LookupEntry(key).isValid()) {
     // exists return error
-    errorno_ = -EEXIST;
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
+    CurrentSession()->errorno_ = -EEXIST;
+    throw FSError(FSErrorType::FS_EEXIST, "A file named filename already exists.");
   }
+  // the new directory, its parent and the allocator state are committed as one write
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
   kvfsInodeValue md_ = kvfsInodeValue(orig_.filename(),
                                       GetFreeInode(),
                                       mode | resolved.second.second.fstat_.st_mode, key);
 
   // update meta data
   md_.fstat_.st_mode |= S_IFDIR;
+  SetOwner(&md_);
   // set this file's group id to its parent's
   md_.fstat_.st_gid = resolved.second.second.fstat_.st_gid;
   // update ctime
   md_.fstat_.st_ctim.tv_sec = time_now;
   // update it in store
   value_str = md_.pack();
-  bool status1 = store_->Put(key_str, value_str);
+  batch->Put(key_str, value_str);
   // update the parent
   ++resolved.second.second.fstat_.st_nlink;
   resolved.second.second.fstat_.st_mtim.tv_sec = time_now;
   key_str = resolved.second.first.pack();
   value_str = resolved.second.second.pack();
-  bool status2 = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
-  return status1 & status2;
+  batch->Put(key_str, value_str);
+  // a new directory is empty, so its filter is complete from the start; tracked before the flush, as
+  // nothing can be created in it until then
+  dentry_cache_->TrackDirectory(md_.fstat_.st_ino, {}, dentry_cache_->NegativeGeneration(md_.fstat_.st_ino));
+  batch->Flush();
+  EntryCreated(key);
+  EntryUpdated(resolved.second.first);
+  return 0;
 }
-int KVFS::Stat(const char *filename, kvfs_stat *buf) {
-  std::filesystem::path orig_ = std::filesystem::path(filename);
+int KVFS::CreateFilesBatch(const char *dir, const kvfs_create_entry *entries, size_t count) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_CREATE_FILES_BATCH);
+  std::filesystem::path orig_ = std::filesystem::path(dir);
   CheckNameLength(orig_);
-  if (orig_.is_relative()) {
-    // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = ResolveAt(AT_FDCWD, orig_);
+  orig_ = resolved.first;
+  kvfsInodeKey dir_key;
+  if (orig_ == "/") {
+    dir_key = {0, std::filesystem::hash_value(orig_)};
+  } else {
+    dir_key = {resolved.second.second.fstat_.st_ino, std::filesystem::hash_value(orig_.filename())};
   }
-  if (orig_.is_absolute()) {
-    // must start with single "/"
-    if (orig_.root_path() != "/") {
-      throw FSError(FSErrorType::FS_EINVAL, "Given name is not in the correct format");
+  KVStoreResult sr = LookupEntry(dir_key);
+  if (!sr.isValid()) {
+    CurrentSession()->errorno_ = -ENOENT;
+    throw FSError(FSErrorType::FS_ENOENT, "No such file or directory!");
+  }
+  kvfsInodeValue dir_md_;
+  dir_md_.parse(sr);
+  if (!S_ISDIR(dir_md_.fstat_.st_mode)) {
+    CurrentSession()->errorno_ = -ENOTDIR;
+    throw FSError(FSErrorType::FS_ENOTDIR, "The dir argument is not a directory.");
+  }
+  // held from the existence checks to the last batch, other creates in the directory wait for it
+  InodeLocks::Guard guard = locks_->Exclusive({dir_md_.fstat_.st_ino});
+  Reload(dir_key, &dir_md_);
+
+  // check every name first, so a failure leaves nothing half created
+  std::vector<kvfsInodeKey> keys(count);
+  std::unordered_set<kvfs_file_hash_t> hashes;
+  for (size_t i = 0; i < count; ++i) {
+    std::filesystem::path name = entries[i].name ? entries[i].name : "";
+    if (name.empty() || name == "." || name == ".." || name.string().find('/') != std::string::npos) {
+      CurrentSession()->errorno_ = -EINVAL;
+      throw FSError(FSErrorType::FS_EINVAL, "An entry name is not a single path component.");
+    }
+    CheckNameLength(name);
+    keys[i] = {dir_md_.fstat_.st_ino, std::filesystem::hash_value(name)};
+    if (!hashes.insert(keys[i].hash_).second || LookupEntry(keys[i]).isValid()) {
+      CurrentSession()->errorno_ = -EEXIST;
+      throw FSError(FSErrorType::FS_EEXIST, "An entry name already exists in the directory.");
     }
   }
 
+  // the files of each batch are committed with the directory update that accounts for them
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+  size_t batch_bytes = 0;
+  size_t batch_first = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const kvfs_create_entry &entry = entries[i];
+    mode_t mode = (entry.mode & S_IFMT) ? entry.mode : (entry.mode | S_IFREG);
+    kvfsInodeValue md_ = kvfsInodeValue(entry.name, GetFreeInode(), mode, keys[i]);
+    SetOwner(&md_);
+    md_.fstat_.st_mtim = md_.fstat_.st_ctim;
+    md_.fstat_.st_atim = md_.fstat_.st_ctim;
+    if (entry.data && entry.size > 0) {
+      size_t blocks = entry.size / KVFS_DEF_BLOCK_SIZE;
+      blocks += (entry.size % KVFS_DEF_BLOCK_SIZE) ? 1 : 0;
+      md_.fstat_.st_size = PackBlocks(batch.get(), kvfsBlockKey(md_.fstat_.st_ino, 0), blocks, entry.data, entry.size);
+      timer.Add(KVFS_COUNTER_FS_BYTES_WRITTEN, entry.size);
+      md_.fstat_.st_blocks = blocks;
+      batch_bytes += blocks * sizeof(kvfsBlockValue);
+    }
+    batch->Put(keys[i].pack(), md_.pack());
+    batch_bytes += sizeof(kvfsInodeValue);
+
+    if (batch_bytes >= kCreateBatchBytes || i + 1 == count) {
+      dir_md_.fstat_.st_nlink += i + 1 - batch_first;
+      dir_md_.fstat_.st_mtim.tv_sec = time_now;
+      batch->Put(dir_key.pack(), dir_md_.pack());
+      batch->Flush();
+      for (size_t j = batch_first; j <= i; ++j) {
+        EntryCreated(keys[j]);
+      }
+      EntryUpdated(dir_key);
+      batch_bytes = 0;
+      batch_first = i + 1;
+    }
+  }
+  return 0;
+}
+int KVFS::Stat(const char *filename, kvfs_stat *buf) {
+  return StatAt(AT_FDCWD, filename, buf);
+}
+int KVFS::StatAt(int dirfd, const char *filename, kvfs_stat *buf) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STAT);
+  std::filesystem::path orig_ = std::filesystem::path(filename);
+  CheckNameLength(orig_);
+
   // Attemp to resolve the real path from given path
-  std::filesystem::path input = orig_.parent_path();
-  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = RealPath(input);
-  resolved.first.append(orig_.filename().string());
-  orig_ = resolved.first.lexically_normal();
+  std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved = ResolveAt(dirfd, orig_);
+  orig_ = resolved.first;
   kvfs_file_hash_t hash;
   if (orig_ != "/") {
     hash = std::filesystem::hash_value(orig_.filename());
@@ -1404,16 +1415,9 @@ int KVFS::Stat(const char *filename, kvfs_stat *buf) {
   }
   // check for existing file
   kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
-  std::string key_str = key.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
+  KVStoreResult sr = LookupEntry(key);
   if (!sr.isValid()) {
-    errorno_ = -ENONET;
+    CurrentSession()->errorno_ = -ENONET;
     throw FSError(FSErrorType::FS_ENOENT,
                   "A component of path does not name an existing file or path is an empty string.");
   }
@@ -1422,12 +1426,95 @@ int KVFS::Stat(const char *filename, kvfs_stat *buf) {
   *buf = md_.fstat_;
   return 0;
 }
+ssize_t KVFS::StatMany(const char *const *paths, size_t count, kvfs_stat *bufs, int *errors) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_STAT_MANY);
+  std::vector<kvfsInodeValue> mds;
+  ResolveMany(paths, count, &mds, errors);
+  ssize_t found = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (errors[i] == 0) {
+      bufs[i] = mds[i].fstat_;
+      ++found;
+    }
+  }
+  return found;
+}
+ssize_t KVFS::ReadFilesMany(const char *const *paths,
+                            size_t count,
+                            void *const *buffers,
+                            const size_t *sizes,
+                            ssize_t *read) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_READ_FILES_MANY);
+  std::vector<kvfsInodeValue> mds;
+  std::vector<int> errors(count);
+  ResolveMany(paths, count, &mds, errors.data());
+
+  // the blocks of all the files go through the same multi-gets, each remembers which file and offset it is for
+  std::vector<std::string> keys;
+  std::vector<std::pair<size_t, size_t>> targets;
+  std::vector<size_t> lengths(count, 0);
+  auto fetch = [&]() {
+    if (keys.empty()) {
+      return;
+    }
+    std::vector<KVStoreResult> results = store_->MultiGet(keys);
+    for (size_t j = 0; j < results.size(); ++j) {
+      if (!results[j].isValid() || results[j].asString().size() != sizeof(kvfsBlockValue)) {
+        continue;
+      }
+      // the data is copied straight out of the value instead of through a parsed kvfsBlockValue
+      const char *value = results[j].asString().data();
+      size_t i = targets[j].first;
+      size_t offset = targets[j].second;
+      size_t block_size;
+      memcpy(&block_size, value + offsetof(kvfsBlockValue, size_), sizeof(block_size));
+      size_t want = std::min<size_t>({KVFS_DEF_BLOCK_SIZE, lengths[i] - offset, block_size});
+      memcpy(static_cast<char *>(buffers[i]) + offset, value + offsetof(kvfsBlockValue, data), want);
+      read[i] += want;
+      timer.Add(KVFS_COUNTER_FS_BYTES_READ, want);
+    }
+    keys.clear();
+    targets.clear();
+  };
+
+  ssize_t files = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (errors[i] != 0) {
+      read[i] = errors[i];
+      continue;
+    }
+    const kvfs_stat &st = mds[i].fstat_;
+    if (S_ISDIR(st.st_mode)) {
+      read[i] = -EISDIR;
+      continue;
+    }
+    if ((st.st_mode & S_IFMT) != 0 && !S_ISREG(st.st_mode)) {
+      // files created by OpenAt carry no type bits
+      read[i] = -EINVAL;
+      continue;
+    }
+    read[i] = 0;
+    ++files;
+    lengths[i] = std::min<size_t>(sizes[i], static_cast<size_t>(st.st_size));
+    for (size_t offset = 0; offset < lengths[i]; offset += KVFS_DEF_BLOCK_SIZE) {
+      kvfsBlockKey blck_key_;
+      blck_key_.inode_ = st.st_ino;
+      blck_key_.block_number_ = offset / KVFS_DEF_BLOCK_SIZE;
+      keys.push_back(blck_key_.pack());
+      targets.emplace_back(i, offset);
+      if (keys.size() == kReadManyBatch) {
+        fetch();
+      }
+    }
+  }
+  fetch();
+  return files;
+}
 off_t KVFS::LSeek(int filedes, off_t offset, int whence) {
-  kvfsFileHandle fh_;
-  bool status = open_fds_->Find(filedes, fh_);
-  ssize_t read = 0;
-  if (!status) {
-    errorno_ = -EBADFD;
+  Stats::Timer timer(stats_.get(), KVFS_OP_LSEEK);
+  OpenFilesCache::Handle handle = open_fds_->Find(filedes);
+  if (!handle) {
+    CurrentSession()->errorno_ = -EBADFD;
     throw FSError(FSErrorType::FS_EBADFD, "The file descriptor doesn't name a opened file, invalid fd");
   }
 
@@ -1435,6 +1522,7 @@ off_t KVFS::LSeek(int filedes, off_t offset, int whence) {
   //  If whence is SEEK_CUR, the file offset shall be set to its current location plus offset.
   //  If whence is SEEK_END, the file offset shall be set to the size of the file plus offset.
 
+  kvfsFileHandle &fh_ = *handle;
   kvfs_off_t result;
   if (whence == SEEK_SET) {
     fh_.offset_ = offset;
@@ -1443,11 +1531,9 @@ off_t KVFS::LSeek(int filedes, off_t offset, int whence) {
     fh_.offset_ += offset;
   }
   if (whence == SEEK_END) {
-    fh_.md_.fstat_.st_size += offset;
+    fh_.offset_ = fh_.inode_->md_.fstat_.st_size + offset;
   }
   result = fh_.offset_;
-  open_fds_->Evict(filedes);
-  open_fds_->Insert(filedes, fh_);
 
   return result;
 }
@@ -1461,109 +1547,130 @@ ssize_t KVFS::CopyFileRange(int inputfd,
   return -1;
 }
 void KVFS::Sync() {
-  store_->Sync();
+  Stats::Timer timer(stats_.get(), KVFS_OP_SYNC);
+  WriteBackOpenInodes();
+  FlushTimestamps();
+  group_commit_->Sync();
 }
 int KVFS::FSync(int filedes) {
-  // currently only same as sync
-  this->Sync();
+  Stats::Timer timer(stats_.get(), KVFS_OP_FSYNC);
+  return SyncFile(filedes, true);
+}
+int KVFS::FDataSync(int filedes) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_FDATASYNC);
+  return SyncFile(filedes, false);
+}
+int KVFS::SyncFile(int filedes, bool metadata) {
+  kvfsFileHandle handle;
+  if (!open_fds_->Copy(filedes, &handle)) {
+    CurrentSession()->errorno_ = -EBADFD;
+    throw FSError(FSErrorType::FS_EBADFD, "The file descriptor doesn't name a opened file, invalid fd");
+  }
+  // only this file is written back, the dirty inodes of other files stay in memory
+  kvfsOpenInode *inode = handle.inode_.get();
+  InodeLocks::Guard guard = locks_->Exclusive({inode->md_.fstat_.st_ino});
+  SyncInode(inode, &guard, metadata);
   return 0;
 }
 ssize_t KVFS::PRead(int filedes, void *buffer, size_t size, off_t offset) {
-  // only read the file from offset argument, doesn't modify filedes offset
-  kvfsFileHandle fh_;
-  bool status = open_fds_->Find(filedes, fh_);
-  ssize_t read = 0;
-  if (!status) {
-    errorno_ = -EBADFD;
+  Stats::Timer timer(stats_.get(), KVFS_OP_PREAD);
+  // the offset is neither read nor moved, reads of one descriptor need not wait for each other
+  kvfsFileHandle handle;
+  if (!open_fds_->Copy(filedes, &handle)) {
+    CurrentSession()->errorno_ = -EBADFD;
     throw FSError(FSErrorType::FS_EBADFD, "The file descriptor doesn't name a opened file, invalid fd");
   }
-  // check flags first
-  if (offset > fh_.md_.fstat_.st_size) {
-    // offset exceeds file size
-    return 0;
+  ssize_t read = PReadHandle(&handle, buffer, size, offset);
+  timer.Add(KVFS_COUNTER_FS_BYTES_READ, read);
+  return read;
+}
+ssize_t KVFS::PReadHandle(kvfsFileHandle *fh, void *buffer, size_t size, off_t offset) {
+  // only read the file from offset argument, doesn't modify filedes offset
+  kvfsFileHandle &fh_ = *fh;
+  kvfsOpenInode &inode = *fh_.inode_;
+  ssize_t read = 0;
+  kvfs_file_inode_t ino = inode.md_.fstat_.st_ino;
+  kvfs_off_t file_size;
+  std::shared_ptr<const KVStore::Snapshot> snapshot;
+  {
+    // writers hold the lock for the whole of a write, so the size and the snapshot taken under it see
+    // either all of a write or none of it; the blocks are then read from the snapshot without the lock,
+    // a writer waits at most for a snapshot to be taken and never for a read
+    InodeLocks::Guard guard = locks_->Shared(ino);
+    file_size = inode.md_.fstat_.st_size;
+    // check flags first
+    if (offset > file_size) {
+      // offset exceeds file size
+      return 0;
+    }
+    // update stats
+    TouchAtime(&fh_);
+    if (offset == file_size) {
+      // eof
+      return read;
+    }
+    snapshot = store_->GetSnapshot();
   }
 
-  if (offset == fh_.md_.fstat_.st_size) {
-    // eof
-    // update stats and return
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    if (!(fh_.flags_ & O_NOATIME)) {
-      // update accesstimes on the file
-      fh_.md_.fstat_.st_atim.tv_sec = time_now;
-    }
-    open_fds_->Insert(filedes, fh_);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    return read;
+  size_t length = std::min<size_t>(size, file_size - offset);
+  if (block_fetcher_ && length >= KVFS_PARALLEL_READ_MIN) {
+    // the blocks of a large read are fetched concurrently, see BlockFetcher
+    return block_fetcher_->Read(ino, offset, length, buffer, snapshot.get());
   }
 
   // determine where to read from and calculate blocks to read.
 
-  size_t size_can_read = fh_.md_.fstat_.st_size > size ? size : fh_.md_.fstat_.st_size;
+  size_t size_can_read = length;
 
   // calculate block key to read from and read upto size_can_read
 
   kvfsBlockKey blck_key_;
-  blck_key_.inode_ = fh_.md_.fstat_.st_ino;
+  blck_key_.inode_ = ino;
   blck_key_.block_number_ = offset / KVFS_DEF_BLOCK_SIZE;
   kvfs_off_t blck_offset = offset % KVFS_DEF_BLOCK_SIZE;
   void *idx = buffer;
   std::string key_str = blck_key_.pack();
   std::string value_str;
-  KVStoreResult sr = store_->Get(key_str);
+  KVStoreResult sr = store_->Get(key_str, snapshot.get());
   if (sr.isValid()) {
     kvfsBlockValue bv_;
     bv_.parse(sr);
-    auto pair = ReadBlock(&bv_, buffer, size, blck_offset);
+    // blocks keep their contents past a truncated size, so the read is bounded by length and not size
+    auto pair = ReadBlock(&bv_, buffer, length, blck_offset);
     read += pair.first;
     idx = pair.second;
-    value_str = bv_.pack();
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    blck_key_ = kvfsBlockKey(fh_.md_.fstat_.st_ino, blck_key_.block_number_ + 1);
+    blck_key_ = kvfsBlockKey(ino, blck_key_.block_number_ + 1);
   }
 
-  size_can_read -= read;
+  size_can_read -= std::min<size_t>(read, size_can_read);
   size_t blocks_to_read_ = size_can_read / KVFS_DEF_BLOCK_SIZE;
   blocks_to_read_ += ((size_can_read % KVFS_DEF_BLOCK_SIZE) > 0) ? 1 : 0;
-  read += ReadBlocks(blck_key_, blocks_to_read_, size_can_read, idx);
+  read += ReadBlocks(blck_key_, blocks_to_read_, size_can_read, idx, snapshot.get());
   // finished
-  // update stats and return
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  if (!(fh_.flags_ & O_NOATIME)) {
-    // update accesstimes on the file
-    fh_.md_.fstat_.st_atim.tv_sec = time_now;
-  }
-  open_fds_->Insert(filedes, fh_);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   return read;
 }
 
 ssize_t KVFS::PWrite(int filedes, const void *buffer, size_t size, off_t offset) {
-  kvfsFileHandle fh_;
-  bool status = open_fds_->Find(filedes, fh_);
-  ssize_t written = 0;
-  if (!status) {
-    errorno_ = -EBADFD;
+  Stats::Timer timer(stats_.get(), KVFS_OP_PWRITE);
+  // the offset of the descriptor is left as it is, the inode lock orders the writes
+  kvfsFileHandle handle;
+  if (!open_fds_->Copy(filedes, &handle)) {
+    CurrentSession()->errorno_ = -EBADFD;
     throw FSError(FSErrorType::FS_EBADFD, "The file descriptor doesn't name a opened file, invalid fd");
   }
+  return PWriteHandle(&handle, buffer, size, offset);
+}
+ssize_t KVFS::PWriteHandle(kvfsFileHandle *fh, const void *buffer, size_t size, off_t offset) {
+  kvfsFileHandle &fh_ = *fh;
+  kvfsOpenInode &inode = *fh_.inode_;
+  ssize_t written = 0;
+  // blocks are read, filled and written back
+  InodeLocks::Guard guard = locks_->Exclusive({inode.md_.fstat_.st_ino});
   // check flags first
 
-  if (offset > fh_.md_.fstat_.st_size) {
+  if (offset > inode.md_.fstat_.st_size) {
     // offset exceeds file size
-    errorno_ = -E2BIG;
+    CurrentSession()->errorno_ = -E2BIG;
     throw FSError(FSErrorType::FS_EINTR, "The offset argument exceeds the filedes's file size.");
   }
 
@@ -1571,7 +1678,7 @@ ssize_t KVFS::PWrite(int filedes, const void *buffer, size_t size, off_t offset)
   // pass that to blocks writer.
 
   kvfsBlockKey blck_key_;
-  blck_key_.inode_ = fh_.md_.fstat_.st_ino;
+  blck_key_.inode_ = inode.md_.fstat_.st_ino;
   blck_key_.block_number_ = offset / KVFS_DEF_BLOCK_SIZE;
   kvfs_off_t blck_offset = offset % KVFS_DEF_BLOCK_SIZE;
   const void *idx = buffer;
@@ -1586,14 +1693,8 @@ ssize_t KVFS::PWrite(int filedes, const void *buffer, size_t size, off_t offset)
     written += pair.first;
     idx = pair.second;
     value_str = bv_.pack();
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
     store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
-    blck_key_ = kvfsBlockKey(fh_.md_.fstat_.st_ino, blck_key_.block_number_ + 1);
+    blck_key_ = kvfsBlockKey(inode.md_.fstat_.st_ino, blck_key_.block_number_ + 1);
   }
 
   size_t size_left = size - written;
@@ -1605,34 +1706,31 @@ ssize_t KVFS::PWrite(int filedes, const void *buffer, size_t size, off_t offset)
 
   // update stats
   if ((fh_.flags_ & O_NOATIME) == 0)
-    fh_.md_.fstat_.st_mtim.tv_sec = time_now;
-  fh_.offset_ += written;
+    inode.md_.fstat_.st_mtim.tv_sec = time_now;
+  fh_.offset_ = offset + written;
 
-  fh_.md_.fstat_.st_size = (fh_.offset_ > fh_.md_.fstat_.st_size) ? fh_.offset_ : fh_.md_.fstat_.st_size;
+  inode.md_.fstat_.st_size = std::max<kvfs_off_t>(inode.md_.fstat_.st_size, offset + written);
+  inode.dirty_ = true;
+  inode.unsynced_ = true;
+  if (fh_.flags_ & O_DSYNC) {
+    SyncInode(&inode, &guard, (fh_.flags_ & O_SYNC) == O_SYNC);
+  }
+  stats_->Add(KVFS_COUNTER_FS_BYTES_WRITTEN, written);
 
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  // update this filedes in cache
-  open_fds_->Insert(filedes, fh_);
   // finished
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   return written;
 }
 int KVFS::ChMod(const char *filename, mode_t mode) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_CHMOD);
   std::filesystem::path orig_ = std::filesystem::path(filename);
   CheckNameLength(orig_);
   if (orig_.lexically_normal() == "/") {
-    errorno_ = -EACCES;
+    CurrentSession()->errorno_ = -EACCES;
     throw FSError(FSErrorType::FS_EACCES, "Cannot change stats of root directory");
   }
   if (orig_.is_relative()) {
     // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+    orig_ = CurrentSession()->pwd_ / orig_;
   }
   if (orig_.is_absolute()) {
     // must start with single "/"
@@ -1656,42 +1754,34 @@ int KVFS::ChMod(const char *filename, mode_t mode) {
   kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
   std::string key_str = key.pack();
   std::string value_str;
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (!sr.isValid()) {
-    errorno_ = -ENONET;
+    CurrentSession()->errorno_ = -ENONET;
     throw FSError(FSErrorType::FS_ENOENT,
                   "A component of path does not name an existing file or path is an empty string.");
   }
   kvfsInodeValue md_;
   md_.parse(sr);
+  InodeLocks::Guard guard = locks_->Exclusive({md_.fstat_.st_ino});
+  Reload(key, &md_);
   md_.fstat_.st_uid = mode & S_ISUID;
   md_.fstat_.st_gid = mode & S_ISGID;
   md_.fstat_.st_mode |= mode;
   md_.fstat_.st_mtim.tv_sec = time_now;
   value_str = md_.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   bool status = store_->Merge(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
+  // descriptors open on it keep writing on top of this
+  open_inodes_->Update(key, md_);
+  EntryUpdated(key);
   return status;
 }
 int KVFS::Access(const char *filename, int how) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_ACCESS);
   std::filesystem::path orig_ = std::filesystem::path(filename);
   CheckNameLength(orig_);
   if (orig_.is_relative()) {
     // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+    orig_ = CurrentSession()->pwd_ / orig_;
   }
   if (orig_.is_absolute()) {
     // must start with single "/"
@@ -1714,35 +1804,36 @@ int KVFS::Access(const char *filename, int how) {
   // check for existing file
   kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
   std::string key_str = key.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (!sr.isValid()) {
-    errorno_ = -ENONET;
+    CurrentSession()->errorno_ = -ENONET;
     throw FSError(FSErrorType::FS_ENOENT,
                   "A component of path does not name an existing file or path is an empty string.");
   }
   kvfsInodeValue md_;
   md_.parse(sr);
-  if (!(md_.fstat_.st_mode & how)) {
-    errorno_ = -EACCES;
-    return errorno_;
+  // the owner, group or other bits apply, whichever class the caller is in, root passes
+  kvfsSession *session = CurrentSession();
+  mode_t allowed = md_.fstat_.st_mode;
+  if (session->uid_ == md_.fstat_.st_uid) {
+    allowed >>= 6;
+  } else if (session->gid_ == md_.fstat_.st_gid) {
+    allowed >>= 3;
+  }
+  if (session->uid_ != 0 && (allowed & how & (R_OK | W_OK | X_OK)) != (how & (R_OK | W_OK | X_OK))) {
+    CurrentSession()->errorno_ = -EACCES;
+    return CurrentSession()->errorno_;
   }
 
   return 0;
 }
 int KVFS::UTime(const char *filename, const struct utimbuf *times) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_UTIME);
   std::filesystem::path orig_ = std::filesystem::path(filename);
   CheckNameLength(orig_);
   if (orig_.is_relative()) {
     // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+    orig_ = CurrentSession()->pwd_ / orig_;
   }
   if (orig_.is_absolute()) {
     // must start with single "/"
@@ -1767,43 +1858,37 @@ int KVFS::UTime(const char *filename, const struct utimbuf *times) {
   kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
   std::string key_str = key.pack();
   std::string value_str;
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (!sr.isValid()) {
-    errorno_ = -ENONET;
+    CurrentSession()->errorno_ = -ENONET;
     throw FSError(FSErrorType::FS_ENOENT,
                   "A component of path does not name an existing file or path is an empty string.");
   }
   kvfsInodeValue md_;
   md_.parse(sr);
+  InodeLocks::Guard guard = locks_->Exclusive({md_.fstat_.st_ino});
+  Reload(key, &md_);
   md_.fstat_.st_mtim.tv_sec = times->modtime;
   md_.fstat_.st_atim.tv_sec = times->actime;
   value_str = md_.pack();
   // store
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
+  // times set explicitly replace any kept by lazytime
+  timestamps_->Forget(key);
   bool status = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
+  // descriptors open on it keep writing on top of this
+  open_inodes_->Update(key, md_);
+  EntryUpdated(key);
   return status;
 }
 int KVFS::Truncate(const char *filename, off_t length) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_TRUNCATE);
   // check if length is less than then change the last block key,
   // if length is bigger, then create linked list of blocks necessary
   std::filesystem::path orig_ = std::filesystem::path(filename);
   CheckNameLength(orig_);
   if (orig_.is_relative()) {
     // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+    orig_ = CurrentSession()->pwd_ / orig_;
   }
   if (orig_.is_absolute()) {
     // must start with single "/"
@@ -1826,20 +1911,16 @@ int KVFS::Truncate(const char *filename, off_t length) {
   kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
   std::string key_str = key.pack();
   std::string value_str;
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
   if (!sr.isValid()) {
-    errorno_ = -ENONET;
+    CurrentSession()->errorno_ = -ENONET;
     throw FSError(FSErrorType::FS_ENOENT,
                   "The filename arguments doesn't name an existing file or its an empty string");
   }
   kvfsInodeValue md_;
   md_.parse(sr);
+  InodeLocks::Guard guard = locks_->Exclusive({md_.fstat_.st_ino});
+  Reload(key, &md_);
   kvfs_off_t new_number_of_blocks = length / KVFS_DEF_BLOCK_SIZE;
   new_number_of_blocks += (length % KVFS_DEF_BLOCK_SIZE) ? 1 : 0;
   // compare to the file's number of blocks
@@ -1858,13 +1939,7 @@ int KVFS::Truncate(const char *filename, off_t length) {
     last_block_key.inode_ = md_.fstat_.st_ino;
     last_block_key.block_number_ = blck_offset;
     key_str = last_block_key.pack();
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
     sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
     if (!sr.isValid()) {
       // error getting file's last block
       return -1;
@@ -1896,23 +1971,19 @@ int KVFS::Truncate(const char *filename, off_t length) {
   // store the new metadata
   key_str = key.pack();
   value_str = md_.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
   bool status = store_->Merge(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
+  // descriptors open on it keep writing on top of this
+  open_inodes_->Update(key, md_);
+  EntryUpdated(key);
   return status;
 }
 int KVFS::Mknod(const char *filename, mode_t mode, dev_t dev) {
+  Stats::Timer timer(stats_.get(), KVFS_OP_MKNOD);
   std::filesystem::path orig_ = std::filesystem::path(filename);
   CheckNameLength(orig_);
   if (orig_.is_relative()) {
     // make it absolute
-    std::filesystem::path prv_ = pwd_;
-    orig_ = pwd_.append(orig_.string());
-    pwd_ = prv_;
+    orig_ = CurrentSession()->pwd_ / orig_;
   }
   if (orig_.is_absolute()) {
     // must start with single "/"
@@ -1936,48 +2007,47 @@ int KVFS::Mknod(const char *filename, mode_t mode, dev_t dev) {
   kvfsInodeKey key = {resolved.second.second.fstat_.st_ino, hash};
   std::string key_str = key.pack();
   std::string value_str;
-#if KVFS_THREAD_SAFE
-  // lock
-  mutex_->lock();
-#endif
-  if (store_->Get(key_str).isValid()) {
+  InodeLocks::Guard guard = locks_->Exclusive({resolved.second.second.fstat_.st_ino});
+  Reload(resolved.second.first, &resolved.second.second);
+  if (LookupEntry(key).isValid()) {
     // exists return error
-    errorno_ = -EEXIST;
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
+    CurrentSession()->errorno_ = -EEXIST;
+    throw FSError(FSErrorType::FS_EEXIST, "There is already a file named filename.");
   }
+  // the new node, its parent and the allocator state are committed as one write
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
   kvfsInodeValue md_ = kvfsInodeValue(orig_.filename(),
                                       GetFreeInode(),
                                       mode | resolved.second.second.fstat_.st_mode, key);
   md_.fstat_.st_dev = dev;
-  md_.fstat_.st_gid = mode;
-  md_.fstat_.st_uid = mode;
+  SetOwner(&md_);
   // update ctime
   md_.fstat_.st_ctim.tv_sec = time_now;
   // store
   value_str = md_.pack();
-#if KVFS_THREAD_SAFE
-  mutex_->lock();
-#endif
-  bool status = store_->Put(key_str, value_str);
-#if KVFS_THREAD_SAFE
-  mutex_->unlock();
-#endif
+  batch->Put(key_str, value_str);
   // update the parent
   ++resolved.second.second.fstat_.st_nlink;
   resolved.second.second.fstat_.st_mtim.tv_sec = time_now;
   key_str = resolved.second.first.pack();
   value_str = resolved.second.second.pack();
-  bool status2 = store_->Put(key_str, value_str);
-  return status;
+  batch->Put(key_str, value_str);
+  batch->Flush();
+  EntryCreated(key);
+  EntryUpdated(resolved.second.first);
+  return 0;
 }
 void KVFS::TuneFS() {
+  // compact after the removed trees are gone, rather than copy them once more
+  tree_reclaimer_->Wait();
   store_->Compact();
 
   store_->Sync();
 }
 void KVFS::DestroyFS() {
+  // the background workers use the store until they are stopped
+  tree_reclaimer_->Stop();
+  block_fetcher_.reset();
   if (!store_->Destroy()) {
     throw FSError(FSErrorType::FS_EIO, "Failed to destroy store");
   }
@@ -1985,25 +2055,58 @@ void KVFS::DestroyFS() {
   open_fds_.reset();
   std::filesystem::remove_all(root_path);
 }
-uint32_t KVFS::GetFreeFD() {
-  uint32_t fi;
-  if (!free_fds.empty()) {
-    fi = free_fds.back();
-    free_fds.pop_back();
-    return fi;
-  }
-  if (next_free_fd_ == KVFS_MAX_OPEN_FILES) {
+int KVFS::InsertOpenFile(kvfsFileHandle fh) {
+  std::shared_ptr<kvfsOpenInode> inode = fh.inode_;
+  int fd = open_fds_->Insert(std::move(fh));
+  if (fd < 0) {
+    // nothing was done through it, there is nothing to write back
+    if (open_inodes_->Release(inode)) {
+      open_inodes_->Forget(inode);
+    }
     // error too many open files
-    errorno_ = -ENFILE;
+    CurrentSession()->errorno_ = -ENFILE;
     throw FSError(FSErrorType::FS_ENFILE, "Too many files are currently open in the system.");
-  } else {
-    fi = next_free_fd_;
-    ++next_free_fd_;
-    return fi;
   }
+  return fd;
 }
 ssize_t KVFS::WriteBlocks(kvfsBlockKey blck_key_, size_t blcks_to_write_, const void *buffer, size_t buffer_size_) {
-  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+  size_t batch_blocks = options_.write_batch_bytes / KVFS_DEF_BLOCK_SIZE;
+  if (batch_blocks == 0 || blcks_to_write_ <= batch_blocks) {
+    std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+    ssize_t written = PackBlocks(batch.get(), blck_key_, blcks_to_write_, buffer, buffer_size_);
+    // flush the write batch
+    batch->Flush();
+    batch.reset();
+    return written;
+  }
+
+  // pack the next batch while the previous one is flushed, see kvfs_mount_options::write_batch_bytes
+  const auto *idx = static_cast<const byte *>(buffer);
+  ssize_t written = 0;
+  std::future<void> flushing;
+  while (blcks_to_write_ > 0) {
+    size_t blocks = std::min(blcks_to_write_, batch_blocks);
+    std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+    // the whole remaining size is passed so the last block of the batch links to the next one
+    ssize_t packed = PackBlocks(batch.get(), blck_key_, blocks, idx, buffer_size_);
+    if (flushing.valid()) {
+      flushing.get();
+    }
+    flushing = std::async(std::launch::async, [flushed = std::move(batch)]() { flushed->Flush(); });
+    written += packed;
+    idx += packed;
+    buffer_size_ -= packed;
+    blcks_to_write_ -= blocks;
+    blck_key_.block_number_ += blocks;
+  }
+  flushing.get();
+  return written;
+}
+ssize_t KVFS::PackBlocks(KVStore::WriteBatch *batch,
+                         kvfsBlockKey blck_key_,
+                         size_t blcks_to_write_,
+                         const void *buffer,
+                         size_t buffer_size_) {
   const void *idx = buffer;
   ssize_t written = 0;
   std::string key_str;
@@ -2029,9 +2132,6 @@ ssize_t KVFS::WriteBlocks(kvfsBlockKey blck_key_, size_t blcks_to_write_, const
     idx = pair.second;
     blck_key_ = bv_->next_block_;
   }
-  // flush the write batch
-  batch->Flush();
-  batch.reset();
   delete (bv_);
   return written;
 }
@@ -2052,19 +2152,17 @@ std::pair<ssize_t, const void *> KVFS::FillBlock(kvfsBlockValue *blck_,
     return std::pair<ssize_t, const void *>(max_writtable_size, idx);
   }
 }
-ssize_t KVFS::ReadBlocks(kvfsBlockKey blck_key_, size_t blcks_to_read_, size_t buffer_size_, void *buffer) {
+ssize_t KVFS::ReadBlocks(kvfsBlockKey blck_key_,
+                         size_t blcks_to_read_,
+                         size_t buffer_size_,
+                         void *buffer,
+                         const KVStore::Snapshot *snapshot) {
   void *idx = buffer;
   ssize_t read = 0;
   kvfsBlockValue bv_;
   std::string key_str = blck_key_.pack();
   for (size_t i = 0; i < blcks_to_read_; ++i) {
-#if KVFS_THREAD_SAFE
-    mutex_->lock();
-#endif
-    KVStoreResult sr = store_->Get(key_str);
-#if KVFS_THREAD_SAFE
-    mutex_->unlock();
-#endif
+    KVStoreResult sr = store_->Get(key_str, snapshot);
     if (sr.isValid()) {
       bv_.parse(sr);
 #ifdef KVFS_DEBUG
@@ -2084,7 +2182,7 @@ std::pair<ssize_t, void *> KVFS::ReadBlock(kvfsBlockValue *blck_, void *buffer,
   // if offset is between 0 and KVFSblocksize then start from there otherwise return with size 0 and buffer
   // calculate size to read, if size is smaller than kvfs blck size then read upto size = (kvfs blck size - offset)
   // else size = size
-  if (offset >= KVFS_DEF_BLOCK_SIZE) {
+  if (offset >= KVFS_DEF_BLOCK_SIZE || offset >= static_cast<off_t>(blck_->size_)) {
     return std::pair<ssize_t, void *>(0, buffer);
   }
   size_t max_readable_size = static_cast<size_t>(blck_->size_ - offset);
@@ -2110,7 +2208,7 @@ std::pair<std::filesystem::path,
     } else {
       ++symlink_loops;
       if (symlink_loops > KVFS_LINK_MAX) {
-        errorno_ = -ELOOP;
+        CurrentSession()->errorno_ = -ELOOP;
         throw FSError(FSErrorType::FS_ELOOP, "A loop exists in symbolic links encountered during resolution of "
                                              "the path");
       }
@@ -2118,14 +2216,463 @@ std::pair<std::filesystem::path,
     }
   }
 }
+std::pair<std::filesystem::path,
+          std::pair<kvfs::kvfsInodeKey, kvfs::kvfsInodeValue>> KVFS::ResolveAt(int dirfd,
+                                                                             const std::filesystem::path &input) {
+  // returns the real path of input together with the key and metadata of its parent directory
+  std::filesystem::path orig_ = input;
+  if (orig_.is_absolute() || dirfd == AT_FDCWD) {
+    if (orig_.is_relative()) {
+      // make it absolute
+      orig_ = CurrentSession()->pwd_ / orig_;
+    }
+    // must start with single "/"
+    if (orig_.root_path() != "/") {
+      throw FSError(FSErrorType::FS_EINVAL, "Given name is not in the correct format");
+    }
+    std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved =
+        RealPath(orig_.parent_path());
+    resolved.first.append(orig_.filename().string());
+    resolved.first = resolved.first.lexically_normal();
+    return resolved;
+  }
+  kvfsInodeKey dir_key;
+  mode_t dir_mode;
+  std::filesystem::path dir_path;
+  {
+    OpenFilesCache::Handle handle = open_fds_->Find(dirfd);
+    if (!handle) {
+      CurrentSession()->errorno_ = -EBADF;
+      throw FSError(FSErrorType::FS_EBADF, "The dirfd argument is not a valid file descriptor.");
+    }
+    // a rename of the directory moves its key
+    InodeLocks::Guard guard = locks_->Shared(handle->inode_->md_.fstat_.st_ino);
+    dir_key = handle->inode_->key_;
+    dir_mode = handle->inode_->md_.fstat_.st_mode;
+    dir_path = handle->path_;
+  }
+  if (!S_ISDIR(dir_mode)) {
+    CurrentSession()->errorno_ = -ENOTDIR;
+    throw FSError(FSErrorType::FS_ENOTDIR, "The dirfd argument is not associated with a directory.");
+  }
+  for (const std::filesystem::path &e : orig_) {
+    if (e == "..") {
+      // walking up needs the components above the directory, resolve it the long way.
+      // path_ has no symbolic links left in it, so ".." can be dropped lexically
+      return ResolveAt(AT_FDCWD, (dir_path / orig_).lexically_normal());
+    }
+  }
+  // the handle may be older than the last update to the directory, so reload it by its key,
+  // that is a single point lookup instead of a walk from the root
+  KVStoreResult sr = store_->Get(dir_key.pack());
+  if (!sr.isValid()) {
+    CurrentSession()->errorno_ = -ENOENT;
+    throw FSError(FSErrorType::FS_ENOENT, "The directory open as dirfd has been removed.");
+  }
+  kvfsInodeKey parent_key_ = dir_key;
+  kvfsInodeValue parent_md_;
+  parent_md_.parse(sr);
+  std::filesystem::path output = dir_path;
+  // only the remaining components are looked up, starting from the directory's inode
+  for (const std::filesystem::path &e : orig_.parent_path()) {
+    if (e == ".") {
+      continue;
+    }
+    CheckNameLength(e);
+    kvfsInodeKey key = {parent_md_.fstat_.st_ino, std::filesystem::hash_value(e)};
+    KVStoreResult esr = LookupEntry(key);
+    if (!esr.isValid()) {
+      CurrentSession()->errorno_ = -ENONET;
+      std::string msg = e.string() + " No such file or directory found under inode: #"
+          + std::to_string(parent_md_.fstat_.st_ino);
+      throw FSError(FSErrorType::FS_ENOENT, msg);
+    }
+    kvfsInodeValue md_;
+    md_.parse(esr);
+    if (S_ISLNK(md_.fstat_.st_mode)) {
+      // symbolic links are resolved by path
+      return ResolveAt(AT_FDCWD, dir_path / orig_);
+    }
+    if (!S_ISDIR(md_.fstat_.st_mode)) {
+      CurrentSession()->errorno_ = -ENOTDIR;
+      throw FSError(FSErrorType::FS_ENOTDIR, "A component of the path prefix is not a directory.");
+    }
+    parent_key_ = key;
+    parent_md_ = md_;
+    output.append(e.string());
+  }
+  output.append(orig_.filename().string());
+  return std::pair(output.lexically_normal(), std::pair(parent_key_, parent_md_));
+}
 int KVFS::UnMount() {
+  tree_reclaimer_->Stop();
+  WriteBackOpenInodes();
+  FlushTimestamps();
+  inode_allocator_->ReturnLeases();
+  inode_allocator_->UpdateSuperBlock(&super_block_);
   std::string value_str = super_block_.pack();
   store_->Put("superblock", value_str);
   store_->Sync();
   return 0;
 }
-void KVFS::FreeUpFD(uint32_t filedes) {
-  free_fds.push_back(filedes);
+KVStoreResult KVFS::LookupEntry(const kvfsInodeKey &key) {
+  kvfsInodeValue cached;
+  // a miss is only cached if nothing was created in the directory while the store was asked
+  uint64_t generation = 0;
+  DentryCache::FindResult found = dentry_cache_->Find(key, &cached, &generation);
+  if (found == DentryCache::kAbsent) {
+    // known miss, don't probe every level of the store for it
+    return KVStoreResult();
+  }
+  if (found == DentryCache::kPresent) {
+    timestamps_->Apply(key, &cached.fstat_);
+    return KVStoreResult(cached.pack());
+  }
+  KVStoreResult sr = store_->Get(key.pack());
+  if (sr.isValid() && !timestamps_->Empty()) {
+    // times kept by lazytime are newer than the stored ones
+    kvfsInodeValue md_;
+    md_.parse(sr);
+    if (timestamps_->Apply(key, &md_.fstat_)) {
+      return KVStoreResult(md_.pack());
+    }
+  }
+  if (!sr.isValid()) {
+    size_t misses = dentry_cache_->InsertNegative(key, generation);
+#if KVFS_DIRECTORY_FILTER
+    if (misses >= kDirectoryFilterThreshold) {
+      // this directory keeps missing, one scan of it is cheaper than the misses to come
+      BuildDirectoryFilter(key.inode_);
+    }
+#endif
+  }
+  return sr;
+}
+void KVFS::EntryCreated(const kvfsInodeKey &key) {
+  dentry_cache_->Created(key);
+}
+void KVFS::EntryRemoved(const kvfsInodeKey &key) {
+  dentry_cache_->Removed(key);
+  open_inodes_->Detach(key);
+}
+void KVFS::EntryUpdated(const kvfsInodeKey &key) {
+  dentry_cache_->Invalidate(key);
+}
+bool KVFS::ReadDirEntry(kvfsDIR *dirstream, kvfsInodeValue *md) {
+  // reads the entry under the stream's iterator in place, false once it has left the directory
+  KVStore::Iterator *it = dirstream->ptr_.get();
+  for (; it->Valid(); it->Next()) {
+    std::string_view key = it->key_view();
+    if (key.size() < sizeof(kvfs_file_inode_t)
+        || memcmp(key.data(), &dirstream->inode_, sizeof(kvfs_file_inode_t)) != 0) {
+      return false;
+    }
+    std::string_view value = it->value_view();
+    if (key.size() == sizeof(kvfsInodeKey) && value.size() == sizeof(kvfsInodeValue)) {
+      memcpy(static_cast<void *>(md), value.data(), sizeof(kvfsInodeValue));
+      return true;
+    }
+  }
+  return false;
+}
+void KVFS::BuildDirectoryFilter(kvfs_file_inode_t dir) {
+  // the scan holds no lock, an entry created while it runs may be missing from it
+  uint64_t generation = dentry_cache_->NegativeGeneration(dir);
+  std::vector<kvfs_file_hash_t> hashes;
+  kvfsInodeKey seek_key = {dir, 0};
+  std::string prefix = seek_key.pack().substr(0, sizeof(kvfs_file_inode_t));
+  std::unique_ptr<KVStore::Iterator> it = store_->GetIterator();
+  for (it->Seek(seek_key.pack()); it->Valid(); it->Next()) {
+    std::string key_str = it->key();
+    if (key_str.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+    if (key_str.size() == sizeof(kvfsInodeKey)) {
+      kvfsInodeKey key;
+      key.parse(key_str);
+      hashes.push_back(key.hash_);
+    }
+  }
+  dentry_cache_->TrackDirectory(dir, hashes, generation);
+}
+void KVFS::Reload(const kvfsInodeKey &key, kvfsInodeValue *md) {
+  // md was resolved before its lock was taken and another thread may have changed it since,
+  // with locking disabled there is no other thread and the read is skipped
+  if (locks_->Enabled()) {
+    KVStoreResult sr = store_->Get(key.pack());
+    if (!sr.isValid()) {
+      CurrentSession()->errorno_ = -ENOENT;
+      throw FSError(FSErrorType::FS_ENOENT, "An entry of the path was removed by another thread.");
+    }
+    md->parse(sr);
+  }
+  // an open file can be ahead of the store until its last descriptor is closed
+  open_inodes_->Overlay(key, md);
+}
+void KVFS::WriteBackInode(kvfsOpenInode *inode) {
+  // the caller holds the inode's lock
+  bool lazy = !inode->dirty_ && options_.time_policy == KVFS_TIME_LAZYTIME;
+  if (inode->dirty_ || (inode->times_dirty_ && !lazy)) {
+    store_->Merge(inode->key_.pack(), inode->md_.pack());
+    EntryUpdated(inode->key_);
+    inode->unsynced_ = true;
+  } else if (inode->times_dirty_) {
+    timestamps_->Record(inode->key_, inode->md_.fstat_);
+  }
+  inode->dirty_ = false;
+  inode->times_dirty_ = false;
+}
+void KVFS::SyncInode(kvfsOpenInode *inode, InodeLocks::Guard *guard, bool metadata) {
+  // the caller holds the inode's lock, fdatasync writes the inode back only when the size changed
+  bool write_back = metadata ? inode->dirty_ || inode->times_dirty_
+                             : inode->md_.fstat_.st_size != inode->synced_size_;
+  if (write_back) {
+    // the times are written even under lazytime, they are what a sync is asked for
+    store_->Merge(inode->key_.pack(), inode->md_.pack());
+    EntryUpdated(inode->key_);
+    inode->dirty_ = false;
+    inode->times_dirty_ = false;
+    inode->unsynced_ = true;
+  }
+  if (!inode->unsynced_) {
+    return;
+  }
+  inode->unsynced_ = false;
+  inode->synced_size_ = inode->md_.fstat_.st_size;
+  // other writers of the file go on while this one waits for its sync, writes after this point
+  // mark the inode unsynced again
+  kvfs_file_inode_t ino = inode->md_.fstat_.st_ino;
+  guard->Unlock();
+  if (!group_commit_->Sync()) {
+    InodeLocks::Guard relock = locks_->Exclusive({ino});
+    inode->unsynced_ = true;
+    CurrentSession()->errorno_ = -EIO;
+    throw FSError(FSErrorType::FS_EIO, "Failed to sync the file to the store");
+  }
+}
+void KVFS::WriteBackOpenInodes() {
+  for (const std::shared_ptr<kvfsOpenInode> &inode : open_inodes_->Snapshot()) {
+    InodeLocks::Guard guard = locks_->Exclusive({inode->md_.fstat_.st_ino});
+    if (open_inodes_->Attached(inode)) {
+      WriteBackInode(inode.get());
+    }
+  }
+}
+void KVFS::TouchAtime(kvfsFileHandle *fh) {
+  if ((fh->flags_ & O_NOATIME) || options_.time_policy == KVFS_TIME_NOATIME) {
+    return;
+  }
+  kvfsOpenInode *inode = fh->inode_.get();
+  std::lock_guard<std::mutex> lock(inode->times_mutex_);
+  kvfs_stat &st = inode->md_.fstat_;
+  time_t now = time_now;
+  if (options_.time_policy != KVFS_TIME_STRICT) {
+    // relatime: only the first read after a change, and then once a day
+    const time_t kRelatimeInterval = 24 * 60 * 60;
+    if (st.st_atim.tv_sec > st.st_mtim.tv_sec && st.st_atim.tv_sec > st.st_ctim.tv_sec
+        && now - st.st_atim.tv_sec < kRelatimeInterval) {
+      return;
+    }
+  }
+  if (st.st_atim.tv_sec != now) {
+    st.st_atim.tv_sec = now;
+    inode->times_dirty_ = true;
+  }
+}
+void KVFS::FlushTimestamps() {
+  if (timestamps_->Empty()) {
+    return;
+  }
+  // the kept times go on top of the current entries, an entry that is gone by now is skipped.
+  // No other thread may change them in between, and there are more than one guard can name
+  InodeLocks::Guard guard = locks_->ExclusiveAll();
+  TimestampCache::TimesMap taken = timestamps_->Take();
+  std::vector<kvfsInodeKey> keys;
+  std::vector<std::string> key_strs;
+  for (const auto &entry : taken) {
+    keys.push_back(entry.first);
+    key_strs.push_back(entry.first.pack());
+  }
+  std::vector<KVStoreResult> results = store_->MultiGet(key_strs);
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (!results[i].isValid()) {
+      continue;
+    }
+    kvfsInodeValue md_;
+    md_.parse(results[i]);
+    TimestampCache::ApplyTimes(taken[keys[i]], &md_.fstat_);
+    batch->Put(key_strs[i], md_.pack());
+  }
+  batch->Flush();
+  for (const kvfsInodeKey &key : keys) {
+    EntryUpdated(key);
+  }
+}
+void KVFS::ResolveMany(const char *const *paths, size_t count, std::vector<kvfsInodeValue> *mds, int *errors) {
+  // one node per distinct entry key, so a directory shared by many paths is looked up once,
+  // and each round looks up the next component of every path that is still being resolved
+  struct Node {
+    kvfsInodeKey key_;
+    kvfsInodeValue md_;
+    int error_;
+  };
+  std::vector<Node> nodes;
+  std::unordered_map<kvfsInodeKey, size_t, InodeCacheHash, InodeCacheComparator> index;
+  std::vector<std::vector<std::string>> components(count);
+  // the paths of a batch mostly share their directories, each name is hashed once
+  std::unordered_map<std::string, kvfs_file_hash_t> hashes;
+  // node of the last resolved component of each path
+  std::vector<size_t> at(count, 0);
+  std::vector<size_t> fallback;
+  mds->assign(count, kvfsInodeValue());
+
+  // the same normalization as lexically_normal(), without building a path per component
+  std::string pwd;
+  for (size_t i = 0; i < count; ++i) {
+    errors[i] = 0;
+    std::string_view path(paths[i]);
+    std::vector<std::string> &names = components[i];
+    auto split = [&names](std::string_view from) {
+      while (!from.empty()) {
+        size_t end = std::min(from.find('/'), from.size());
+        std::string_view name = from.substr(0, end);
+        from.remove_prefix(std::min(end + 1, from.size()));
+        if (name.empty() || name == ".") {
+          continue;
+        }
+        if (name == "..") {
+          if (!names.empty()) {
+            names.pop_back();
+          }
+          continue;
+        }
+        names.emplace_back(name);
+      }
+    };
+    if (path.empty() || path.front() != '/') {
+      if (pwd.empty()) {
+        pwd = CurrentSession()->pwd_.string();
+      }
+      if (pwd.empty() || pwd.front() != '/') {
+        errors[i] = -EINVAL;
+        continue;
+      }
+      split(pwd);
+    }
+    split(path);
+    for (const std::string &name : names) {
+      if (name.length() > NAME_MAX) {
+        errors[i] = -ENAMETOOLONG;
+        break;
+      }
+    }
+  }
+
+  kvfsInodeKey root_key = {0, std::filesystem::hash_value(std::filesystem::path("/"))};
+  nodes.push_back({root_key, kvfsInodeValue(), 0});
+  std::vector<size_t> level = {0};
+  std::vector<kvfsInodeKey> level_keys;
+  std::vector<DentryCache::FindResult> found;
+  std::vector<kvfsInodeValue> cached;
+  std::vector<uint64_t> generations;
+  for (size_t depth = 0; !level.empty(); ++depth) {
+    // the cached entries are taken from the dentry cache, the rest of the level is one multi-get
+    level_keys.clear();
+    for (size_t n : level) {
+      level_keys.push_back(nodes[n].key_);
+    }
+    dentry_cache_->FindMany(level_keys, &found, &cached, &generations);
+    std::vector<std::string> keys;
+    std::vector<size_t> fetched;
+    std::vector<uint64_t> positive_generations;
+    for (size_t j = 0; j < level.size(); ++j) {
+      Node &node = nodes[level[j]];
+      if (found[j] == DentryCache::kAbsent) {
+        node.error_ = -ENOENT;
+      } else if (found[j] == DentryCache::kPresent) {
+        node.md_ = cached[j];
+      } else {
+        keys.push_back(node.key_.pack());
+        fetched.push_back(j);
+        positive_generations.push_back(dentry_cache_->PositiveGeneration(node.key_.inode_));
+      }
+    }
+    if (!keys.empty()) {
+      std::vector<KVStoreResult> results = store_->MultiGet(keys);
+      for (size_t j = 0; j < results.size(); ++j) {
+        Node &node = nodes[level[fetched[j]]];
+        if (results[j].isValid()) {
+          node.md_.parse(results[j]);
+          if (S_ISDIR(node.md_.fstat_.st_mode)) {
+            // the next batch most likely passes through the same directories
+            dentry_cache_->InsertPositive(node.key_, node.md_, positive_generations[j]);
+          }
+        } else {
+          node.error_ = -ENOENT;
+          dentry_cache_->InsertNegative(node.key_, generations[fetched[j]]);
+        }
+      }
+    }
+
+    level.clear();
+    for (size_t i = 0; i < count; ++i) {
+      if (errors[i] != 0 || components[i].size() < depth) {
+        continue;
+      }
+      const Node &parent = nodes[at[i]];
+      if (parent.error_ != 0) {
+        errors[i] = parent.error_;
+        continue;
+      }
+      if (components[i].size() == depth) {
+        // resolved, it is not looked at again
+        (*mds)[i] = parent.md_;
+        timestamps_->Apply(parent.key_, &(*mds)[i].fstat_);
+        continue;
+      }
+      if (S_ISLNK(parent.md_.fstat_.st_mode)) {
+        // a symbolic link in the middle of the path, resolved on its own below
+        fallback.push_back(i);
+        errors[i] = 1;
+        continue;
+      }
+      if (!S_ISDIR(parent.md_.fstat_.st_mode)) {
+        errors[i] = -ENOTDIR;
+        continue;
+      }
+      const std::string &name = components[i][depth];
+      auto hash = hashes.find(name);
+      if (hash == hashes.end()) {
+        hash = hashes.emplace(name, std::filesystem::hash_value(std::filesystem::path(name))).first;
+      }
+      kvfsInodeKey key = {parent.md_.fstat_.st_ino, hash->second};
+      auto inserted = index.emplace(key, nodes.size());
+      if (inserted.second) {
+        nodes.push_back({key, kvfsInodeValue(), 0});
+        level.push_back(nodes.size() - 1);
+      }
+      at[i] = inserted.first->second;
+    }
+  }
+
+  for (size_t i : fallback) {
+    try {
+      std::pair<std::filesystem::path, std::pair<kvfsInodeKey, kvfsInodeValue>> resolved =
+          ResolveAt(AT_FDCWD, paths[i]);
+      kvfsInodeKey key = {resolved.second.second.fstat_.st_ino,
+                          std::filesystem::hash_value(resolved.first.filename())};
+      KVStoreResult sr = LookupEntry(key);
+      if (!sr.isValid()) {
+        errors[i] = -ENOENT;
+        continue;
+      }
+      (*mds)[i].parse(sr);
+      errors[i] = 0;
+    } catch (FSError &) {
+      errors[i] = CurrentSession()->errorno_ ? CurrentSession()->errorno_ : -ENOENT;
+    }
+  }
 }
 
 }  // namespace kvfs
\ No newline at end of file
@@ -10,6 +10,10 @@
 #ifndef KVFS_KVFS_DIRENT_H
 #define KVFS_KVFS_DIRENT_H
 
+#include <functional>
+#include <ctime>
+#include <cstdint>
+
 typedef size_t kvfs_file_hash_t;
 typedef unsigned char byte;
 #ifdef __USE_LARGEFILE64
@@ -24,6 +28,163 @@ typedef struct stat kvfs_stat;
 typedef off_t kvfs_off_t;
 #endif
 
+/**
+ * A directory entry with the attributes of the file it names, filled in by ReadDirPlus.
+ */
+struct kvfs_dirent_plus {
+  kvfs_dirent d_entry;
+  kvfs_stat d_stat;
+};
+
+/**
+ * A file to be created by CreateFilesBatch.
+ */
+struct kvfs_create_entry {
+  // a single path component, the file is created in the directory given to CreateFilesBatch
+  const char *name;
+  mode_t mode;
+  // initial contents, nullptr for an empty file
+  const void *data;
+  size_t size;
+};
+
+/**
+ * An entry passed to the WalkTree visitor. name and stat point into the walker's buffers and
+ * are only valid during the call.
+ */
+struct kvfs_walk_entry {
+  // st_ino of the directory holding the entry
+  kvfs_file_inode_t parent;
+  const char *name;
+  const kvfs_stat *stat;
+  // 0 for the root of the walk
+  int depth;
+};
+
+/**
+ * Return values of the WalkTree visitor.
+ */
+enum kvfs_walk_action : int {
+  KVFS_WALK_CONTINUE = 0,
+  // don't descend into the directory just visited
+  KVFS_WALK_SKIP_SUBTREE = 1,
+  // end the walk, WalkTree returns once the calls already running are done
+  KVFS_WALK_STOP = 2
+};
+
+struct kvfs_walk_options {
+  // number of threads to walk with, 0 for one per core
+  unsigned threads = 0;
+  // deepest level to visit, the root is 0, negative for no limit
+  int max_depth = -1;
+};
+
+typedef std::function<int(const kvfs_walk_entry &entry)> kvfs_walk_visitor;
+
+/**
+ * When the access and modification times of files are written to the store.
+ */
+enum kvfs_time_policy {
+  // every read updates st_atim and the file is written back when it is closed
+  KVFS_TIME_STRICT = 0,
+  // reads never update st_atim
+  KVFS_TIME_NOATIME = 1,
+  // a read updates st_atim only if it is not later than st_mtim or st_ctim, or older than a day
+  KVFS_TIME_RELATIME = 2,
+  // as relatime, but a file whose times are all that changed is not written back when it is closed,
+  // its times are kept in memory and written in batches, see kvfs_mount_options
+  KVFS_TIME_LAZYTIME = 3
+};
+
+struct kvfs_mount_options {
+  kvfs_time_policy time_policy = KVFS_TIME_RELATIME;
+  // lazytime writes the kept times once the oldest of them is this many seconds old,
+  // or once this many files have kept times, and at every sync
+  time_t lazytime_flush_seconds = 60;
+  size_t lazytime_flush_entries = 4096;
+  // a write of more than this many bytes is committed as a pipeline of batches of this size, each packed
+  // while the one before it is written, so at most two are held in memory and each is atomic only on its own;
+  // 0 commits every write as a single batch
+  size_t write_batch_bytes = 4 << 20;
+  // fsyncs and O_SYNC writes share one sync of the store with those that arrive while it runs, or within
+  // this many microseconds of the first of them; 0 syncs at once
+  unsigned sync_window_usec = 0;
+};
+
+/**
+ * Calls made to the store since the file system was mounted.
+ */
+struct kvfs_store_calls {
+  // keys looked up by Get and MultiGet
+  uint64_t gets = 0;
+  // iterator seeks, GetChildren and GetParent included
+  uint64_t seeks = 0;
+  // iterator steps
+  uint64_t nexts = 0;
+  // keys put or merged, alone or in a write batch
+  uint64_t puts = 0;
+  // keys and ranges deleted, alone or in a write batch
+  uint64_t deletes = 0;
+  // writes to the store, a write batch is one
+  uint64_t writes = 0;
+  uint64_t syncs = 0;
+};
+
+/**
+ * Operations of the requests submitted to an AsyncQueue.
+ */
+enum kvfs_io_opcode : int {
+  // PRead of size bytes at offset into buffer, Read at the file offset when offset is -1
+  KVFS_IO_READ = 0,
+  // PWrite of size bytes at offset from buffer, Write at the file offset when offset is -1
+  KVFS_IO_WRITE = 1,
+  // Open of path with flags and mode, the result is the new descriptor
+  KVFS_IO_OPEN = 2,
+  KVFS_IO_CLOSE = 3,
+  // Stat of path into stat
+  KVFS_IO_STAT = 4,
+  KVFS_IO_FSYNC = 5,
+  KVFS_IO_FDATASYNC = 6
+};
+
+/**
+ * A request submitted to an AsyncQueue. buffer and stat must stay valid until its completion is
+ * reaped, path is copied by Submit.
+ */
+struct kvfs_io_request {
+  kvfs_io_opcode opcode = KVFS_IO_READ;
+  int fd = -1;
+  const char *path = nullptr;
+  int flags = 0;
+  mode_t mode = 0;
+  void *buffer = nullptr;
+  size_t size = 0;
+  off_t offset = 0;
+  kvfs_stat *stat = nullptr;
+  // returned with the completion, not used otherwise
+  uint64_t user_data = 0;
+};
+
+/**
+ * The completion of a kvfs_io_request: what the synchronous call would have returned, the number
+ * of bytes for reads and writes, the descriptor for opens and 0 otherwise, or -errno if it failed.
+ */
+struct kvfs_io_completion {
+  uint64_t user_data;
+  ssize_t result;
+};
+
+typedef void (*kvfs_io_callback)(const kvfs_io_completion &completion);
+
+struct kvfs_async_options {
+  // number of worker threads, 0 for one per core
+  unsigned threads = 0;
+  // requests that may be submitted and not yet reaped at once
+  unsigned entries = 256;
+  // if set, called on the worker with each completion instead of queueing it for Poll and Wait
+  kvfs_io_callback on_complete = nullptr;
+};
+
 struct __kvfs_dir_stream;
 
 /**
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   latency_histogram.h
+ */
+
+#ifndef KVFS_LATENCY_HISTOGRAM_H
+#define KVFS_LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace kvfs {
+
+/**
+ * Latencies in nanoseconds in log-linear buckets, as HDR histograms keep them: every power of two is
+ * split into kSubBuckets buckets, so a percentile is off by less than 2% of its value.
+ * A histogram is filled by one thread, those of several threads are added together afterwards.
+ */
+class LatencyHistogram {
+ public:
+  static const int kSubBucketBits = 5;
+  static const uint64_t kSubBuckets = 1u << kSubBucketBits;
+  static const size_t kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyHistogram() : count_(0), sum_(0), min_(UINT64_MAX), max_(0) {}
+
+  void Record(uint64_t nanos) {
+    // the buckets are only allocated once there is something to keep
+    if (counts_.empty()) {
+      counts_.resize(kBuckets, 0);
+    }
+    ++counts_[Index(nanos)];
+    ++count_;
+    sum_ += nanos;
+    min_ = std::min(min_, nanos);
+    max_ = std::max(max_, nanos);
+  }
+
+  void Add(const LatencyHistogram &other) {
+    if (other.count_ == 0) {
+      return;
+    }
+    Add(other.counts_.data(), other.sum_);
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  /**
+   * Add kBuckets counts kept elsewhere, whose latencies sum to sum. Only their buckets are known, so the
+   * minimum and maximum become the bounds of the lowest and highest bucket counted in.
+   */
+  void Add(const uint64_t *counts, uint64_t sum) {
+    for (size_t i = 0; i < kBuckets; ++i) {
+      if (counts[i] == 0) {
+        continue;
+      }
+      if (counts_.empty()) {
+        counts_.resize(kBuckets, 0);
+      }
+      counts_[i] += counts[i];
+      count_ += counts[i];
+      min_ = std::min(min_, Lower(i));
+      max_ = std::max(max_, Lower(i + 1) - 1);
+    }
+    sum_ += sum;
+  }
+
+  uint64_t Count() const {
+    return count_;
+  }
+
+  uint64_t Sum() const {
+    return sum_;
+  }
+
+  /**
+   * Latency below which fraction of the recorded ones are, the middle of its bucket.
+   */
+  uint64_t Percentile(double fraction) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(fraction * count_ + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        uint64_t middle = Lower(i) + (Lower(i + 1) - Lower(i)) / 2;
+        return std::min(std::max(middle, min_), max_);
+      }
+    }
+    return max_;
+  }
+
+  /**
+   * {"count": .., "min": .., "mean": .., "p50": .., "p90": .., "p99": .., "p99.9": .., "max": ..} in microseconds.
+   */
+  void WriteJson(std::ostream &out) const {
+    out << "{\"count\": " << count_
+        << ", \"min\": " << Micros(count_ ? min_ : 0)
+        << ", \"mean\": " << (count_ ? static_cast<double>(sum_) / count_ / 1000.0 : 0.0)
+        << ", \"p50\": " << Micros(Percentile(0.5))
+        << ", \"p90\": " << Micros(Percentile(0.9))
+        << ", \"p99\": " << Micros(Percentile(0.99))
+        << ", \"p99.9\": " << Micros(Percentile(0.999))
+        << ", \"max\": " << Micros(max_) << "}";
+  }
+
+  static size_t Index(uint64_t value) {
+    if (value < kSubBuckets) {
+      return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+  }
+
+  // smallest value of a bucket
+  static uint64_t Lower(size_t index) {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    size_t shift = index / kSubBuckets - 1;
+    return (index % kSubBuckets + kSubBuckets) << shift;
+  }
+
+ private:
+  std::vector<uint64_t> counts_;
+  uint64_t count_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+
+  static double Micros(uint64_t nanos) {
+    return nanos / 1000.0;
+  }
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_LATENCY_HISTOGRAM_H
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   session.cpp
+ */
+
+#include <kvfs/session.h>
+#include <atomic>
+#include <unordered_map>
+#include <unistd.h>
+
+namespace kvfs {
+
+namespace {
+std::atomic<uint64_t> next_table_id{1};
+
+// sessions of the calling thread by table, and the last one looked up
+thread_local std::unordered_map<uint64_t, std::shared_ptr<kvfsSession>> thread_sessions;
+thread_local uint64_t last_table = 0;
+thread_local kvfsSession *last_session = nullptr;
+}  // namespace
+
+kvfsSession::kvfsSession() : uid_(getuid()), gid_(getgid()) {}
+
+kvfsSession::kvfsSession(uid_t uid, gid_t gid) : uid_(uid), gid_(gid) {}
+
+SessionTable::SessionTable() : id_(next_table_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+std::shared_ptr<kvfsSession> &SessionTable::Slot() {
+  std::shared_ptr<kvfsSession> &slot = thread_sessions[id_];
+  if (!slot) {
+    slot = std::make_shared<kvfsSession>();
+  }
+  last_table = id_;
+  last_session = slot.get();
+  return slot;
+}
+
+kvfsSession *SessionTable::Current() {
+  if (last_table == id_) {
+    return last_session;
+  }
+  return Slot().get();
+}
+
+std::shared_ptr<kvfsSession> SessionTable::CurrentShared() {
+  return Slot();
+}
+
+void SessionTable::Attach(std::shared_ptr<kvfsSession> session) {
+  thread_sessions[id_] = std::move(session);
+  Slot();
+}
+
+SessionTable::~SessionTable() {
+  // other threads drop theirs when they exit
+  thread_sessions.erase(id_);
+  if (last_table == id_) {
+    last_table = 0;
+    last_session = nullptr;
+  }
+}
+
+}  // namespace kvfs
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   session.h
+ */
+
+#ifndef KVFS_SESSION_H
+#define KVFS_SESSION_H
+
+#include <kvfs_store/kvfs_store_entry.h>
+#include <filesystem>
+#include <memory>
+#include <sys/types.h>
+
+namespace kvfs {
+
+/**
+ * What a process keeps per caller: the working directory, the credentials new entries are owned by and
+ * checked against, and the error of the last failed call.
+ * A session is used by one thread at a time, different threads may use different sessions of one mount.
+ */
+struct kvfsSession {
+  std::filesystem::path pwd_{"/"};
+  std::filesystem::path cwd_name_{};
+  kvfsInodeKey cwd_key_{};
+  kvfsInodeValue cwd_md_{};
+  uid_t uid_;
+  gid_t gid_;
+  int errorno_{0};
+
+  // at "/" with the credentials of the process
+  kvfsSession();
+  kvfsSession(uid_t uid, gid_t gid);
+};
+
+/**
+ * The sessions of the threads using one mount.
+ *
+ * A thread gets a session of its own the first time it calls into the mount, unless it attached one.
+ * They are kept thread local, so finding the current one takes no lock, and go away with their thread.
+ */
+class SessionTable {
+ public:
+  SessionTable();
+
+  /**
+   * @return the session of the calling thread.
+   */
+  kvfsSession *Current();
+
+  /**
+   * @return the session of the calling thread, shared with the caller.
+   */
+  std::shared_ptr<kvfsSession> CurrentShared();
+
+  /**
+   * Make the calling thread use the given session, nullptr gives it a new one of its own.
+   */
+  void Attach(std::shared_ptr<kvfsSession> session);
+
+  ~SessionTable();
+
+ private:
+  // never reused, a session a thread still keeps for a table that is gone can't be taken for a new one
+  uint64_t id_;
+
+  std::shared_ptr<kvfsSession> &Slot();
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_SESSION_H
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   stats.cpp
+ */
+
+#include <kvfs/stats.h>
+#include <vector>
+
+static const char *const kOpNames[KVFS_OP_COUNT] = {
+    "chdir", "opendir", "readdir", "readdir_batch", "readdir_plus", "telldir", "seekdir", "closedir",
+    "link", "symlink", "readlink", "unlink", "remove_tree", "walk_tree", "rename", "mkdir",
+    "create_files_batch", "stat", "stat_many", "read_files_many", "chmod", "access", "utime", "truncate",
+    "mknod", "open", "close", "read", "write", "lseek", "sync", "fsync", "fdatasync", "pread", "pwrite",
+    "store_get", "store_multiget", "store_put", "store_merge", "store_delete", "store_delete_range",
+    "store_get_children", "store_get_parent", "store_write_batch", "store_seek", "store_next",
+    "store_snapshot", "store_sync", "store_compact"};
+
+static const char *const kCounterNames[KVFS_COUNTER_COUNT] = {
+    "fs_bytes_read", "fs_bytes_written", "store_bytes_read", "store_bytes_written", "store_keys_read",
+    "store_keys_written", "store_keys_deleted"};
+
+const char *kvfs_stats_op_name(kvfs_stats_op op) {
+  return kOpNames[op];
+}
+
+const char *kvfs_stats_counter_name(kvfs_stats_counter counter) {
+  return kCounterNames[counter];
+}
+
+double kvfs_stats::ReadAmplification() const {
+  uint64_t read = counters[KVFS_COUNTER_FS_BYTES_READ];
+  return read ? static_cast<double>(counters[KVFS_COUNTER_STORE_BYTES_READ]) / read : 0;
+}
+
+double kvfs_stats::WriteAmplification() const {
+  uint64_t written = counters[KVFS_COUNTER_FS_BYTES_WRITTEN];
+  return written ? static_cast<double>(counters[KVFS_COUNTER_STORE_BYTES_WRITTEN]) / written : 0;
+}
+
+void kvfs_stats::Write(std::ostream &out, kvfs_stats_format format) const {
+  if (format == KVFS_STATS_JSON) {
+    out << "{\"seconds\": " << seconds << ", \"read_amplification\": " << ReadAmplification()
+        << ", \"write_amplification\": " << WriteAmplification() << ",\n \"counters\": {";
+    for (int c = 0; c < KVFS_COUNTER_COUNT; ++c) {
+      out << (c ? ", " : "") << "\"" << kCounterNames[c] << "\": " << counters[c];
+    }
+    out << "},\n \"ops\": {";
+    bool first = true;
+    for (int op = 0; op < KVFS_OP_COUNT; ++op) {
+      if (ops[op].calls == 0) {
+        continue;
+      }
+      out << (first ? "\n" : ",\n") << "  \"" << kOpNames[op] << "\": {\"calls\": " << ops[op].calls
+          << ", \"errors\": " << ops[op].errors << ", \"lat_us\": ";
+      ops[op].latency.WriteJson(out);
+      out << "}";
+      first = false;
+    }
+    out << "}}\n";
+    return;
+  }
+
+  out << "# HELP kvfs_op_latency_seconds Latency of the calls of each operation over the interval.\n"
+      << "# TYPE kvfs_op_latency_seconds summary\n";
+  for (int op = 0; op < KVFS_OP_COUNT; ++op) {
+    const kvfs::LatencyHistogram &latency = ops[op].latency;
+    if (ops[op].calls == 0) {
+      continue;
+    }
+    // none of a few calls may have been sampled
+    if (latency.Count() != 0) {
+      for (double quantile : {0.5, 0.9, 0.99, 0.999}) {
+        out << "kvfs_op_latency_seconds{op=\"" << kOpNames[op] << "\",quantile=\"" << quantile << "\"} "
+            << latency.Percentile(quantile) / 1e9 << "\n";
+      }
+    }
+    // the sum of the sampled calls scaled up to all of them
+    double sum = latency.Count() ? static_cast<double>(latency.Sum()) / latency.Count() * ops[op].calls : 0;
+    out << "kvfs_op_latency_seconds_sum{op=\"" << kOpNames[op] << "\"} " << sum / 1e9 << "\n"
+        << "kvfs_op_latency_seconds_count{op=\"" << kOpNames[op] << "\"} " << ops[op].calls << "\n";
+  }
+  out << "# HELP kvfs_op_errors Calls of each operation that failed over the interval.\n"
+      << "# TYPE kvfs_op_errors gauge\n";
+  for (int op = 0; op < KVFS_OP_COUNT; ++op) {
+    if (ops[op].calls != 0) {
+      out << "kvfs_op_errors{op=\"" << kOpNames[op] << "\"} " << ops[op].errors << "\n";
+    }
+  }
+  for (int c = 0; c < KVFS_COUNTER_COUNT; ++c) {
+    out << "# TYPE kvfs_" << kCounterNames[c] << " gauge\n"
+        << "kvfs_" << kCounterNames[c] << " " << counters[c] << "\n";
+  }
+  out << "# TYPE kvfs_read_amplification gauge\n"
+      << "kvfs_read_amplification " << ReadAmplification() << "\n"
+      << "# TYPE kvfs_write_amplification gauge\n"
+      << "kvfs_write_amplification " << WriteAmplification() << "\n";
+}
+
+namespace kvfs {
+
+static std::atomic<uint64_t> next_stats_id{1};
+
+Stats::Stats() : id_(next_stats_id.fetch_add(1)), previous_time_(std::chrono::steady_clock::now()) {}
+
+Stats::~Stats() {
+  for (auto &shard : shards_) {
+    for (auto &histogram : shard.second->latencies) {
+      delete histogram.load();
+    }
+  }
+}
+
+Stats::Shard *Stats::FindShard() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<Shard> &shard = shards_[std::this_thread::get_id()];
+  if (!shard) {
+    shard = std::make_unique<Shard>();
+    // xorshift never leaves 0
+    shard->random = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+  }
+  return shard.get();
+}
+
+Stats::Histogram *Stats::NewHistogram(Shard *shard, kvfs_stats_op op) {
+  auto *histogram = new Histogram();
+  // Sum may be reading the shard, it must find the histogram filled with zeros
+  shard->latencies[op].store(histogram, std::memory_order_release);
+  return histogram;
+}
+
+void Stats::Sum(Sums *sums) {
+  for (auto &shard : shards_) {
+    for (int op = 0; op < KVFS_OP_COUNT; ++op) {
+      sums->calls[op] += shard.second->calls[op].load(std::memory_order_relaxed);
+      sums->errors[op] += shard.second->errors[op].load(std::memory_order_relaxed);
+      Histogram *histogram = shard.second->latencies[op].load(std::memory_order_acquire);
+      if (histogram == nullptr) {
+        continue;
+      }
+      if (!sums->buckets[op]) {
+        sums->buckets[op] = std::make_unique<uint64_t[]>(LatencyHistogram::kBuckets);
+      }
+      for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i) {
+        sums->buckets[op][i] += histogram->buckets[i].load(std::memory_order_relaxed);
+      }
+      sums->sums[op] += histogram->sum.load(std::memory_order_relaxed);
+    }
+    for (int c = 0; c < KVFS_COUNTER_COUNT; ++c) {
+      sums->counters[c] += shard.second->counters[c].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+kvfs_stats Stats::Snapshot() {
+  kvfs_stats stats;
+  std::lock_guard<std::mutex> lock(mutex_);
+  Sums now;
+  Sum(&now);
+  auto time = std::chrono::steady_clock::now();
+  stats.seconds = std::chrono::duration<double>(time - previous_time_).count();
+  previous_time_ = time;
+  std::vector<uint64_t> buckets(LatencyHistogram::kBuckets);
+  for (int op = 0; op < KVFS_OP_COUNT; ++op) {
+    stats.ops[op].calls = now.calls[op] - previous_.calls[op];
+    stats.ops[op].errors = now.errors[op] - previous_.errors[op];
+    if (!now.buckets[op]) {
+      continue;
+    }
+    for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i) {
+      buckets[i] = now.buckets[op][i] - (previous_.buckets[op] ? previous_.buckets[op][i] : 0);
+    }
+    stats.ops[op].latency.Add(buckets.data(), now.sums[op] - previous_.sums[op]);
+  }
+  for (int c = 0; c < KVFS_COUNTER_COUNT; ++c) {
+    stats.counters[c] = now.counters[c] - previous_.counters[c];
+  }
+  previous_ = std::move(now);
+  return stats;
+}
+
+uint64_t Stats::Calls(kvfs_stats_op op) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t calls = 0;
+  for (auto &shard : shards_) {
+    calls += shard.second->calls[op].load(std::memory_order_relaxed);
+  }
+  return calls;
+}
+
+uint64_t Stats::Total(kvfs_stats_counter counter) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t total = 0;
+  for (auto &shard : shards_) {
+    total += shard.second->counters[counter].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+}  // namespace kvfs
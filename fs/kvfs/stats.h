@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   stats.h
+ */
+
+#ifndef KVFS_STATS_H
+#define KVFS_STATS_H
+
+#include <kvfs_config.h>
+#include <kvfs/latency_histogram.h>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+/**
+ * The operations whose calls and latencies are kept, those of the file system first and then those of
+ * the store under it. Open and OpenAt are both open, and so on for the other calls with an At variant;
+ * RmDir and Remove are unlink, as they are carried out by it.
+ */
+enum kvfs_stats_op : int {
+  KVFS_OP_CHDIR = 0,
+  KVFS_OP_OPENDIR,
+  KVFS_OP_READDIR,
+  KVFS_OP_READDIR_BATCH,
+  KVFS_OP_READDIR_PLUS,
+  KVFS_OP_TELLDIR,
+  KVFS_OP_SEEKDIR,
+  KVFS_OP_CLOSEDIR,
+  KVFS_OP_LINK,
+  KVFS_OP_SYMLINK,
+  KVFS_OP_READLINK,
+  KVFS_OP_UNLINK,
+  KVFS_OP_REMOVE_TREE,
+  KVFS_OP_WALK_TREE,
+  KVFS_OP_RENAME,
+  KVFS_OP_MKDIR,
+  KVFS_OP_CREATE_FILES_BATCH,
+  KVFS_OP_STAT,
+  KVFS_OP_STAT_MANY,
+  KVFS_OP_READ_FILES_MANY,
+  KVFS_OP_CHMOD,
+  KVFS_OP_ACCESS,
+  KVFS_OP_UTIME,
+  KVFS_OP_TRUNCATE,
+  KVFS_OP_MKNOD,
+  KVFS_OP_OPEN,
+  KVFS_OP_CLOSE,
+  KVFS_OP_READ,
+  KVFS_OP_WRITE,
+  KVFS_OP_LSEEK,
+  KVFS_OP_SYNC,
+  KVFS_OP_FSYNC,
+  KVFS_OP_FDATASYNC,
+  KVFS_OP_PREAD,
+  KVFS_OP_PWRITE,
+  KVFS_OP_STORE_GET,
+  KVFS_OP_STORE_MULTIGET,
+  KVFS_OP_STORE_PUT,
+  KVFS_OP_STORE_MERGE,
+  KVFS_OP_STORE_DELETE,
+  KVFS_OP_STORE_DELETE_RANGE,
+  KVFS_OP_STORE_GET_CHILDREN,
+  KVFS_OP_STORE_GET_PARENT,
+  // a write batch written to the store, an empty one is not
+  KVFS_OP_STORE_WRITE_BATCH,
+  // iterator seeks of any kind
+  KVFS_OP_STORE_SEEK,
+  // iterator steps either way
+  KVFS_OP_STORE_NEXT,
+  KVFS_OP_STORE_SNAPSHOT,
+  KVFS_OP_STORE_SYNC,
+  KVFS_OP_STORE_COMPACT,
+  KVFS_OP_COUNT
+};
+
+/**
+ * Amounts kept besides the operations, the bytes at either level give the read and write amplification.
+ */
+enum kvfs_stats_counter : int {
+  // data read and written through the file system
+  KVFS_COUNTER_FS_BYTES_READ = 0,
+  KVFS_COUNTER_FS_BYTES_WRITTEN,
+  // values read from the store, and keys and values written to it
+  KVFS_COUNTER_STORE_BYTES_READ,
+  KVFS_COUNTER_STORE_BYTES_WRITTEN,
+  // keys looked up by Get and MultiGet
+  KVFS_COUNTER_STORE_KEYS_READ,
+  // keys put or merged, alone or in a write batch
+  KVFS_COUNTER_STORE_KEYS_WRITTEN,
+  // keys and ranges deleted, alone or in a write batch
+  KVFS_COUNTER_STORE_KEYS_DELETED,
+  KVFS_COUNTER_COUNT
+};
+
+const char *kvfs_stats_op_name(kvfs_stats_op op);
+const char *kvfs_stats_counter_name(kvfs_stats_counter counter);
+
+struct kvfs_op_stats {
+  uint64_t calls = 0;
+  // calls that failed by throwing
+  uint64_t errors = 0;
+  // of a random sample of the calls, failed ones included, see Stats
+  kvfs::LatencyHistogram latency;
+};
+
+enum kvfs_stats_format : int {
+  KVFS_STATS_JSON = 0,
+  // the Prometheus text exposition format
+  KVFS_STATS_PROMETHEUS = 1
+};
+
+/**
+ * What was counted between two calls of KVFS::GetStats.
+ */
+struct kvfs_stats {
+  // length of the interval
+  double seconds = 0;
+  kvfs_op_stats ops[KVFS_OP_COUNT];
+  uint64_t counters[KVFS_COUNTER_COUNT] = {};
+
+  // bytes read from the store per byte read through the file system, 0 if nothing was read
+  double ReadAmplification() const;
+  // bytes written to the store per byte written through the file system, 0 if nothing was written
+  double WriteAmplification() const;
+
+  /**
+   * Write the operations that were called and all counters, latencies in microseconds.
+   * Prometheus gets a summary per operation, whose sum is estimated from the sampled latencies, and a
+   * gauge per counter, each over the interval only.
+   */
+  void Write(std::ostream &out, kvfs_stats_format format) const;
+};
+
+namespace kvfs {
+
+/**
+ * Calls, latencies and counters of a file system, cheap enough to be kept on every call.
+ *
+ * Each thread counts in a shard of its own, which only it writes, so counting takes no locked
+ * instruction and no cache line moves between cores. Snapshot adds the shards up and hands out the
+ * difference to the previous sum, which is how the counts start over without a shard being written
+ * by any other thread than its own. A thread that has ended leaves its shard to the next thread given
+ * the same id.
+ * Calls, failures and counters are exact. Reading the clock costs more than the rest together, so
+ * latencies are only taken of one call in kSampleEvery, picked at random.
+ * Built without BuildWithStats, nothing is counted and the counting calls compile to nothing.
+ */
+class Stats {
+ public:
+  static const uint64_t kSampleEvery = 64;
+
+  Stats();
+  ~Stats();
+
+  void Add(kvfs_stats_counter counter, uint64_t amount) {
+#if KVFS_STATS
+    Bump(&LocalShard()->counters[counter], amount);
+#else
+    (void) counter;
+    (void) amount;
+#endif
+  }
+
+  /**
+   * Everything counted since the previous snapshot, or since the start for the first one.
+   * Calls finishing while the snapshot is taken count in this one or in the next.
+   */
+  kvfs_stats Snapshot();
+
+  /**
+   * Calls of op and the amount of counter since the start, snapshots do not reset these.
+   */
+  uint64_t Calls(kvfs_stats_op op);
+  uint64_t Total(kvfs_stats_counter counter);
+
+ private:
+  struct Histogram {
+    std::atomic<uint64_t> buckets[LatencyHistogram::kBuckets];
+    std::atomic<uint64_t> sum;
+  };
+
+  struct Shard {
+    std::atomic<uint64_t> calls[KVFS_OP_COUNT];
+    std::atomic<uint64_t> errors[KVFS_OP_COUNT];
+    // allocated on the first sampled call of each operation
+    std::atomic<Histogram *> latencies[KVFS_OP_COUNT];
+    std::atomic<uint64_t> counters[KVFS_COUNTER_COUNT];
+    // xorshift state picking the sampled calls, only the owning thread reads it
+    uint64_t random;
+
+    bool Sample() {
+      random ^= random << 13;
+      random ^= random >> 7;
+      random ^= random << 17;
+      return random % kSampleEvery == 0;
+    }
+  };
+
+ public:
+  /**
+   * Counts the call of an operation it lives through, and times it if it is sampled.
+   * File system calls failed if they are left by an exception, which a call made by a destructor while
+   * one is thrown is taken for as well; store calls fail by returning it, see Done.
+   */
+  class Timer {
+   public:
+#if KVFS_STATS
+    Timer(Stats *stats, kvfs_stats_op op)
+        : stats_(stats), shard_(stats->LocalShard()), op_(op), failed_(false),
+          start_(shard_->Sample() ? Now() : 0) {}
+    ~Timer() {
+      Bump(&shard_->calls[op_], 1);
+      if (failed_ || (op_ < KVFS_OP_STORE_GET && std::uncaught_exceptions() > 0)) {
+        Bump(&shard_->errors[op_], 1);
+      }
+      if (start_ != 0) {
+        stats_->Record(shard_, op_, Now() - start_);
+      }
+    }
+
+    // counts the call as failed unless ok, which it returns
+    bool Done(bool ok) {
+      failed_ = !ok;
+      return ok;
+    }
+    // Stats::Add, without looking up the shard of the thread again
+    void Add(kvfs_stats_counter counter, uint64_t amount) {
+      Bump(&shard_->counters[counter], amount);
+    }
+#else
+    Timer(Stats *, kvfs_stats_op) {}
+
+    bool Done(bool ok) {
+      return ok;
+    }
+    void Add(kvfs_stats_counter, uint64_t) {}
+#endif
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+#if KVFS_STATS
+   private:
+    Stats *stats_;
+    Shard *shard_;
+    kvfs_stats_op op_;
+    bool failed_;
+    uint64_t start_;
+
+    static uint64_t Now() {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+#endif
+  };
+
+ private:
+  // sums of the shards, at the previous snapshot or now
+  struct Sums {
+    std::unique_ptr<uint64_t[]> buckets[KVFS_OP_COUNT];
+    uint64_t sums[KVFS_OP_COUNT] = {};
+    uint64_t calls[KVFS_OP_COUNT] = {};
+    uint64_t errors[KVFS_OP_COUNT] = {};
+    uint64_t counters[KVFS_COUNTER_COUNT] = {};
+  };
+
+  // tells apart the stats of file systems a thread has used
+  const uint64_t id_;
+  std::mutex mutex_;
+  std::map<std::thread::id, std::unique_ptr<Shard>> shards_;
+  Sums previous_;
+  std::chrono::steady_clock::time_point previous_time_;
+
+  // only the thread owning the counter writes it, no locked add is needed
+  static void Bump(std::atomic<uint64_t> *counter, uint64_t amount) {
+    counter->store(counter->load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  }
+
+  Shard *LocalShard() {
+    // one thread local, each costs a lookup in a shared library
+    thread_local struct {
+      uint64_t owner;
+      Shard *shard;
+    } local = {0, nullptr};
+    if (local.owner != id_) {
+      local.shard = FindShard();
+      local.owner = id_;
+    }
+    return local.shard;
+  }
+
+  void Record(Shard *shard, kvfs_stats_op op, uint64_t nanos) {
+    Histogram *histogram = shard->latencies[op].load(std::memory_order_relaxed);
+    if (histogram == nullptr) {
+      histogram = NewHistogram(shard, op);
+    }
+    Bump(&histogram->buckets[LatencyHistogram::Index(nanos)], 1);
+    Bump(&histogram->sum, nanos);
+  }
+
+  Shard *FindShard();
+  Histogram *NewHistogram(Shard *shard, kvfs_stats_op op);
+  void Sum(Sums *sums);
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_STATS_H
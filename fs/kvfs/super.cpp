@@ -31,10 +31,25 @@ std::string kvfsSuperBlock::pack() const {
   return d;
 }
 std::string kvfsFreedInodesKey::pack() const {
-  std::string d(sizeof(kvfsFreedInodesKey), L'\0');
-  memcpy(&d[0], this, d.size());
+  // copied field by field, the struct has padding which must not end up in the key
+  std::string d(sizeof(name) + sizeof(number_), L'\0');
+  memcpy(&d[0], name, sizeof(name));
+  memcpy(&d[sizeof(name)], &number_, sizeof(number_));
   return d;
 }
+void kvfsFreedInodesKey::parse(const std::string &key) {
+  if (key.size() != sizeof(name) + sizeof(number_)) {
+    std::ostringstream oss;
+    oss << "Unexpected key size retrieved from the backing store, "
+           "expected size for ";
+    oss << "kvfsFreedInodesKey";
+    oss << " is: (" << sizeof(name) + sizeof(number_) << ") ";
+    oss << "but retrieved size: (" << key.size() << ") ";
+    throw FSError(FSErrorType::FS_EBADVALUESIZE, oss.str());
+  }
+  memcpy(name, key.data(), sizeof(name));
+  memcpy(&number_, key.data() + sizeof(name), sizeof(number_));
+}
 std::string kvfsFreedInodesValue::pack() const {
   std::string d(sizeof(kvfsFreedInodesValue), L'\0');
   memcpy(&d[0], this, d.size());
@@ -54,4 +69,41 @@ void kvfsFreedInodesValue::parse(const KVStoreResult &sr) {
   auto *idx = bytes_.data();
   memcpy(this, idx, sizeof(kvfsFreedInodesValue));
 }
+std::string kvfsInodeAllocState::pack() const {
+  std::string d(sizeof(kvfsInodeAllocState), L'\0');
+  memcpy(&d[0], this, d.size());
+  return d;
+}
+void kvfsInodeAllocState::parse(const KVStoreResult &sr) {
+  auto bytes_ = sr.asString();
+  if (bytes_.size() != sizeof(kvfsInodeAllocState)) {
+    std::ostringstream oss;
+    oss << "Unexpected value size retrieved from the backing store, "
+           "expected size for ";
+    oss << "kvfsInodeAllocState";
+    oss << " is: (" << sizeof(kvfsInodeAllocState) << ") ";
+    oss << "but retrieved size: (" << bytes_.size() << ") ";
+    throw FSError(FSErrorType::FS_EBADVALUESIZE, oss.str());
+  }
+  memcpy(this, bytes_.data(), sizeof(kvfsInodeAllocState));
+}
+std::string kvfsOrphanKey::pack() const {
+  std::string d(sizeof(name) + sizeof(inode_), L'\0');
+  memcpy(&d[0], name, sizeof(name));
+  memcpy(&d[sizeof(name)], &inode_, sizeof(inode_));
+  return d;
+}
+void kvfsOrphanKey::parse(const std::string &key) {
+  if (key.size() != sizeof(name) + sizeof(inode_)) {
+    std::ostringstream oss;
+    oss << "Unexpected key size retrieved from the backing store, "
+           "expected size for ";
+    oss << "kvfsOrphanKey";
+    oss << " is: (" << sizeof(name) + sizeof(inode_) << ") ";
+    oss << "but retrieved size: (" << key.size() << ") ";
+    throw FSError(FSErrorType::FS_EBADVALUESIZE, oss.str());
+  }
+  memcpy(name, key.data(), sizeof(name));
+  memcpy(&inode_, key.data() + sizeof(name), sizeof(inode_));
+}
 }
\ No newline at end of file
@@ -31,20 +31,44 @@ struct kvfsSuperBlock {
   std::string pack() const;
 };
 
+/**
+ * A run of freed inode numbers is stored as {"freeinodes", first inode} -> {number of inodes}.
+ */
 struct kvfsFreedInodesKey {
   char name[11];
   uint64_t number_;
 
   std::string pack() const;
+  void parse(const std::string &key);
 };
 struct kvfsFreedInodesValue {
-  uint32_t count_{};
-  kvfs_file_inode_t inodes[512]{};
+  kvfs_file_inode_t count_{};
+
+  std::string pack() const;
+  void parse(const KVStoreResult &sr);
+};
+/**
+ * Inode numbers below high_water_ have been leased out, stored at "inodealloc".
+ */
+struct kvfsInodeAllocState {
+  kvfs_file_inode_t high_water_{};
 
   std::string pack() const;
   void parse(const KVStoreResult &sr);
 };
 
+/**
+ * A detached directory tree waiting to be deleted is stored as {"orphans", inode} -> its kvfsInodeValue,
+ * until every key under it has been removed.
+ */
+struct kvfsOrphanKey {
+  char name[10];
+  kvfs_file_inode_t inode_;
+
+  std::string pack() const;
+  void parse(const std::string &key);
+};
+
 }  // namespace kvfs
 
 #endif //KVFS_SUPERBLOCK_H
\ No newline at end of file
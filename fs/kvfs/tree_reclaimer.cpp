@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   tree_reclaimer.cpp
+ */
+
+#include <kvfs/tree_reclaimer.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <vector>
+
+namespace kvfs {
+
+namespace {
+// inode numbers freed per write batch
+const size_t kFreeBatchSize = 4096;
+
+std::string OrphanKey(kvfs_file_inode_t inode) {
+  kvfsOrphanKey key{"orphans", inode};
+  return key.pack();
+}
+// every key of the entries of a directory and of the blocks of a file starts with its inode
+std::string InodePrefix(kvfs_file_inode_t inode) {
+  std::string prefix(sizeof(inode), '\0');
+  memcpy(&prefix[0], &inode, sizeof(inode));
+  return prefix;
+}
+std::string PrefixEnd(std::string prefix) {
+  while (!prefix.empty()) {
+    auto last = static_cast<unsigned char>(prefix.back());
+    if (last != 0xff) {
+      prefix.back() = static_cast<char>(last + 1);
+      return prefix;
+    }
+    prefix.pop_back();
+  }
+  return prefix;
+}
+// other links to the file still need its blocks and its number
+bool OwnsData(const kvfsInodeValue &md) {
+  return S_ISDIR(md.fstat_.st_mode) || md.fstat_.st_nlink <= 1;
+}
+}  // namespace
+
+TreeReclaimer::TreeReclaimer(std::shared_ptr<KVStore> store, InodeAllocator *allocator)
+    : store_(std::move(store)), allocator_(allocator), busy_(false), stop_(false) {}
+
+void TreeReclaimer::Detach(const kvfsInodeValue &md, KVStore::WriteBatch *batch) {
+  batch->Put(OrphanKey(md.dirent_.d_ino), md.pack());
+}
+
+void TreeReclaimer::Start() {
+  std::string prefix = OrphanKey(0).substr(0, sizeof(kvfsOrphanKey::name));
+  std::unique_ptr<KVStore::Iterator> it = store_->GetIterator();
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    std::string_view key = it->key_view();
+    if (key.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+    std::string_view value = it->value_view();
+    if (value.size() != sizeof(kvfsInodeValue)) {
+      continue;
+    }
+    kvfsInodeValue md;
+    memcpy(static_cast<void *>(&md), value.data(), sizeof(kvfsInodeValue));
+    queue_.push_back(md);
+  }
+  it.reset();
+  worker_ = std::thread(&TreeReclaimer::Run, this);
+}
+
+void TreeReclaimer::Reclaim(const kvfsInodeValue &md) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  queue_.push_back(md);
+  work_cv_.notify_one();
+}
+
+void TreeReclaimer::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this] { return (queue_.empty() && !busy_) || stop_; });
+}
+
+void TreeReclaimer::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  idle_cv_.notify_all();
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+TreeReclaimer::~TreeReclaimer() {
+  Stop();
+}
+
+void TreeReclaimer::Run() {
+  while (true) {
+    kvfsInodeValue md;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this] { return !queue_.empty() || stop_; });
+      if (stop_) {
+        return;
+      }
+      md = queue_.front();
+      queue_.pop_front();
+      busy_ = true;
+    }
+    ReclaimEntry(md);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      busy_ = false;
+      if (queue_.empty()) {
+        idle_cv_.notify_all();
+      }
+    }
+  }
+}
+
+bool TreeReclaimer::Stopping() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stop_;
+}
+
+bool TreeReclaimer::ReclaimEntry(const kvfsInodeValue &md) {
+  if (S_ISDIR(md.fstat_.st_mode)) {
+    if (!ReclaimDirectory(md.fstat_.st_ino)) {
+      return false;
+    }
+  } else if (OwnsData(md)) {
+    std::string prefix = InodePrefix(md.fstat_.st_ino);
+    store_->DeleteRange(prefix, PrefixEnd(prefix));
+  }
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+  if (OwnsData(md)) {
+    allocator_->Free(md.dirent_.d_ino, batch.get());
+  }
+  batch->Delete(OrphanKey(md.dirent_.d_ino));
+  batch->Flush();
+  return true;
+}
+
+bool TreeReclaimer::ReclaimDirectory(kvfs_file_inode_t dir) {
+  std::string prefix = InodePrefix(dir);
+  std::vector<kvfs_file_inode_t> freed;
+  std::unique_ptr<KVStore::Iterator> it = store_->GetIterator();
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    std::string_view key = it->key_view();
+    if (key.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+    std::string_view value = it->value_view();
+    if (key.size() != sizeof(kvfsInodeKey) || value.size() != sizeof(kvfsInodeValue)) {
+      continue;
+    }
+    kvfsInodeValue md;
+    memcpy(static_cast<void *>(&md), value.data(), sizeof(kvfsInodeValue));
+    if (S_ISDIR(md.fstat_.st_mode)) {
+      // children first, this directory's entry of it is deleted with the rest of its range below
+      if (!ReclaimDirectory(md.fstat_.st_ino)) {
+        return false;
+      }
+    } else if (OwnsData(md)) {
+      std::string blocks = InodePrefix(md.fstat_.st_ino);
+      store_->DeleteRange(blocks, PrefixEnd(blocks));
+    }
+    if (OwnsData(md)) {
+      freed.push_back(md.dirent_.d_ino);
+    }
+    if (Stopping()) {
+      return false;
+    }
+  }
+  it.reset();
+
+  // the entries go before their numbers are freed, see the class comment
+  store_->DeleteRange(prefix, PrefixEnd(prefix));
+  std::unique_ptr<KVStore::WriteBatch> batch = store_->GetWriteBatch();
+  for (size_t i = 0; i < freed.size(); ++i) {
+    allocator_->Free(freed[i], batch.get());
+    if ((i + 1) % kFreeBatchSize == 0) {
+      batch->Flush();
+    }
+  }
+  batch->Flush();
+  return true;
+}
+
+}  // namespace kvfs
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   tree_reclaimer.h
+ */
+
+#ifndef KVFS_TREE_RECLAIMER_H
+#define KVFS_TREE_RECLAIMER_H
+
+#include <kvfs_store/kvfs_store.h>
+#include <kvfs/inode_allocator.h>
+#include <kvfs/super.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace kvfs {
+
+/**
+ * Deletes detached directory trees in the background.
+ *
+ * RemoveTree only deletes the entry of the tree from its parent and puts an orphan record
+ * ({"orphans", inode} -> entry, see kvfsOrphanKey) into the same batch, everything below it is removed here:
+ * the entries of each directory and the blocks of each file with DeleteRange over their inode prefix,
+ * children before their parent.
+ *
+ * The inode numbers of the entries of a directory are freed only after the range holding those entries
+ * is deleted, so a crash in between leaks numbers but never frees one twice, and a tree is picked up
+ * again from its orphan record at the next mount.
+ * Files that still have other links keep their blocks and their number.
+ */
+class TreeReclaimer {
+ public:
+  TreeReclaimer(std::shared_ptr<KVStore> store, InodeAllocator *allocator);
+
+  /**
+   * Add the orphan record of an entry to the batch that detaches it.
+   */
+  static void Detach(const kvfsInodeValue &md, KVStore::WriteBatch *batch);
+
+  /**
+   * Queue the trees left by earlier mounts and start the worker thread.
+   */
+  void Start();
+
+  /**
+   * Queue an entry whose orphan record has been written.
+   */
+  void Reclaim(const kvfsInodeValue &md);
+
+  /**
+   * Block until every queued tree has been deleted.
+   */
+  void Wait();
+
+  /**
+   * Stop the worker after the directory it is working on, the rest stays recorded for the next mount.
+   */
+  void Stop();
+
+  ~TreeReclaimer();
+
+ private:
+  std::shared_ptr<KVStore> store_;
+  InodeAllocator *allocator_;
+  std::deque<kvfsInodeValue> queue_;
+  bool busy_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable idle_cv_;
+  std::thread worker_;
+
+  void Run();
+  bool ReclaimEntry(const kvfsInodeValue &md);
+  bool ReclaimDirectory(kvfs_file_inode_t dir);
+  bool Stopping();
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_TREE_RECLAIMER_H
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   tree_walker.cpp
+ */
+
+#include <kvfs/tree_walker.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace kvfs {
+
+namespace {
+// an idle worker yields this many times before it starts sleeping between attempts to steal
+const size_t kIdleSpins = 64;
+const std::chrono::microseconds kIdleSleep(50);
+}  // namespace
+
+TreeWalker::TreeWalker(std::shared_ptr<KVStore> store,
+                       const KVStore::Snapshot *snapshot,
+                       const kvfs_walk_visitor &visitor,
+                       const kvfs_walk_options &options)
+    : store_(std::move(store)),
+      snapshot_(snapshot),
+      visitor_(visitor),
+      max_depth_(options.max_depth),
+      pending_(0),
+      stop_(false) {
+  unsigned threads = options.threads ? options.threads : std::thread::hardware_concurrency();
+  threads = std::max(threads, 1u);
+  for (unsigned i = 0; i < threads; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+}
+
+int TreeWalker::Walk(kvfs_file_inode_t parent, const kvfsInodeValue &root) {
+  int action = Visit(parent, root, 0);
+  if (action == KVFS_WALK_STOP) {
+    return KVFS_WALK_STOP;
+  }
+  if (!S_ISDIR(root.fstat_.st_mode) || action == KVFS_WALK_SKIP_SUBTREE || max_depth_ == 0) {
+    return 0;
+  }
+  Push(0, Task{root.fstat_.st_ino, 0});
+
+  // the calling thread is worker 0
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    threads.emplace_back(&TreeWalker::Run, this, i);
+  }
+  Run(0);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+  return stop_ ? KVFS_WALK_STOP : 0;
+}
+
+void TreeWalker::Run(size_t id) {
+  std::unique_ptr<KVStore::Iterator> it = store_->GetIterator(snapshot_);
+  Task task{};
+  size_t idle = 0;
+  while (pending_.load(std::memory_order_acquire) > 0) {
+    if (!Pop(id, &task)) {
+      if (++idle < kIdleSpins) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(kIdleSleep);
+      }
+      continue;
+    }
+    idle = 0;
+    // once stopped, the remaining tasks are only drained
+    if (!stop_.load(std::memory_order_relaxed)) {
+      try {
+        ReadDirectory(id, it.get(), task);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+        stop_ = true;
+      }
+    }
+    // after the children were pushed, so the count can't reach 0 while there is work left
+    pending_.fetch_sub(1, std::memory_order_acq_rel);
+  }
+}
+
+bool TreeWalker::Pop(size_t id, Task *task) {
+  {
+    Worker &own = *workers_[id];
+    std::lock_guard<std::mutex> lock(own.mutex_);
+    if (!own.tasks_.empty()) {
+      *task = own.tasks_.back();
+      own.tasks_.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    Worker &victim = *workers_[(id + i) % workers_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex_);
+    if (!victim.tasks_.empty()) {
+      *task = victim.tasks_.front();
+      victim.tasks_.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void TreeWalker::Push(size_t id, const Task &task) {
+  pending_.fetch_add(1, std::memory_order_acq_rel);
+  Worker &own = *workers_[id];
+  std::lock_guard<std::mutex> lock(own.mutex_);
+  own.tasks_.push_back(task);
+}
+
+void TreeWalker::ReadDirectory(size_t id, KVStore::Iterator *it, const Task &task) {
+  // the entries of a directory are the keys starting with its inode
+  std::string prefix(sizeof(kvfs_file_inode_t), '\0');
+  memcpy(&prefix[0], &task.dir_, sizeof(kvfs_file_inode_t));
+  int depth = task.depth_ + 1;
+  kvfsInodeValue md;
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    std::string_view key = it->key_view();
+    if (key.size() < prefix.size() || memcmp(key.data(), prefix.data(), prefix.size()) != 0) {
+      break;
+    }
+    std::string_view value = it->value_view();
+    if (key.size() != sizeof(kvfsInodeKey) || value.size() != sizeof(kvfsInodeValue)) {
+      continue;
+    }
+    memcpy(static_cast<void *>(&md), value.data(), sizeof(kvfsInodeValue));
+    int action = Visit(task.dir_, md, depth);
+    if (action == KVFS_WALK_STOP) {
+      stop_ = true;
+      return;
+    }
+    if (S_ISDIR(md.fstat_.st_mode) && action != KVFS_WALK_SKIP_SUBTREE
+        && (max_depth_ < 0 || depth < max_depth_)) {
+      Push(id, Task{md.fstat_.st_ino, depth});
+    }
+    if (stop_.load(std::memory_order_relaxed)) {
+      return;
+    }
+  }
+}
+
+int TreeWalker::Visit(kvfs_file_inode_t parent, const kvfsInodeValue &md, int depth) {
+  kvfs_walk_entry entry{parent, md.dirent_.d_name, &md.fstat_, depth};
+  return visitor_(entry);
+}
+
+}  // namespace kvfs
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   tree_walker.h
+ */
+
+#ifndef KVFS_TREE_WALKER_H
+#define KVFS_TREE_WALKER_H
+
+#include <kvfs_store/kvfs_store.h>
+#include <kvfs/kvfs_dirent.h>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace kvfs {
+
+/**
+ * Runs one WalkTree call.
+ *
+ * Every worker owns a deque of directories still to be read. It takes its own work from the back, so it
+ * goes depth first and keeps its deque short, and when that is empty it steals from the front of the
+ * others', where the directories closest to the root are and so likely the most work.
+ * Each worker reads with a single iterator on the snapshot, re-seeked for every directory, and entries
+ * are handed to the visitor straight from a stack copy, nothing is allocated per entry.
+ */
+class TreeWalker {
+ public:
+  TreeWalker(std::shared_ptr<KVStore> store,
+             const KVStore::Snapshot *snapshot,
+             const kvfs_walk_visitor &visitor,
+             const kvfs_walk_options &options);
+
+  /**
+   * Visit root and everything below it.
+   * @param parent st_ino of the directory holding root.
+   * @return 0 or KVFS_WALK_STOP, as WalkTree.
+   */
+  int Walk(kvfs_file_inode_t parent, const kvfsInodeValue &root);
+
+  ~TreeWalker() = default;
+
+ private:
+  struct Task {
+    kvfs_file_inode_t dir_;
+    int depth_;
+  };
+  struct Worker {
+    std::mutex mutex_;
+    std::deque<Task> tasks_;
+  };
+
+  std::shared_ptr<KVStore> store_;
+  const KVStore::Snapshot *snapshot_;
+  const kvfs_walk_visitor &visitor_;
+  int max_depth_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // directories pushed but not read yet, the walk is over when it drops to 0
+  std::atomic<size_t> pending_;
+  std::atomic<bool> stop_;
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+
+  void Run(size_t id);
+  bool Pop(size_t id, Task *task);
+  void Push(size_t id, const Task &task);
+  void ReadDirectory(size_t id, KVStore::Iterator *it, const Task &task);
+  int Visit(kvfs_file_inode_t parent, const kvfsInodeValue &md, int depth);
+};
+
+}  // namespace kvfs
+
+#endif //KVFS_TREE_WALKER_H
@@ -8,6 +8,7 @@
  */
 
 #include <leveldb/write_batch.h>
+#include <algorithm>
 #include "kvfs_leveldb_store.h"
 
 kvfs::kvfsLevelDBStore::kvfsLevelDBStore(const std::string &db_path)
@@ -24,22 +25,15 @@ void kvfs::kvfsLevelDBStore::Close() {
   db_handle.reset();
 }
 bool kvfs::kvfsLevelDBStore::Merge(const std::string &key, const std::string &value) {
-  db_handle->db->Delete(leveldb::WriteOptions(), key);
+  // a put replaces the old value in one write, readers never see the key missing in between
   leveldb::Status status = db_handle->db->Put(leveldb::WriteOptions(), key, value);
   return status.ok();
 }
 kvfs::KVStoreResult kvfs::kvfsLevelDBStore::Get(const std::string &key) {
-  std::string value;
-  leveldb::Status status = db_handle->db->Get(leveldb::ReadOptions(), key, &value);
-  if (!status.ok()) {
-    if (status.IsNotFound()) {
-      // Return an empty KVStoreResult
-      return KVStoreResult();
-    }
-    throw LevelDBException(
-        status, "Failed to get " + key + " from local store");
-  }
-  return KVStoreResult(std::move(value));
+  return Get(key, nullptr);
+}
+std::vector<kvfs::KVStoreResult> kvfs::kvfsLevelDBStore::MultiGet(const std::vector<std::string> &keys) {
+  return MultiGet(keys, nullptr);
 }
 bool kvfs::kvfsLevelDBStore::Delete(const std::string &key) {
   leveldb::WriteOptions options;
@@ -48,7 +42,29 @@ bool kvfs::kvfsLevelDBStore::Delete(const std::string &key) {
   return status.ok();
 }
 bool kvfs::kvfsLevelDBStore::DeleteRange(const std::string &start, const std::string &end) {
-  return false;
+  // leveldb has no range tombstones, the keys are deleted in batches of kDeleteRangeBatch
+  const size_t kDeleteRangeBatch = 1024;
+  std::unique_ptr<leveldb::Iterator> it(db_handle->db->NewIterator(leveldb::ReadOptions()));
+  leveldb::WriteBatch batch;
+  size_t pending = 0;
+  for (it->Seek(start); it->Valid(); it->Next()) {
+    std::string_view key(it->key().data(), it->key().size());
+    if (!end.empty() && key.compare(end) >= 0) {
+      break;
+    }
+    batch.Delete(it->key());
+    if (++pending == kDeleteRangeBatch) {
+      if (!db_handle->db->Write(leveldb::WriteOptions(), &batch).ok()) {
+        return false;
+      }
+      batch.Clear();
+      pending = 0;
+    }
+  }
+  if (!it->status().ok()) {
+    return false;
+  }
+  return pending == 0 || db_handle->db->Write(leveldb::WriteOptions(), &batch).ok();
 }
 std::vector<kvfs::KVStoreResult> kvfs::kvfsLevelDBStore::GetChildren(const std::string &key) {
   return std::vector<kvfs::KVStoreResult>();
@@ -112,10 +128,27 @@ void LevelDBWriteBatch::Delete(const std::string &key) {
   write_batch.Delete(key);
 }
 
+class LevelDBSnapshot : public kvfs::KVStore::Snapshot {
+ public:
+  explicit LevelDBSnapshot(std::shared_ptr<kvfs::LevelDBHandles> db_handle);
+  ~LevelDBSnapshot() override;
+
+  std::shared_ptr<kvfs::LevelDBHandles> db_handle_;
+  const leveldb::Snapshot *snapshot_;
+};
+
+LevelDBSnapshot::LevelDBSnapshot(std::shared_ptr<kvfs::LevelDBHandles> db_handle)
+    : db_handle_(std::move(db_handle)), snapshot_(db_handle_->db->GetSnapshot()) {}
+
+LevelDBSnapshot::~LevelDBSnapshot() {
+  db_handle_->db->ReleaseSnapshot(snapshot_);
+}
+
 class LevelDBIterator : public kvfs::KVStore::Iterator {
  public:
 
-  explicit LevelDBIterator(const std::shared_ptr<kvfs::LevelDBHandles> &db_handle);
+  LevelDBIterator(const std::shared_ptr<kvfs::LevelDBHandles> &db_handle,
+                  const kvfs::KVStore::Snapshot *snapshot);
   ~LevelDBIterator() override;
 
   bool Valid() const override;
@@ -126,6 +159,8 @@ class LevelDBIterator : public kvfs::KVStore::Iterator {
   void Prev() override;
   std::string key() const override;
   kvfs::KVStoreResult value() const override;
+  std::string_view key_view() const override;
+  std::string_view value_view() const override;
   bool status() const override;
   void SeekForPrev(const std::string &target) override;
   bool Refresh() override;
@@ -134,10 +169,14 @@ class LevelDBIterator : public kvfs::KVStore::Iterator {
   std::unique_ptr<leveldb::Iterator> iterator_;
 };
 
-LevelDBIterator::LevelDBIterator(const std::shared_ptr<kvfs::LevelDBHandles> &db_handle)
+LevelDBIterator::LevelDBIterator(const std::shared_ptr<kvfs::LevelDBHandles> &db_handle,
+                                 const kvfs::KVStore::Snapshot *snapshot)
     : kvfs::KVStore::Iterator() {
   leveldb::ReadOptions options;
   options.fill_cache = false;
+  if (snapshot) {
+    options.snapshot = static_cast<const LevelDBSnapshot *>(snapshot)->snapshot_;
+  }
   iterator_.reset(db_handle->db->NewIterator(options));
 }
 
@@ -165,6 +204,14 @@ std::string LevelDBIterator::key() const {
 kvfs::KVStoreResult LevelDBIterator::value() const {
   return kvfs::KVStoreResult(iterator_->value().ToString());
 }
+std::string_view LevelDBIterator::key_view() const {
+  leveldb::Slice key = iterator_->key();
+  return std::string_view(key.data(), key.size());
+}
+std::string_view LevelDBIterator::value_view() const {
+  leveldb::Slice value = iterator_->value();
+  return std::string_view(value.data(), value.size());
+}
 bool LevelDBIterator::status() const {
   return iterator_->status().ok();
 }
@@ -183,5 +230,57 @@ std::unique_ptr<kvfs::KVStore::WriteBatch> kvfs::kvfsLevelDBStore::GetWriteBatch
   return std::make_unique<LevelDBWriteBatch>(db_handle);
 }
 std::unique_ptr<kvfs::KVStore::Iterator> kvfs::kvfsLevelDBStore::GetIterator() {
-  return std::make_unique<LevelDBIterator>(db_handle);
+  return std::make_unique<LevelDBIterator>(db_handle, nullptr);
+}
+std::shared_ptr<const kvfs::KVStore::Snapshot> kvfs::kvfsLevelDBStore::GetSnapshot() {
+  return std::make_shared<LevelDBSnapshot>(db_handle);
+}
+std::unique_ptr<kvfs::KVStore::Iterator> kvfs::kvfsLevelDBStore::GetIterator(const Snapshot *snapshot) {
+  return std::make_unique<LevelDBIterator>(db_handle, snapshot);
+}
+kvfs::KVStoreResult kvfs::kvfsLevelDBStore::Get(const std::string &key, const Snapshot *snapshot) {
+  leveldb::ReadOptions options;
+  if (snapshot) {
+    options.snapshot = static_cast<const LevelDBSnapshot *>(snapshot)->snapshot_;
+  }
+  std::string value;
+  leveldb::Status status = db_handle->db->Get(options, key, &value);
+  if (!status.ok()) {
+    if (status.IsNotFound()) {
+      // Return an empty KVStoreResult
+      return KVStoreResult();
+    }
+    throw LevelDBException(
+        status, "Failed to get " + key + " from local store");
+  }
+  return KVStoreResult(std::move(value));
+}
+std::vector<kvfs::KVStoreResult> kvfs::kvfsLevelDBStore::MultiGet(const std::vector<std::string> &keys,
+                                                                  const Snapshot *snapshot) {
+  // leveldb has no multi-get, the keys are read in key order from one snapshot so that neighbouring
+  // keys are served from the same table blocks
+  std::vector<size_t> order(keys.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+  std::shared_ptr<const Snapshot> own;
+  if (!snapshot) {
+    own = GetSnapshot();
+    snapshot = own.get();
+  }
+  leveldb::ReadOptions options;
+  options.snapshot = static_cast<const LevelDBSnapshot *>(snapshot)->snapshot_;
+  std::vector<KVStoreResult> results(keys.size());
+  for (size_t i : order) {
+    std::string value;
+    leveldb::Status status = db_handle->db->Get(options, keys[i], &value);
+    if (status.ok()) {
+      results[i] = KVStoreResult(std::move(value));
+    } else if (!status.IsNotFound()) {
+      throw LevelDBException(
+          status, "Failed to get " + keys[i] + " from local store");
+    }
+  }
+  return results;
 }
@@ -31,18 +31,11 @@ bool kvfsRocksDBStore::Put(const std::string &key, const std::string &value) {
 }
 
 KVStoreResult kvfsRocksDBStore::Get(const std::string &key) {
-  std::string value;
-  auto status = db_handle->db->Get(
-      rocksdb::ReadOptions(), key, &value);
-  if (!status.ok()) {
-    if (status.IsNotFound()) {
-      // Return an empty StoreResult
-      return KVStoreResult();
-    }
-    throw RocksException(
-        status, "failed to get " + key + " from local store");
-  }
-  return KVStoreResult(std::move(value));
+  return Get(key, nullptr);
+}
+
+vector<KVStoreResult> kvfsRocksDBStore::MultiGet(const std::vector<std::string> &keys) {
+  return MultiGet(keys, nullptr);
 }
 
 bool kvfsRocksDBStore::Delete(const std::string &key) {
@@ -98,16 +91,27 @@ bool kvfsRocksDBStore::Compact() {
 }
 
 bool kvfsRocksDBStore::Merge(const std::string &key, const std::string &value) {
-  if (this->Get(key).isValid()) {
-    auto status = db_handle->db->Delete(rocksdb::WriteOptions(), key);
-    status = db_handle->db->Put(rocksdb::WriteOptions(), key, value);
-    return status.ok();
-  } else {
-    return this->Put(key, value);
-  }
+  // a put replaces the old value in one write, readers never see the key missing in between
+  return this->Put(key, value);
 }
 
 bool kvfsRocksDBStore::DeleteRange(const std::string &start, const std::string &end) {
+  if (end.empty()) {
+    // rocksdb takes an empty end as an empty range, delete up to the last key and the last key itself
+    std::unique_ptr<rocksdb::Iterator> it(db_handle->db->NewIterator(rocksdb::ReadOptions()));
+    it->SeekToLast();
+    if (!it->Valid()) {
+      return it->status().ok();
+    }
+    std::string last = it->key().ToString();
+    if (last < start) {
+      return true;
+    }
+    rocksdb::WriteBatch batch;
+    batch.DeleteRange(start, last);
+    batch.Delete(last);
+    return db_handle->db->Write(rocksdb::WriteOptions(), &batch).ok();
+  }
   auto status = db_handle->db->DeleteRange(rocksdb::WriteOptions(), db_handle->db->DefaultColumnFamily(), start, end);
   return status.ok();
 }
@@ -153,10 +157,26 @@ void RocksDBWriteBatch::Delete(const std::string &key) {
   write_batch.Delete(key);
 }
 
+class RocksDBSnapshot : public KVStore::Snapshot {
+ public:
+  explicit RocksDBSnapshot(std::shared_ptr<kvfs::RocksHandles> db_handle);
+  ~RocksDBSnapshot() override;
+
+  std::shared_ptr<kvfs::RocksHandles> db_handle_;
+  const rocksdb::Snapshot *snapshot_;
+};
+
+RocksDBSnapshot::RocksDBSnapshot(std::shared_ptr<kvfs::RocksHandles> db_handle)
+    : db_handle_(std::move(db_handle)), snapshot_(db_handle_->db->GetSnapshot()) {}
+
+RocksDBSnapshot::~RocksDBSnapshot() {
+  db_handle_->db->ReleaseSnapshot(snapshot_);
+}
+
 class RocksDBIterator : public KVStore::Iterator {
  public:
 
-  explicit RocksDBIterator(const std::shared_ptr<kvfs::RocksHandles> &db_handle);
+  RocksDBIterator(const std::shared_ptr<kvfs::RocksHandles> &db_handle, const KVStore::Snapshot *snapshot);
   ~RocksDBIterator() override;
 
   bool Valid() const override;
@@ -168,6 +188,8 @@ class RocksDBIterator : public KVStore::Iterator {
   void Prev() override;
   std::string key() const override;
   KVStoreResult value() const override;
+  std::string_view key_view() const override;
+  std::string_view value_view() const override;
   bool status() const override;
   bool Refresh() override;
 
@@ -175,10 +197,14 @@ class RocksDBIterator : public KVStore::Iterator {
   std::unique_ptr<rocksdb::Iterator> iterator_;
 };
 
-kvfs::RocksDBIterator::RocksDBIterator(const std::shared_ptr<kvfs::RocksHandles> &db_handle)
+kvfs::RocksDBIterator::RocksDBIterator(const std::shared_ptr<kvfs::RocksHandles> &db_handle,
+                                       const KVStore::Snapshot *snapshot)
     : KVStore::Iterator() {
   rocksdb::ReadOptions options;
   options.fill_cache = false;
+  if (snapshot) {
+    options.snapshot = static_cast<const RocksDBSnapshot *>(snapshot)->snapshot_;
+  }
   iterator_.reset(db_handle->db->NewIterator(options));
 }
 bool kvfs::RocksDBIterator::Valid() const {
@@ -208,6 +234,14 @@ std::string kvfs::RocksDBIterator::key() const {
 KVStoreResult kvfs::RocksDBIterator::value() const {
   return KVStoreResult(iterator_->value().ToString());
 }
+std::string_view kvfs::RocksDBIterator::key_view() const {
+  rocksdb::Slice key = iterator_->key();
+  return std::string_view(key.data(), key.size());
+}
+std::string_view kvfs::RocksDBIterator::value_view() const {
+  rocksdb::Slice value = iterator_->value();
+  return std::string_view(value.data(), value.size());
+}
 bool kvfs::RocksDBIterator::status() const {
   return iterator_->status().ok();
 }
@@ -224,7 +258,49 @@ std::unique_ptr<KVStore::WriteBatch> kvfsRocksDBStore::GetWriteBatch() {
   return std::make_unique<RocksDBWriteBatch>(db_handle);
 }
 std::unique_ptr<KVStore::Iterator> kvfsRocksDBStore::GetIterator() {
-  return std::make_unique<RocksDBIterator>(db_handle);
+  return std::make_unique<RocksDBIterator>(db_handle, nullptr);
+}
+std::shared_ptr<const KVStore::Snapshot> kvfsRocksDBStore::GetSnapshot() {
+  return std::make_shared<RocksDBSnapshot>(db_handle);
+}
+std::unique_ptr<KVStore::Iterator> kvfsRocksDBStore::GetIterator(const Snapshot *snapshot) {
+  return std::make_unique<RocksDBIterator>(db_handle, snapshot);
+}
+KVStoreResult kvfsRocksDBStore::Get(const std::string &key, const Snapshot *snapshot) {
+  rocksdb::ReadOptions options;
+  if (snapshot) {
+    options.snapshot = static_cast<const RocksDBSnapshot *>(snapshot)->snapshot_;
+  }
+  std::string value;
+  auto status = db_handle->db->Get(options, key, &value);
+  if (!status.ok()) {
+    if (status.IsNotFound()) {
+      // Return an empty StoreResult
+      return KVStoreResult();
+    }
+    throw RocksException(
+        status, "failed to get " + key + " from local store");
+  }
+  return KVStoreResult(std::move(value));
+}
+vector<KVStoreResult> kvfsRocksDBStore::MultiGet(const std::vector<std::string> &keys, const Snapshot *snapshot) {
+  rocksdb::ReadOptions options;
+  if (snapshot) {
+    options.snapshot = static_cast<const RocksDBSnapshot *>(snapshot)->snapshot_;
+  }
+  vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+  vector<std::string> values;
+  vector<rocksdb::Status> statuses = db_handle->db->MultiGet(options, slices, &values);
+  vector<KVStoreResult> results(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (statuses[i].ok()) {
+      results[i] = KVStoreResult(std::move(values[i]));
+    } else if (!statuses[i].IsNotFound()) {
+      throw RocksException(
+          statuses[i], "failed to get " + keys[i] + " from local store");
+    }
+  }
+  return results;
 }
 bool kvfsRocksDBStore::Destroy() {
   rocksdb::DestroyDB(this->db_handle->db->GetName(), db_handle->db->GetOptions());
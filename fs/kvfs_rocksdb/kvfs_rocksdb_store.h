@@ -35,6 +35,7 @@ class kvfsRocksDBStore : public KVStore {
   bool Merge(const std::string &key, const std::string &value) override;
 
   KVStoreResult Get(const std::string &key) override;
+  std::vector<KVStoreResult> MultiGet(const std::vector<std::string> &keys) override;
 
   bool Delete(const std::string &key) override;
   bool DeleteRange(const std::string &start, const std::string &end) override;
@@ -52,6 +53,13 @@ class kvfsRocksDBStore : public KVStore {
 
   std::unique_ptr<Iterator> GetIterator() override;
 
+  std::shared_ptr<const Snapshot> GetSnapshot() override;
+
+  std::unique_ptr<Iterator> GetIterator(const Snapshot *snapshot) override;
+
+  KVStoreResult Get(const std::string &key, const Snapshot *snapshot) override;
+  std::vector<KVStoreResult> MultiGet(const std::vector<std::string> &keys, const Snapshot *snapshot) override;
+
  private:
   std::shared_ptr<RocksHandles> db_handle;
 };
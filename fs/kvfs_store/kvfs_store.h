@@ -13,6 +13,7 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <string_view>
 
 #include "kvfs_store_entry.h"
 #include "kvfs_store_result.h"
@@ -25,8 +26,15 @@ class KVStore {
   virtual bool Merge(const std::string &key, const std::string &value) = 0;
 
   virtual KVStoreResult Get(const std::string &key) = 0;
+  /**
+   * Get many keys from one view of the store, results are in the order of keys and invalid for missing keys.
+   */
+  virtual std::vector<KVStoreResult> MultiGet(const std::vector<std::string> &keys) = 0;
 
   virtual bool Delete(const std::string &key) = 0;
+  /**
+   * Delete every key in [start, end), an empty end means up to the last key.
+   */
   virtual bool DeleteRange(const std::string &start, const std::string &end) = 0;
 
   virtual bool Compact() = 0;
@@ -85,6 +93,13 @@ class KVStore {
 
     virtual KVStoreResult value() const = 0;
 
+    /**
+     * Key and value without copying them out of the iterator, valid until it is moved.
+     */
+    virtual std::string_view key_view() const = 0;
+
+    virtual std::string_view value_view() const = 0;
+
     virtual bool status() const = 0;
 
     virtual bool Refresh() = 0;
@@ -104,6 +119,28 @@ class KVStore {
 
   virtual std::unique_ptr<Iterator> GetIterator() = 0;
 
+  /**
+   * A consistent view of the store, reads through it don't see the writes made after it was taken.
+   * The view is released together with the last reference to it.
+   */
+  class Snapshot {
+   public:
+    virtual ~Snapshot() = default;
+  };
+
+  virtual std::shared_ptr<const Snapshot> GetSnapshot() = 0;
+
+  /**
+   * Iterator over the store as it was when snapshot was taken, the latest state if snapshot is nullptr.
+   */
+  virtual std::unique_ptr<Iterator> GetIterator(const Snapshot *snapshot) = 0;
+
+  /**
+   * Get and MultiGet of the store as it was when snapshot was taken, the latest state if snapshot is nullptr.
+   */
+  virtual KVStoreResult Get(const std::string &key, const Snapshot *snapshot) = 0;
+  virtual std::vector<KVStoreResult> MultiGet(const std::vector<std::string> &keys, const Snapshot *snapshot) = 0;
+
 };
 
 } // namespace kvfs
@@ -39,8 +39,11 @@ std::string kvfsInodeKey::pack() const {
 }
 kvfsBlockKey::kvfsBlockKey(kvfs_file_inode_t inode, kvfs_off_t number) : inode_(inode), block_number_(number) {}
 std::string kvfsBlockKey::pack() const {
+  // copied field by field, the padding at the end of the struct is not initialized and must stay zero in the key
   std::string d(sizeof(kvfsBlockKey), L'\0');
-  std::memcpy(&d[0], this, d.size());
+  std::memcpy(&d[offsetof(kvfsBlockKey, inode_)], &inode_, sizeof(inode_));
+  std::memcpy(&d[offsetof(kvfsBlockKey, block_number_)], &block_number_, sizeof(block_number_));
+  std::memcpy(&d[offsetof(kvfsBlockKey, __padding)], __padding, sizeof(__padding));
   return d;
 }
 void kvfsBlockKey::parse(const std::string &sr) {
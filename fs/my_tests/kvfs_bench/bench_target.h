@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   bench_target.h
+ */
+
+#ifndef KVFS_BENCH_TARGET_H
+#define KVFS_BENCH_TARGET_H
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+/**
+ * The file system a benchmark runs against, KVFS or a directory of the host file system.
+ *
+ * Paths are absolute within the target, the host target puts them under its directory. Calls return what
+ * the POSIX calls return, -1 on failure, whether the file system reports failures by return value or by
+ * throwing FSError.
+ */
+class BenchTarget {
+ public:
+  virtual ~BenchTarget() = default;
+
+  virtual int Open(const std::string &path, int flags, mode_t mode) = 0;
+  virtual int Close(int fd) = 0;
+  virtual ssize_t PRead(int fd, void *buffer, size_t size, off_t offset) = 0;
+  virtual ssize_t PWrite(int fd, const void *buffer, size_t size, off_t offset) = 0;
+  virtual int FSync(int fd) = 0;
+  virtual int MkDir(const std::string &path, mode_t mode) = 0;
+  virtual int UnLink(const std::string &path) = 0;
+  virtual int RmDir(const std::string &path) = 0;
+  virtual int Rename(const std::string &from, const std::string &to) = 0;
+  virtual int Stat(const std::string &path) = 0;
+  // lists a directory, returns the number of entries other than . and ..
+  virtual int ReadDir(const std::string &path) = 0;
+  // the calls the file system made to its store so far, false if it does not count them
+  virtual bool StoreCalls(kvfs_store_calls *calls) {
+    (void) calls;
+    return false;
+  }
+  // removes everything the benchmark left behind
+  virtual void Destroy() = 0;
+  // true if calls may come from several threads at once
+  virtual bool ThreadSafe() const = 0;
+};
+
+class KvfsTarget : public BenchTarget {
+ public:
+  explicit KvfsTarget(const std::string &mount_path, const kvfs_mount_options &options = kvfs_mount_options())
+      : kvfs_(new kvfs::KVFS(mount_path, options)), fs_(kvfs_) {}
+
+  int Open(const std::string &path, int flags, mode_t mode) override {
+    return Call([&] { return fs_->Open(path.c_str(), flags, mode); });
+  }
+  int Close(int fd) override {
+    return Call([&] { return fs_->Close(fd); });
+  }
+  ssize_t PRead(int fd, void *buffer, size_t size, off_t offset) override {
+    return Call([&] { return fs_->PRead(fd, buffer, size, offset); });
+  }
+  ssize_t PWrite(int fd, const void *buffer, size_t size, off_t offset) override {
+    return Call([&] { return fs_->PWrite(fd, buffer, size, offset); });
+  }
+  int FSync(int fd) override {
+    return Call([&] { return fs_->FSync(fd); });
+  }
+  int MkDir(const std::string &path, mode_t mode) override {
+    return Call([&] { return fs_->MkDir(path.c_str(), mode); });
+  }
+  int UnLink(const std::string &path) override {
+    return Call([&] { return fs_->UnLink(path.c_str()); });
+  }
+  int RmDir(const std::string &path) override {
+    return Call([&] { return fs_->RmDir(path.c_str()); });
+  }
+  int Rename(const std::string &from, const std::string &to) override {
+    return Call([&] { return fs_->Rename(from.c_str(), to.c_str()); });
+  }
+  int Stat(const std::string &path) override {
+    kvfs_stat buf{};
+    return Call([&] { return fs_->Stat(path.c_str(), &buf); });
+  }
+  int ReadDir(const std::string &path) override {
+    return Call([&] {
+      kvfsDIR *dir = fs_->OpenDir(path.c_str());
+      if (dir == nullptr) {
+        return -1;
+      }
+      int entries = 0;
+      while (kvfs_dirent *entry = fs_->ReadDir(dir)) {
+        std::string name = entry->d_name;
+        entries += name != "." && name != "..";
+      }
+      fs_->CloseDir(dir);
+      return entries;
+    });
+  }
+  bool StoreCalls(kvfs_store_calls *calls) override {
+    *calls = kvfs_->StoreCalls();
+    return KVFS_STATS;
+  }
+  void Destroy() override {
+    fs_->DestroyFS();
+  }
+  bool ThreadSafe() const override {
+    return KVFS_THREAD_SAFE;
+  }
+  FS *fs() {
+    return fs_.get();
+  }
+
+ private:
+  // the same file system, the FS interface of it is the one the benchmarks use
+  kvfs::KVFS *kvfs_;
+  std::unique_ptr<FS> fs_;
+
+  template<typename Function>
+  static auto Call(Function function) -> decltype(function()) {
+    try {
+      auto result = function();
+      return result < 0 ? -1 : result;
+    } catch (kvfs::FSError &) {
+      return -1;
+    }
+  }
+};
+
+class HostTarget : public BenchTarget {
+ public:
+  // everything goes into a new directory below directory, which is removed again by Destroy
+  explicit HostTarget(const std::string &directory)
+      : root_(directory + "/kvfs_bench." + std::to_string(getpid())) {
+    std::filesystem::create_directories(root_);
+  }
+
+  int Open(const std::string &path, int flags, mode_t mode) override {
+    return open(Host(path).c_str(), flags, mode);
+  }
+  int Close(int fd) override {
+    return close(fd);
+  }
+  ssize_t PRead(int fd, void *buffer, size_t size, off_t offset) override {
+    return pread(fd, buffer, size, offset);
+  }
+  ssize_t PWrite(int fd, const void *buffer, size_t size, off_t offset) override {
+    return pwrite(fd, buffer, size, offset);
+  }
+  int FSync(int fd) override {
+    return fsync(fd);
+  }
+  int MkDir(const std::string &path, mode_t mode) override {
+    return mkdir(Host(path).c_str(), mode);
+  }
+  int UnLink(const std::string &path) override {
+    return unlink(Host(path).c_str());
+  }
+  int RmDir(const std::string &path) override {
+    return rmdir(Host(path).c_str());
+  }
+  int Rename(const std::string &from, const std::string &to) override {
+    return rename(Host(from).c_str(), Host(to).c_str());
+  }
+  int Stat(const std::string &path) override {
+    struct stat buf{};
+    return stat(Host(path).c_str(), &buf);
+  }
+  int ReadDir(const std::string &path) override {
+    DIR *dir = opendir(Host(path).c_str());
+    if (dir == nullptr) {
+      return -1;
+    }
+    int entries = 0;
+    while (dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      entries += name != "." && name != "..";
+    }
+    closedir(dir);
+    return entries;
+  }
+  void Destroy() override {
+    std::error_code ignored;
+    std::filesystem::remove_all(root_, ignored);
+  }
+  bool ThreadSafe() const override {
+    return true;
+  }
+
+ private:
+  std::string root_;
+
+  std::string Host(const std::string &path) const {
+    return root_ + path;
+  }
+};
+
+#endif //KVFS_BENCH_TARGET_H
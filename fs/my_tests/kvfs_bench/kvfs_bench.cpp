@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   kvfs_bench.cpp
+ */
+
+#include "bench_target.h"
+#include <kvfs/latency_histogram.h>
+#include <getopt.h>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// A fio-like driver: each job runs numjobs threads, each with nrfiles files of its own, doing reads and
+// writes of bs bytes for runtime seconds. Jobs are given with the options below, the same names fio uses,
+// or as sections of fio style job files, where a [global] section sets defaults for the sections after it.
+//
+//   kvfs_bench --rw=randrw --bs=4k --size=64m --numjobs=4 --runtime=10
+//   kvfs_bench --ioengine=host --directory=/mnt/scratch/bench jobs.fio
+//
+// The results are written as JSON, one object per job, with iops, bandwidth and latency percentiles of
+// the reads, writes and fsyncs.
+
+struct Job {
+  std::string name = "job";
+  // kvfs or host
+  std::string ioengine = "kvfs";
+  // mount path of kvfs, whose store is destroyed after the job, or the directory on the host file system
+  // the job makes its files in; a default for either if empty
+  std::string directory;
+  unsigned numjobs = 1;
+  unsigned nrfiles = 1;
+  // of each file
+  uint64_t size = 64 << 20;
+  uint64_t bs = 4096;
+  // read, write, rw (readwrite), randread, randwrite or randrw
+  std::string rw = "randread";
+  unsigned rwmixread = 50;
+  // of the random offsets: random, or zipf:theta where block i is picked in proportion to 1 / (i + 1)^theta
+  std::string random_distribution = "random";
+  // fsync the file after this many writes to it, 0 never
+  unsigned fsync = 0;
+  double runtime = 10;
+  // stop a thread after this many reads and writes, 0 runs for runtime
+  uint64_t number_ios = 0;
+};
+
+struct ThreadResult {
+  kvfs::LatencyHistogram read;
+  kvfs::LatencyHistogram write;
+  kvfs::LatencyHistogram fsync;
+  uint64_t read_bytes = 0;
+  uint64_t write_bytes = 0;
+  uint64_t errors = 0;
+};
+
+uint64_t ParseSize(const std::string &value) {
+  size_t end = 0;
+  double number = std::stod(value, &end);
+  uint64_t unit = 1;
+  if (end < value.size()) {
+    switch (std::tolower(value[end])) {
+      case 'k':unit = 1ull << 10;
+        break;
+      case 'm':unit = 1ull << 20;
+        break;
+      case 'g':unit = 1ull << 30;
+        break;
+      case 't':unit = 1ull << 40;
+        break;
+      default:throw std::invalid_argument("unknown size suffix in " + value);
+    }
+  }
+  return static_cast<uint64_t>(number * unit);
+}
+
+double ParseTime(const std::string &value) {
+  size_t end = 0;
+  double number = std::stod(value, &end);
+  std::string unit = value.substr(end);
+  if (unit == "ms") {
+    return number / 1000;
+  }
+  if (unit == "m") {
+    return number * 60;
+  }
+  return number;
+}
+
+// false if key is not a job option
+bool SetOption(Job *job, const std::string &key, const std::string &value) {
+  if (key == "name") {
+    job->name = value;
+  } else if (key == "ioengine") {
+    if (value != "kvfs" && value != "host") {
+      throw std::invalid_argument("ioengine is kvfs or host");
+    }
+    job->ioengine = value;
+  } else if (key == "directory") {
+    job->directory = value;
+  } else if (key == "numjobs") {
+    job->numjobs = std::max(std::stoul(value), 1ul);
+  } else if (key == "nrfiles") {
+    job->nrfiles = std::max(std::stoul(value), 1ul);
+  } else if (key == "size") {
+    job->size = ParseSize(value);
+  } else if (key == "bs") {
+    job->bs = std::max<uint64_t>(ParseSize(value), 1);
+  } else if (key == "rw" || key == "readwrite") {
+    if (value != "read" && value != "write" && value != "rw" && value != "readwrite" && value != "randread"
+        && value != "randwrite" && value != "randrw") {
+      throw std::invalid_argument("unknown rw " + value);
+    }
+    job->rw = value == "readwrite" ? "rw" : value;
+  } else if (key == "rwmixread") {
+    job->rwmixread = std::min(std::stoul(value), 100ul);
+  } else if (key == "random_distribution") {
+    if (value != "random" && value.compare(0, 5, "zipf:") != 0) {
+      throw std::invalid_argument("random_distribution is random or zipf:theta");
+    }
+    job->random_distribution = value;
+  } else if (key == "fsync") {
+    job->fsync = std::stoul(value);
+  } else if (key == "runtime") {
+    job->runtime = ParseTime(value);
+  } else if (key == "number_ios") {
+    job->number_ios = std::stoull(value);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// the sections of a job file, [global] ones only set defaults
+void ParseJobFile(const std::string &path, const Job &defaults, std::vector<Job> *jobs) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::invalid_argument("cannot open job file " + path);
+  }
+  Job global = defaults;
+  Job *current = nullptr;
+  std::string line;
+  while (std::getline(in, line)) {
+    line.erase(0, line.find_first_not_of(" \t"));
+    line.erase(line.find_last_not_of(" \t\r") + 1);
+    if (line.empty() || line[0] == ';' || line[0] == '#') {
+      continue;
+    }
+    if (line[0] == '[') {
+      std::string section = line.substr(1, line.find(']') - 1);
+      if (section == "global") {
+        current = &global;
+      } else {
+        jobs->push_back(global);
+        jobs->back().name = section;
+        current = &jobs->back();
+      }
+      continue;
+    }
+    if (current == nullptr) {
+      throw std::invalid_argument("option outside of a section in " + path + ": " + line);
+    }
+    size_t equals = line.find('=');
+    std::string key = line.substr(0, equals);
+    std::string value = equals == std::string::npos ? "1" : line.substr(equals + 1);
+    key.erase(key.find_last_not_of(" \t") + 1);
+    value.erase(0, value.find_first_not_of(" \t"));
+    if (!SetOption(current, key, value)) {
+      std::cerr << "ignoring unknown option " << key << " in " << path << "\n";
+    }
+  }
+}
+
+/**
+ * Block numbers of a file, zipf or uniform.
+ */
+class OffsetPicker {
+ public:
+  OffsetPicker(const Job &job, uint64_t blocks) : blocks_(std::max<uint64_t>(blocks, 1)) {
+    if (job.random_distribution.compare(0, 5, "zipf:") == 0) {
+      double theta = std::stod(job.random_distribution.substr(5));
+      cdf_.resize(blocks_);
+      double sum = 0;
+      for (uint64_t i = 0; i < blocks_; ++i) {
+        sum += 1.0 / std::pow(static_cast<double>(i + 1), theta);
+        cdf_[i] = sum;
+      }
+      for (double &value : cdf_) {
+        value /= sum;
+      }
+    }
+  }
+
+  uint64_t Pick(std::mt19937_64 *random) const {
+    if (cdf_.empty()) {
+      return std::uniform_int_distribution<uint64_t>(0, blocks_ - 1)(*random);
+    }
+    double u = std::uniform_real_distribution<double>(0, 1)(*random);
+    return std::min<uint64_t>(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin(), blocks_ - 1);
+  }
+
+ private:
+  uint64_t blocks_;
+  std::vector<double> cdf_;
+};
+
+std::string FileName(const Job &job, unsigned thread, unsigned file) {
+  return "/" + job.name + "." + std::to_string(thread) + "." + std::to_string(file);
+}
+
+// every file is written in full before the job starts, reads need the data and kvfs does not write past the end
+bool LayOut(BenchTarget *target, const Job &job, unsigned threads) {
+  std::string chunk(std::min<uint64_t>(job.size, 1 << 20), '\0');
+  std::mt19937_64 random(1);
+  for (char &c : chunk) {
+    c = static_cast<char>(random());
+  }
+  for (unsigned t = 0; t < threads; ++t) {
+    for (unsigned f = 0; f < job.nrfiles; ++f) {
+      int fd = target->Open(FileName(job, t, f), O_CREAT | O_RDWR, 0644);
+      if (fd < 0) {
+        return false;
+      }
+      for (uint64_t offset = 0; offset < job.size; offset += chunk.size()) {
+        size_t length = std::min<uint64_t>(chunk.size(), job.size - offset);
+        if (target->PWrite(fd, chunk.data(), length, offset) != static_cast<ssize_t>(length)) {
+          target->Close(fd);
+          return false;
+        }
+      }
+      target->Close(fd);
+    }
+  }
+  return true;
+}
+
+void RunThread(BenchTarget *target,
+               const Job &job,
+               const OffsetPicker &picker,
+               unsigned thread,
+               std::chrono::steady_clock::time_point deadline,
+               ThreadResult *result) {
+  std::vector<int> fds;
+  for (unsigned f = 0; f < job.nrfiles; ++f) {
+    fds.push_back(target->Open(FileName(job, thread, f), O_RDWR, 0644));
+  }
+  std::vector<char> buffer(job.bs);
+  std::mt19937_64 random(thread + 1);
+  for (char &c : buffer) {
+    c = static_cast<char>(random());
+  }
+  std::vector<unsigned> unsynced(job.nrfiles, 0);
+  bool sequential = job.rw.compare(0, 4, "rand") != 0;
+  bool reads = job.rw != "write" && job.rw != "randwrite";
+  bool writes = job.rw != "read" && job.rw != "randread";
+  uint64_t blocks = std::max<uint64_t>(job.size / job.bs, 1);
+  unsigned file = 0;
+  uint64_t block = 0;
+
+  for (uint64_t io = 0; job.number_ios == 0 || io < job.number_ios; ++io) {
+    auto start = std::chrono::steady_clock::now();
+    if (start >= deadline) {
+      break;
+    }
+    bool read = reads && (!writes || random() % 100 < job.rwmixread);
+    if (sequential) {
+      if (block == blocks) {
+        block = 0;
+        file = (file + 1) % job.nrfiles;
+      }
+    } else {
+      file = random() % job.nrfiles;
+      block = picker.Pick(&random);
+    }
+    int fd = fds[file];
+    off_t offset = static_cast<off_t>(block * job.bs);
+    size_t length = std::min<uint64_t>(job.bs, job.size - std::min<uint64_t>(offset, job.size));
+    ssize_t done = read ? target->PRead(fd, buffer.data(), length, offset)
+                        : target->PWrite(fd, buffer.data(), length, offset);
+    auto finish = std::chrono::steady_clock::now();
+    auto nanos = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count());
+    if (done < 0) {
+      ++result->errors;
+    } else if (read) {
+      result->read.Record(nanos);
+      result->read_bytes += done;
+    } else {
+      result->write.Record(nanos);
+      result->write_bytes += done;
+    }
+    if (!read && job.fsync && ++unsynced[file] == job.fsync) {
+      unsynced[file] = 0;
+      start = std::chrono::steady_clock::now();
+      if (target->FSync(fd) < 0) {
+        ++result->errors;
+      }
+      finish = std::chrono::steady_clock::now();
+      result->fsync.Record(static_cast<uint64_t>(
+                               std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count()));
+    }
+    if (sequential) {
+      ++block;
+    }
+  }
+  for (int fd : fds) {
+    target->Close(fd);
+  }
+}
+
+void WriteDirection(std::ostream &out, const char *name, const kvfs::LatencyHistogram &latency, uint64_t bytes,
+                    double seconds) {
+  out << "    \"" << name << "\": {\"ios\": " << latency.Count() << ", \"bytes\": " << bytes
+      << ", \"iops\": " << (seconds > 0 ? latency.Count() / seconds : 0)
+      << ", \"bw_bytes\": " << (seconds > 0 ? bytes / seconds : 0) << ", \"lat_us\": ";
+  latency.WriteJson(out);
+  out << "}";
+}
+
+bool RunJob(const Job &job, std::ostream &out) {
+  std::unique_ptr<BenchTarget> target;
+  if (job.ioengine == "kvfs") {
+    target = std::make_unique<KvfsTarget>(job.directory.empty() ? "/tmp/kvfs_bench/" : job.directory);
+  } else {
+    target = std::make_unique<HostTarget>(job.directory.empty() ? "/tmp" : job.directory);
+  }
+  unsigned threads = job.numjobs;
+  if (!target->ThreadSafe() && threads > 1) {
+    std::cerr << job.name << ": kvfs was built without BuildWithThreadSafety, running 1 thread instead of "
+              << threads << "\n";
+    threads = 1;
+  }
+  if (!LayOut(target.get(), job, threads)) {
+    std::cerr << job.name << ": laying out the files failed\n";
+    target->Destroy();
+    return false;
+  }
+
+  OffsetPicker picker(job, std::max<uint64_t>(job.size / job.bs, 1));
+  std::vector<ThreadResult> results(threads);
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(job.runtime));
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back(RunThread, target.get(), std::cref(job), std::cref(picker), t, deadline, &results[t]);
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  ThreadResult total;
+  for (const ThreadResult &result : results) {
+    total.read.Add(result.read);
+    total.write.Add(result.write);
+    total.fsync.Add(result.fsync);
+    total.read_bytes += result.read_bytes;
+    total.write_bytes += result.write_bytes;
+    total.errors += result.errors;
+  }
+  for (unsigned t = 0; t < threads; ++t) {
+    for (unsigned f = 0; f < job.nrfiles; ++f) {
+      target->UnLink(FileName(job, t, f));
+    }
+  }
+  target->Destroy();
+
+  out << "  {\n    \"jobname\": \"" << job.name << "\", \"ioengine\": \"" << job.ioengine << "\", \"rw\": \""
+      << job.rw << "\", \"bs\": " << job.bs << ", \"size\": " << job.size << ", \"nrfiles\": " << job.nrfiles
+      << ", \"numjobs\": " << threads << ", \"rwmixread\": " << job.rwmixread << ", \"random_distribution\": \""
+      << job.random_distribution << "\", \"fsync\": " << job.fsync << ",\n    \"runtime_s\": " << seconds
+      << ", \"errors\": " << total.errors << ",\n";
+  WriteDirection(out, "read", total.read, total.read_bytes, seconds);
+  out << ",\n";
+  WriteDirection(out, "write", total.write, total.write_bytes, seconds);
+  out << ",\n    \"fsync\": {\"ios\": " << total.fsync.Count() << ", \"lat_us\": ";
+  total.fsync.WriteJson(out);
+  out << "}\n  }";
+  return true;
+}
+
+void Usage(const char *program) {
+  std::cerr << "Usage: " << program << " [--name=job] [--ioengine=kvfs|host] [--directory=path] [--numjobs=n]\n"
+            << "    [--nrfiles=n] [--size=64m] [--bs=4k] [--rw=read|write|rw|randread|randwrite|randrw]\n"
+            << "    [--rwmixread=50] [--random_distribution=random|zipf:theta] [--fsync=n] [--runtime=10]\n"
+            << "    [--number_ios=n] [--output=file.json] [jobfile ...]\n"
+            << "Options given before the job files are the defaults of their jobs.\n";
+}
+
+int main(int argc, char **argv) {
+  static const option kOptions[] = {
+      {"name", required_argument, nullptr, 0},
+      {"ioengine", required_argument, nullptr, 0},
+      {"directory", required_argument, nullptr, 0},
+      {"numjobs", required_argument, nullptr, 0},
+      {"nrfiles", required_argument, nullptr, 0},
+      {"size", required_argument, nullptr, 0},
+      {"bs", required_argument, nullptr, 0},
+      {"rw", required_argument, nullptr, 0},
+      {"readwrite", required_argument, nullptr, 0},
+      {"rwmixread", required_argument, nullptr, 0},
+      {"random_distribution", required_argument, nullptr, 0},
+      {"fsync", required_argument, nullptr, 0},
+      {"runtime", required_argument, nullptr, 0},
+      {"number_ios", required_argument, nullptr, 0},
+      {"output", required_argument, nullptr, 0},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+
+  Job defaults;
+  std::string output;
+  std::vector<Job> jobs;
+  try {
+    int index;
+    int rvalue;
+    while ((rvalue = getopt_long(argc, argv, "h", kOptions, &index)) != -1) {
+      if (rvalue != 0) {
+        Usage(argv[0]);
+        return rvalue == 'h' ? 0 : 1;
+      }
+      std::string key = kOptions[index].name;
+      if (key == "output") {
+        output = optarg;
+      } else {
+        SetOption(&defaults, key, optarg);
+      }
+    }
+    for (int i = optind; i < argc; ++i) {
+      ParseJobFile(argv[i], defaults, &jobs);
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n";
+    Usage(argv[0]);
+    return 1;
+  }
+  if (jobs.empty()) {
+    jobs.push_back(defaults);
+  }
+
+  std::ostringstream json;
+  json << "{\"jobs\": [\n";
+  bool ok = true;
+  bool first = true;
+  for (const Job &job : jobs) {
+    std::ostringstream result;
+    if (!RunJob(job, result)) {
+      ok = false;
+      continue;
+    }
+    json << (first ? "" : ",\n") << result.str();
+    first = false;
+  }
+  json << "\n]}\n";
+  if (output.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream(output) << json.str();
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   kvfs_mdtest.cpp
+ */
+
+#include "bench_target.h"
+#include <kvfs/latency_histogram.h>
+#include <getopt.h>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// An mdtest-like driver for metadata rates: each thread builds a tree of directories depth levels deep,
+// with branch subdirectories in each directory and items files in every one of them, then stats, opens,
+// lists, renames and removes what it made, one phase after the other.
+//
+//   kvfs_mdtest --depth=2 --branch=8 --items=100 --threads=4
+//   kvfs_mdtest --shared --depth=0 --items=5000 --threads=8
+//   kvfs_mdtest --ioengine=host --directory=/mnt/scratch
+//
+// With --shared all threads work in one tree, made and removed by the first thread, with files of their
+// own in each directory; --depth=0 has them all contend for a single directory.
+// The results are written as JSON, one object per phase, with the rate and latency percentiles of its
+// operations and, on kvfs, the calls made to the store per operation.
+
+struct Config {
+  // kvfs or host
+  std::string ioengine = "kvfs";
+  // mount path of kvfs, whose store is destroyed after the run, or the directory on the host file system
+  // the run makes its tree in; a default for either if empty
+  std::string directory;
+  unsigned depth = 2;
+  unsigned branch = 4;
+  unsigned items = 64;
+  unsigned threads = 1;
+  bool shared = false;
+};
+
+struct ThreadResult {
+  kvfs::LatencyHistogram latency;
+  uint64_t errors = 0;
+  // readdir only, the entries listed
+  uint64_t entries = 0;
+};
+
+// the directories of a tree, parents before their children
+std::vector<std::string> TreeDirs(const std::string &root, unsigned depth, unsigned branch) {
+  std::vector<std::string> dirs{root};
+  size_t level_start = 0;
+  for (unsigned level = 0; level < depth; ++level) {
+    size_t level_end = dirs.size();
+    for (size_t parent = level_start; parent < level_end; ++parent) {
+      for (unsigned child = 0; child < branch; ++child) {
+        dirs.push_back(dirs[parent] + "/d" + std::to_string(child));
+      }
+    }
+    level_start = level_end;
+  }
+  return dirs;
+}
+
+std::string FilePath(const std::string &dir, unsigned thread, unsigned item, bool renamed) {
+  return dir + "/f" + std::to_string(thread) + "." + std::to_string(item) + (renamed ? ".r" : "");
+}
+
+// times one operation, which failed if it returned less than 0
+template<typename Function>
+void Timed(ThreadResult *result, Function function) {
+  auto start = std::chrono::steady_clock::now();
+  int done = function();
+  auto finish = std::chrono::steady_clock::now();
+  if (done < 0) {
+    ++result->errors;
+    return;
+  }
+  result->latency.Record(static_cast<uint64_t>(
+                             std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count()));
+  result->entries += done;
+}
+
+class MdTest {
+ public:
+  MdTest(const Config &config, BenchTarget *target, unsigned threads)
+      : config_(config), target_(target), threads_(threads), first_(true) {
+    for (unsigned t = 0; t < (config.shared ? 1 : threads); ++t) {
+      trees_.push_back(TreeDirs(config.shared ? "/mdtest" : "/mdtest." + std::to_string(t),
+                                config.depth,
+                                config.branch));
+    }
+  }
+
+  void Run(std::ostream &out) {
+    // in a shared tree only the first thread makes and removes the directories
+    unsigned tree_threads = config_.shared ? 1 : threads_;
+    Phase(out, "dir_create", tree_threads, [this](unsigned t, ThreadResult *result) {
+      for (const std::string &dir : Tree(t)) {
+        Timed(result, [&] { return target_->MkDir(dir, 0755); });
+      }
+    });
+    Phase(out, "file_create", threads_, [this](unsigned t, ThreadResult *result) {
+      ForEachFile(t, false, [&](const std::string &path) {
+        Timed(result, [&] {
+          int fd = target_->Open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+          return fd < 0 ? fd : target_->Close(fd);
+        });
+      });
+    });
+    Phase(out, "file_stat", threads_, [this](unsigned t, ThreadResult *result) {
+      ForEachFile(t, false, [&](const std::string &path) {
+        Timed(result, [&] { return target_->Stat(path); });
+      });
+    });
+    Phase(out, "file_open_close", threads_, [this](unsigned t, ThreadResult *result) {
+      ForEachFile(t, false, [&](const std::string &path) {
+        Timed(result, [&] {
+          int fd = target_->Open(path, O_RDONLY, 0);
+          return fd < 0 ? fd : target_->Close(fd);
+        });
+      });
+    });
+    // in a shared tree every thread lists every directory
+    Phase(out, "dir_readdir", threads_, [this](unsigned t, ThreadResult *result) {
+      for (const std::string &dir : Tree(t)) {
+        Timed(result, [&] { return target_->ReadDir(dir); });
+      }
+    });
+    Phase(out, "file_rename", threads_, [this](unsigned t, ThreadResult *result) {
+      ForEachFile(t, false, [&](const std::string &path) {
+        Timed(result, [&] { return target_->Rename(path, path + ".r"); });
+      });
+    });
+    Phase(out, "file_unlink", threads_, [this](unsigned t, ThreadResult *result) {
+      ForEachFile(t, true, [&](const std::string &path) {
+        Timed(result, [&] { return target_->UnLink(path); });
+      });
+    });
+    Phase(out, "dir_remove", tree_threads, [this](unsigned t, ThreadResult *result) {
+      const std::vector<std::string> &dirs = Tree(t);
+      for (auto dir = dirs.rbegin(); dir != dirs.rend(); ++dir) {
+        Timed(result, [&] { return target_->RmDir(*dir); });
+      }
+    });
+  }
+
+ private:
+  const Config &config_;
+  BenchTarget *target_;
+  unsigned threads_;
+  std::vector<std::vector<std::string>> trees_;
+  bool first_;
+
+  const std::vector<std::string> &Tree(unsigned thread) const {
+    return trees_[config_.shared ? 0 : thread];
+  }
+
+  void ForEachFile(unsigned thread, bool renamed, const std::function<void(const std::string &)> &visit) const {
+    for (const std::string &dir : Tree(thread)) {
+      for (unsigned item = 0; item < config_.items; ++item) {
+        visit(FilePath(dir, thread, item, renamed));
+      }
+    }
+  }
+
+  void Phase(std::ostream &out,
+             const char *name,
+             unsigned threads,
+             const std::function<void(unsigned, ThreadResult *)> &work) {
+    kvfs_store_calls before;
+    bool counted = target_->StoreCalls(&before);
+    std::vector<ThreadResult> results(threads);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t) {
+      workers.emplace_back(work, t, &results[t]);
+    }
+    for (std::thread &worker : workers) {
+      worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    kvfs_store_calls after;
+    target_->StoreCalls(&after);
+
+    ThreadResult total;
+    for (const ThreadResult &result : results) {
+      total.latency.Add(result.latency);
+      total.errors += result.errors;
+      total.entries += result.entries;
+    }
+    uint64_t ops = total.latency.Count() + total.errors;
+    out << (first_ ? "" : ",\n") << "    {\"phase\": \"" << name << "\", \"threads\": " << threads
+        << ", \"ops\": " << ops << ", \"errors\": " << total.errors << ", \"seconds\": " << seconds
+        << ", \"ops_per_s\": " << (seconds > 0 ? ops / seconds : 0);
+    if (std::string(name) == "dir_readdir") {
+      out << ", \"entries\": " << total.entries;
+    }
+    out << ",\n     \"lat_us\": ";
+    total.latency.WriteJson(out);
+    if (counted) {
+      auto per_op = [ops](uint64_t calls) { return ops ? static_cast<double>(calls) / ops : 0.0; };
+      out << ",\n     \"store_per_op\": {\"gets\": " << per_op(after.gets - before.gets)
+          << ", \"seeks\": " << per_op(after.seeks - before.seeks)
+          << ", \"nexts\": " << per_op(after.nexts - before.nexts)
+          << ", \"puts\": " << per_op(after.puts - before.puts)
+          << ", \"deletes\": " << per_op(after.deletes - before.deletes)
+          << ", \"writes\": " << per_op(after.writes - before.writes)
+          << ", \"syncs\": " << per_op(after.syncs - before.syncs) << "}";
+    }
+    out << "}";
+    first_ = false;
+  }
+};
+
+void Usage(const char *program) {
+  std::cerr << "Usage: " << program << " [--ioengine=kvfs|host] [--directory=path] [--depth=2] [--branch=4]\n"
+            << "    [--items=64] [--threads=1] [--shared] [--output=file.json]\n";
+}
+
+int main(int argc, char **argv) {
+  static const option kOptions[] = {
+      {"ioengine", required_argument, nullptr, 0},
+      {"directory", required_argument, nullptr, 0},
+      {"depth", required_argument, nullptr, 0},
+      {"branch", required_argument, nullptr, 0},
+      {"items", required_argument, nullptr, 0},
+      {"threads", required_argument, nullptr, 0},
+      {"shared", no_argument, nullptr, 0},
+      {"output", required_argument, nullptr, 0},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+
+  Config config;
+  std::string output;
+  try {
+    int index;
+    int rvalue;
+    while ((rvalue = getopt_long(argc, argv, "h", kOptions, &index)) != -1) {
+      if (rvalue != 0) {
+        Usage(argv[0]);
+        return rvalue == 'h' ? 0 : 1;
+      }
+      std::string key = kOptions[index].name;
+      if (key == "ioengine") {
+        if (std::string(optarg) != "kvfs" && std::string(optarg) != "host") {
+          throw std::invalid_argument("ioengine is kvfs or host");
+        }
+        config.ioengine = optarg;
+      } else if (key == "directory") {
+        config.directory = optarg;
+      } else if (key == "depth") {
+        config.depth = std::stoul(optarg);
+      } else if (key == "branch") {
+        config.branch = std::max(std::stoul(optarg), 1ul);
+      } else if (key == "items") {
+        config.items = std::stoul(optarg);
+      } else if (key == "threads") {
+        config.threads = std::max(std::stoul(optarg), 1ul);
+      } else if (key == "shared") {
+        config.shared = true;
+      } else if (key == "output") {
+        output = optarg;
+      }
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n";
+    Usage(argv[0]);
+    return 1;
+  }
+
+  std::unique_ptr<BenchTarget> target;
+  if (config.ioengine == "kvfs") {
+    target = std::make_unique<KvfsTarget>(config.directory.empty() ? "/tmp/kvfs_mdtest/" : config.directory);
+  } else {
+    target = std::make_unique<HostTarget>(config.directory.empty() ? "/tmp" : config.directory);
+  }
+  unsigned threads = config.threads;
+  if (!target->ThreadSafe() && threads > 1) {
+    std::cerr << "kvfs was built without BuildWithThreadSafety, running 1 thread instead of " << threads << "\n";
+    threads = 1;
+  }
+
+  std::ostringstream json;
+  json << "{\"ioengine\": \"" << config.ioengine << "\", \"depth\": " << config.depth << ", \"branch\": "
+       << config.branch << ", \"items\": " << config.items << ", \"threads\": " << threads << ", \"shared\": "
+       << (config.shared ? "true" : "false") << ",\n  \"phases\": [\n";
+  MdTest test(config, target.get(), threads);
+  test.Run(json);
+  json << "\n  ]}\n";
+  target->Destroy();
+
+  if (output.empty()) {
+    std::cout << json.str();
+  } else {
+    std::ofstream(output) << json.str();
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   fs_async_queue_test.cpp
+ */
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <kvfs/async_queue.h>
+#include <random>
+
+// kFiles files of kFileSize bytes, read and written kIOSize bytes at a time at random offsets
+const int kFiles = 16;
+const size_t kFileSize = 1 << 20;
+const size_t kIOSize = 4096;
+const int kReads = 20000;
+const int kWrites = 2000;
+
+// keeps depth requests in flight until total have completed, make fills in the request for number i
+template<typename Make>
+int64_t RunAtDepth(kvfs::AsyncQueue *queue, size_t depth, int total, Make make) {
+  std::vector<kvfs_io_request> requests(depth);
+  std::vector<kvfs_io_completion> completions(depth);
+  int submitted = 0;
+  int completed = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  while (completed < total) {
+    size_t room = std::min(depth - queue->InFlight(), static_cast<size_t>(total - submitted));
+    for (size_t i = 0; i < room; ++i) {
+      make(submitted + static_cast<int>(i), &requests[i]);
+    }
+    submitted += static_cast<int>(queue->Submit(requests.data(), room));
+    size_t reaped = queue->Wait(completions.data(), completions.size(), 1);
+    for (size_t i = 0; i < reaped; ++i) {
+      if (completions[i].result < 0) {
+        std::cout << "request " << completions[i].user_data << " failed with " << completions[i].result << "\n";
+      }
+    }
+    completed += static_cast<int>(reaped);
+  }
+  auto finish = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+}
+
+int main() {
+  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>();
+  fs_->MkDir("/async", 0755);
+
+  std::string block(kIOSize, 'a');
+  std::vector<int> fds(kFiles);
+  for (int i = 0; i < kFiles; ++i) {
+    std::string name = "/async/file" + std::to_string(i);
+    fds[i] = fs_->Open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    for (size_t offset = 0; offset < kFileSize; offset += kIOSize) {
+      fs_->PWrite(fds[i], block.data(), block.size(), offset);
+    }
+  }
+
+  std::mt19937 random(42);
+  std::vector<std::pair<int, off_t>> targets(kReads);
+  for (auto &target : targets) {
+    target = {fds[random() % kFiles], static_cast<off_t>(random() % (kFileSize / kIOSize) * kIOSize)};
+  }
+  std::vector<std::string> buffers(64, std::string(kIOSize, '\0'));
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (const auto &target : targets) {
+    fs_->PRead(target.first, &buffers[0][0], kIOSize, target.second);
+  }
+  auto finish = std::chrono::high_resolution_clock::now();
+  auto baseline = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << "PRead of " << kReads << " random " << kIOSize << " byte blocks for " << baseline << "us, "
+            << (baseline ? kReads * 1000000L / baseline : 0) << " IOPS\n";
+
+  {
+    kvfs::AsyncQueue queue(fs_.get());
+    for (size_t depth = 1; depth <= 64; depth *= 2) {
+      auto elapsed = RunAtDepth(&queue, depth, kReads, [&](int i, kvfs_io_request *request) {
+        request->opcode = KVFS_IO_READ;
+        request->fd = targets[i].first;
+        request->buffer = &buffers[i % 64][0];
+        request->size = kIOSize;
+        request->offset = targets[i].second;
+        request->user_data = i;
+      });
+      std::cout << "Queue depth " << depth << ": " << kReads << " reads for " << elapsed << "us, "
+                << (elapsed ? kReads * 1000000L / elapsed : 0) << " IOPS, "
+                << (elapsed ? static_cast<double>(baseline) / elapsed : 0) << "x PRead\n";
+    }
+
+    // every other request an fsync of the file just written, fsyncs taken together are run once
+    for (size_t depth = 1; depth <= 64; depth *= 2) {
+      auto elapsed = RunAtDepth(&queue, depth, kWrites, [&](int i, kvfs_io_request *request) {
+        request->opcode = i % 2 ? KVFS_IO_FSYNC : KVFS_IO_WRITE;
+        request->fd = targets[i / 2].first;
+        request->buffer = &block[0];
+        request->size = kIOSize;
+        request->offset = targets[i / 2].second;
+        request->user_data = i;
+      });
+      std::cout << "Queue depth " << depth << ": " << kWrites / 2 << " writes and fsyncs for " << elapsed << "us, "
+                << (elapsed ? kWrites * 1000000L / elapsed : 0) << " IOPS\n";
+    }
+  }
+
+  for (int fd : fds) {
+    fs_->Close(fd);
+  }
+  fs_->DestroyFS();
+  fs_.reset();
+  return 0;
+}
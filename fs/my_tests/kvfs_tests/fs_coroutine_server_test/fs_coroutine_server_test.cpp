@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   fs_coroutine_server_test.cpp
+ */
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <kvfs/async_fs.h>
+#include <atomic>
+#include <condition_variable>
+
+// a file server: every request stats one of kFiles files, reads a block of it and echoes the block
+// into the reply file of its client
+const int kFiles = 64;
+const size_t kBlocks = 64;
+const size_t kBlockSize = 4096;
+const int kRequests = 40000;
+
+struct Server {
+  FS *fs;
+  std::vector<std::string> names;
+  std::vector<int> files;
+  std::vector<int> replies;
+};
+
+// started eagerly and never awaited, the frame is freed when the coroutine returns
+struct Task {
+  struct promise_type {
+    Task get_return_object() {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+};
+
+struct Latch {
+  std::atomic<int> left;
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  void CountDown() {
+    if (left.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(mutex);
+      cv.notify_all();
+    }
+  }
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return left.load() == 0; });
+  }
+};
+
+void Serve(const Server &server, int client, int request, char *buffer) {
+  int file = (client * 31 + request) % kFiles;
+  kvfs_stat st{};
+  server.fs->Stat(server.names[file].c_str(), &st);
+  off_t offset = static_cast<off_t>((client + request) % kBlocks * kBlockSize);
+  ssize_t read = server.fs->PRead(server.files[file], buffer, kBlockSize, offset);
+  server.fs->PWrite(server.replies[client % kFiles], buffer, read, offset);
+}
+
+Task Client(kvfs::AsyncFS *async, const Server *server, int client, int requests, Latch *done) {
+  char buffer[kBlockSize];
+  for (int request = 0; request < requests; ++request) {
+    int file = (client * 31 + request) % kFiles;
+    kvfs_stat st{};
+    if (co_await async->StatAsync(server->names[file].c_str(), &st) < 0) {
+      std::cout << "stat of " << server->names[file] << " failed\n";
+    }
+    off_t offset = static_cast<off_t>((client + request) % kBlocks * kBlockSize);
+    ssize_t read = co_await async->ReadAsync(server->files[file], buffer, kBlockSize, offset);
+    if (read != static_cast<ssize_t>(kBlockSize)) {
+      std::cout << "read of " << server->names[file] << " returned " << read << "\n";
+    }
+    co_await async->WriteAsync(server->replies[client % kFiles], buffer, kBlockSize, offset);
+  }
+  done->CountDown();
+}
+
+int main() {
+  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>();
+  fs_->MkDir("/srv", 0755);
+  fs_->MkDir("/replies", 0755);
+
+  Server server{fs_.get()};
+  std::string block(kBlockSize, 'a');
+  for (int i = 0; i < kFiles; ++i) {
+    server.names.push_back("/srv/file" + std::to_string(i));
+    int fd = fs_->Open(server.names.back().c_str(), O_CREAT | O_RDWR, 0644);
+    std::string reply = "/replies/client" + std::to_string(i);
+    int reply_fd = fs_->Open(reply.c_str(), O_CREAT | O_WRONLY, 0644);
+    // replies overwrite blocks, writes past the end of a file are not allowed
+    for (size_t b = 0; b < kBlocks; ++b) {
+      fs_->PWrite(fd, block.data(), block.size(), b * kBlockSize);
+      fs_->PWrite(reply_fd, block.data(), block.size(), b * kBlockSize);
+    }
+    server.files.push_back(fd);
+    server.replies.push_back(reply_fd);
+  }
+
+  char buffer[kBlockSize];
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int request = 0; request < kRequests; ++request) {
+    Serve(server, request % 1024, request / 1024, buffer);
+  }
+  auto finish = std::chrono::high_resolution_clock::now();
+  auto baseline = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << "Blocking calls served " << kRequests << " requests for " << baseline << "us, "
+            << (baseline ? kRequests * 1000000L / baseline : 0) << " requests/s\n";
+
+  for (int clients = 16; clients <= 4096; clients *= 4) {
+    // before async, the last client still holds it while the workers are joined
+    Latch done{{clients}};
+    kvfs_async_options options;
+    options.entries = clients;
+    kvfs::AsyncFS async(fs_.get(), options);
+    start = std::chrono::high_resolution_clock::now();
+    for (int client = 0; client < clients; ++client) {
+      Client(&async, &server, client, kRequests / clients, &done);
+    }
+    done.Wait();
+    finish = std::chrono::high_resolution_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+    int served = kRequests / clients * clients;
+    std::cout << clients << " coroutines served " << served << " requests for " << elapsed << "us, "
+              << (elapsed ? served * 1000000L / elapsed : 0) << " requests/s, "
+              << (elapsed ? static_cast<double>(baseline) * served / kRequests / elapsed : 0) << "x blocking\n";
+  }
+
+  for (int i = 0; i < kFiles; ++i) {
+    fs_->Close(server.files[i]);
+    fs_->Close(server.replies[i]);
+  }
+  fs_->DestroyFS();
+  fs_.reset();
+  return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   fs_dataloader_test.cpp
+ */
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <random>
+
+// a data set of kShards directories with kSamples small files each, read in random batches the way
+// a training data loader samples it
+const int kShards = 64;
+const int kSamples = 256;
+const size_t kMinSampleSize = 512;
+const size_t kMaxSampleSize = 8192;
+const size_t kBatchSize = 256;
+const int kSteps = 40;
+
+std::string SamplePath(int shard, int sample) {
+  return "/dataset/shard" + std::to_string(shard) + "/sample" + std::to_string(sample);
+}
+
+int main() {
+  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>();
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> size_dist(kMinSampleSize, kMaxSampleSize);
+
+  fs_->MkDir("/dataset", 0755);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int shard = 0; shard < kShards; ++shard) {
+    std::string dir = "/dataset/shard" + std::to_string(shard);
+    fs_->MkDir(dir.c_str(), 0755);
+    std::vector<std::string> names(kSamples);
+    std::vector<std::string> contents(kSamples);
+    std::vector<kvfs_create_entry> entries(kSamples);
+    for (int sample = 0; sample < kSamples; ++sample) {
+      names[sample] = "sample" + std::to_string(sample);
+      contents[sample] = std::string(size_dist(gen), static_cast<char>('a' + sample % 26));
+      entries[sample] = {names[sample].c_str(), 0644, contents[sample].data(), contents[sample].size()};
+    }
+    fs_->CreateFilesBatch(dir.c_str(), entries.data(), entries.size());
+  }
+  auto finish = std::chrono::high_resolution_clock::now();
+  std::cout << "Created " << kShards * kSamples << " samples for "
+            << std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() << "us\n";
+
+  // the same random batches are used by every loader
+  std::uniform_int_distribution<int> shard_dist(0, kShards - 1);
+  std::uniform_int_distribution<int> sample_dist(0, kSamples - 1);
+  std::vector<std::vector<std::string>> batches(kSteps);
+  for (std::vector<std::string> &batch : batches) {
+    for (size_t i = 0; i < kBatchSize; ++i) {
+      batch.push_back(SamplePath(shard_dist(gen), sample_dist(gen)));
+    }
+  }
+  std::vector<std::string> buffers(kBatchSize, std::string(kMaxSampleSize, '\0'));
+  const size_t samples = kSteps * kBatchSize;
+
+  start = std::chrono::high_resolution_clock::now();
+  for (const std::vector<std::string> &batch : batches) {
+    for (const std::string &path : batch) {
+      kvfs_stat buf{};
+      fs_->Stat(path.c_str(), &buf);
+    }
+  }
+  finish = std::chrono::high_resolution_clock::now();
+  auto stat_loop = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << "Stat loop: " << samples << " samples for " << stat_loop << "us\n";
+
+  start = std::chrono::high_resolution_clock::now();
+  for (const std::vector<std::string> &batch : batches) {
+    std::vector<const char *> paths;
+    for (const std::string &path : batch) {
+      paths.push_back(path.c_str());
+    }
+    std::vector<kvfs_stat> bufs(kBatchSize);
+    std::vector<int> errors(kBatchSize);
+    fs_->StatMany(paths.data(), paths.size(), bufs.data(), errors.data());
+  }
+  finish = std::chrono::high_resolution_clock::now();
+  auto stat_many = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << "StatMany: " << samples << " samples for " << stat_many << "us, "
+            << (stat_many ? static_cast<double>(stat_loop) / stat_many : 0) << "x the loop\n";
+
+  start = std::chrono::high_resolution_clock::now();
+  uint64_t bytes = 0;
+  for (const std::vector<std::string> &batch : batches) {
+    for (size_t i = 0; i < batch.size(); ++i) {
+      int fd = fs_->Open(batch[i].c_str(), O_RDONLY, 0);
+      bytes += fs_->Read(fd, &buffers[i][0], kMaxSampleSize);
+      fs_->Close(fd);
+    }
+  }
+  finish = std::chrono::high_resolution_clock::now();
+  auto read_loop = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << "Open/Read/Close loop: " << samples << " samples, " << bytes << " bytes for " << read_loop << "us\n";
+
+  start = std::chrono::high_resolution_clock::now();
+  bytes = 0;
+  for (const std::vector<std::string> &batch : batches) {
+    std::vector<const char *> paths;
+    std::vector<void *> bufs;
+    for (size_t i = 0; i < batch.size(); ++i) {
+      paths.push_back(batch[i].c_str());
+      bufs.push_back(&buffers[i][0]);
+    }
+    std::vector<size_t> sizes(kBatchSize, kMaxSampleSize);
+    std::vector<ssize_t> read(kBatchSize);
+    fs_->ReadFilesMany(paths.data(), paths.size(), bufs.data(), sizes.data(), read.data());
+    for (ssize_t r : read) {
+      bytes += r > 0 ? r : 0;
+    }
+  }
+  finish = std::chrono::high_resolution_clock::now();
+  auto read_many = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << "ReadFilesMany: " << samples << " samples, " << bytes << " bytes for " << read_many << "us, "
+            << (read_many ? static_cast<double>(read_loop) / read_many : 0) << "x the loop\n";
+
+  fs_->DestroyFS();
+  fs_.reset();
+  return 0;
+}
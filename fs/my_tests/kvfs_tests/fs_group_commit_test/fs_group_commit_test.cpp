@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   fs_group_commit_test.cpp
+ */
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <atomic>
+#include <thread>
+
+// every thread overwrites the blocks of a file of its own kBlocks times over, each write made durable
+// before the next one, either by an fsync after it or by writing through an O_SYNC descriptor
+const int kBlocks = 64;
+const int kRounds = 4;
+const size_t kBlockSize = 4096;
+
+size_t RunWriter(FS *fs, const std::string &name, bool osync, int thread) {
+  std::string data(kBlockSize, static_cast<char>('a' + thread % 26));
+  int fd = fs->Open(name.c_str(), O_CREAT | O_WRONLY, 0644);
+  for (int b = 0; b < kBlocks; ++b) {
+    fs->PWrite(fd, data.data(), data.size(), b * kBlockSize);
+  }
+  fs->Close(fd);
+  fd = fs->Open(name.c_str(), O_WRONLY | (osync ? O_SYNC : 0), 0644);
+  size_t commits = 0;
+  for (int round = 0; round < kRounds; ++round) {
+    for (int b = 0; b < kBlocks; ++b) {
+      fs->PWrite(fd, data.data(), data.size(), b * kBlockSize);
+      if (!osync) {
+        fs->FSync(fd);
+      }
+      ++commits;
+    }
+  }
+  fs->Close(fd);
+  return commits;
+}
+
+void RunRound(FS *fs, unsigned threads, bool osync, const std::string &root) {
+  fs->MkDir(root.c_str(), 0755);
+  std::atomic<size_t> commits{0};
+  std::vector<std::thread> workers;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (unsigned i = 0; i < threads; ++i) {
+    std::string name = root + "/file" + std::to_string(i);
+    workers.emplace_back([&, name, i] {
+      commits.fetch_add(RunWriter(fs, name, osync, i), std::memory_order_relaxed);
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  auto finish = std::chrono::high_resolution_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << threads << " threads, " << (osync ? "O_SYNC writes" : "write and fsync") << ": "
+            << commits.load() << " durable writes for " << elapsed << "us, "
+            << (elapsed ? commits.load() * 1000000 / elapsed : 0) << " writes/s\n";
+}
+
+// one tenant fsyncs its file while kNoisyFiles other open files are kept dirty, between two fsyncs
+// each of kNoisyWrites of them is written again
+const int kNoisyFiles = 400;
+const int kNoisyWrites = 16;
+
+void RunTenant(FS *fs, const std::string &root) {
+  fs->MkDir(root.c_str(), 0755);
+  std::string data(kBlockSize, 'n');
+  std::vector<int> noisy;
+  for (int i = 0; i < kNoisyFiles; ++i) {
+    std::string name = root + "/noisy" + std::to_string(i);
+    noisy.push_back(fs->Open(name.c_str(), O_CREAT | O_WRONLY, 0644));
+    fs->PWrite(noisy.back(), data.data(), data.size(), 0);
+  }
+  std::string name = root + "/tenant";
+  int fd = fs->Open(name.c_str(), O_CREAT | O_WRONLY, 0644);
+  fs->PWrite(fd, data.data(), data.size(), 0);
+  int64_t total = 0;
+  int64_t worst = 0;
+  int next = 0;
+  for (int i = 0; i < kBlocks * kRounds; ++i) {
+    for (int w = 0; w < kNoisyWrites; ++w) {
+      fs->PWrite(noisy[next], data.data(), data.size(), 0);
+      next = (next + 1) % kNoisyFiles;
+    }
+    fs->PWrite(fd, data.data(), data.size(), 0);
+    auto start = std::chrono::high_resolution_clock::now();
+    fs->FSync(fd);
+    auto finish = std::chrono::high_resolution_clock::now();
+    int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+    total += elapsed;
+    worst = std::max(worst, elapsed);
+  }
+  std::cout << "fsync of one file among " << kNoisyFiles << " dirty open files: " << total / (kBlocks * kRounds)
+            << "us average, " << worst << "us worst\n";
+  fs->Close(fd);
+  for (int noisy_fd : noisy) {
+    fs->Close(noisy_fd);
+  }
+}
+
+int main() {
+  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>();
+#if !KVFS_THREAD_SAFE
+  std::cout << "Built without BuildWithThreadSafety, running a single thread only\n";
+  RunRound(fs_.get(), 1, false, "/fsync");
+  RunRound(fs_.get(), 1, true, "/osync");
+#else
+  // the threads mostly wait for syncs, so there are more of them than cores
+  int round = 0;
+  for (unsigned threads = 1; threads <= 32; threads *= 2) {
+    RunRound(fs_.get(), threads, false, "/fsync" + std::to_string(round));
+    RunRound(fs_.get(), threads, true, "/osync" + std::to_string(round));
+    ++round;
+  }
+#endif
+  RunTenant(fs_.get(), "/tenant");
+  fs_->DestroyFS();
+  fs_.reset();
+  return 0;
+}
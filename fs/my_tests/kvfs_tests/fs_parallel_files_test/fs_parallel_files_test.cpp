@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   fs_parallel_files_test.cpp
+ */
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <atomic>
+#include <thread>
+
+// every thread creates, writes, reads back and stats kFiles files of kFileSize bytes
+const int kFiles = 2000;
+const size_t kFileSize = 4096;
+
+size_t RunFiles(FS *fs, const std::string &dir, int thread) {
+  std::string data(kFileSize, static_cast<char>('a' + thread % 26));
+  std::string buffer(kFileSize, '\0');
+  size_t ops = 0;
+  // every thread has a working directory of its own, names are relative to it
+  fs->ChDir(dir.c_str());
+  for (int i = 0; i < kFiles; ++i) {
+    std::string name = "t" + std::to_string(thread) + "_" + std::to_string(i);
+    int fd = fs->Open(name.c_str(), O_CREAT | O_WRONLY, 0644);
+    fs->Write(fd, data.data(), data.size());
+    fs->Close(fd);
+    fd = fs->Open(name.c_str(), O_RDONLY, 0);
+    fs->Read(fd, &buffer[0], buffer.size());
+    fs->Close(fd);
+    kvfs_stat buf{};
+    fs->Stat(name.c_str(), &buf);
+    if (buffer != data || buf.st_size != static_cast<off_t>(kFileSize)) {
+      std::cerr << "Mismatch on " << name << "\n";
+    }
+    ops += 3;
+  }
+  return ops;
+}
+
+// shared == false gives each thread a directory of its own, otherwise all of them create in one
+void RunRound(FS *fs, unsigned threads, bool shared, const std::string &root) {
+  fs->MkDir(root.c_str(), 0755);
+  std::vector<std::string> dirs(threads, root);
+  if (!shared) {
+    for (unsigned i = 0; i < threads; ++i) {
+      dirs[i] = root + "/dir" + std::to_string(i);
+      fs->MkDir(dirs[i].c_str(), 0755);
+    }
+  }
+  std::atomic<size_t> ops{0};
+  std::vector<std::thread> workers;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back([&, i] { ops.fetch_add(RunFiles(fs, dirs[i], i), std::memory_order_relaxed); });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  auto finish = std::chrono::high_resolution_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << threads << " threads, " << (shared ? "one shared directory" : "a directory each") << ": "
+            << ops.load() << " create/read/stat ops for " << elapsed << "us, "
+            << (elapsed ? ops.load() * 1000000 / elapsed : 0) << " ops/s\n";
+}
+
+int main() {
+  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>();
+#if !KVFS_THREAD_SAFE
+  std::cout << "Built without BuildWithThreadSafety, running a single thread only\n";
+  RunRound(fs_.get(), 1, false, "/single");
+#else
+  unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+  int round = 0;
+  for (unsigned threads = 1; threads <= cores * 2; threads *= 2) {
+    RunRound(fs_.get(), threads, false, "/private" + std::to_string(round));
+    RunRound(fs_.get(), threads, true, "/shared" + std::to_string(round));
+    ++round;
+  }
+#endif
+  fs_->DestroyFS();
+  fs_.reset();
+  return 0;
+}
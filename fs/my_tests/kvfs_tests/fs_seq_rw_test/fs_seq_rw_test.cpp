@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <chrono>
 #include <kvfs/fs.h>
 #include <kvfs/kvfs.h>
@@ -49,12 +50,12 @@ int main(int argc, char **argv) {
   int block_count = 10;
   int file_count = 10;
   int rvalue;
-  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>();
+  kvfs_mount_options options;
 
-  while ((rvalue = getopt(argc, argv, "h--s:c:n:d")) != -1)
+  while ((rvalue = getopt(argc, argv, "h--s:c:n:b:d")) != -1)
     switch (rvalue) {
       default:
-        printf("Usage: %s [-s blocksize] [-c blockcount] [-n filecount] [-l loopcount (float)] [-d]\n",
+        printf("Usage: %s [-s blocksize] [-c blockcount] [-n filecount] [-b writebatchbytes] [-l loopcount (float)] [-d]\n",
                argv[0]);
         exit(0);
       case 's':sscanf(optarg, "%ld", &blocksize);
@@ -63,11 +64,14 @@ int main(int argc, char **argv) {
         break;
       case 'n':sscanf(optarg, "%d", &file_count);
         break;
+      case 'b':sscanf(optarg, "%zu", &options.write_batch_bytes);
+        break;
     }
-  int file_size = blocksize * block_count;
+  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>("/tmp/db/", options);
+  int64_t file_size = blocksize * block_count;
   read_times.reserve(file_count);
   write_times.reserve(file_count);
-  printf("Creating %d files of size %d B", file_count, file_size);
+  printf("Creating %d files of size %ld B", file_count, file_size);
   printf(", total data %.2f MB\n", (double) (file_size * file_count) / (1024.0 * 1024.0));
 
   int flags = O_CREAT;
@@ -98,6 +102,9 @@ int main(int argc, char **argv) {
   auto maximum = *std::max_element(write_times.begin(), write_times.end());
   printf("Mimimum file write time; %ld\n", minimum);
   printf("Maximum file write time: %ld\n", maximum);
+  struct rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  printf("Peak RSS after writing: %ld KB\n", usage.ru_maxrss);
   printf("Reading\n");
   total_duration = 0;
   for (int &it : vec) {
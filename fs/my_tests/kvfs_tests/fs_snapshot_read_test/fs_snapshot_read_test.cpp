@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   fs_snapshot_read_test.cpp
+ */
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <atomic>
+#include <thread>
+
+// a writer rewrites the whole of a file with one byte value after the other, readers read all of it
+// and check they never see two values at once; the writer is timed alone and with the readers.
+// The test fails if a read was torn or if the readers did not overlap the writes at all.
+const int kWrites = 200;
+// the writer goes on past kWrites until the readers have read this many times
+const size_t kMinReads = 200;
+
+struct WriterTimes {
+  int64_t total = 0;
+  int64_t worst = 0;
+  int64_t writes = 0;
+};
+
+void WriteOnce(FS *fs, int fd, std::string *data, int i, WriterTimes *times) {
+  std::fill(data->begin(), data->end(), static_cast<char>('a' + i % 26));
+  auto start = std::chrono::high_resolution_clock::now();
+  fs->LSeek(fd, 0, SEEK_SET);
+  fs->Write(fd, data->data(), data->size());
+  auto finish = std::chrono::high_resolution_clock::now();
+  int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  times->total += elapsed;
+  times->worst = std::max(times->worst, elapsed);
+  ++times->writes;
+}
+
+// false if the read mixes the data of two writes
+bool ReadOnce(FS *fs, int fd, std::string *buffer) {
+  ssize_t read = fs->PRead(fd, &(*buffer)[0], buffer->size(), 0);
+  if (read != static_cast<ssize_t>(buffer->size())) {
+    return false;
+  }
+  return buffer->find_first_not_of((*buffer)[0]) == std::string::npos;
+}
+
+void Report(const std::string &round, size_t size, const WriterTimes &times, size_t reads, size_t torn, int64_t elapsed) {
+  std::cout << size / 1024 << " KiB file, " << round << ": " << times.writes << " writes "
+            << (times.writes ? times.total / times.writes : 0) << "us average, "
+            << times.worst << "us worst; " << reads << " reads, " << torn << " torn, "
+            << (elapsed ? reads * 1000000 / elapsed : 0) << " reads/s\n";
+}
+
+// false if a read was torn or nothing was read
+bool RunRound(FS *fs, size_t size, unsigned readers, const std::string &name) {
+  std::string data(size, 'a');
+  int fd = fs->Open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  fs->Write(fd, data.data(), data.size());
+
+  WriterTimes alone;
+  for (int i = 0; i < kWrites; ++i) {
+    WriteOnce(fs, fd, &data, i, &alone);
+  }
+  Report("writer alone", size, alone, 0, 0, 0);
+
+  WriterTimes shared;
+  std::atomic<size_t> reads{0};
+  std::atomic<size_t> torn{0};
+  auto start = std::chrono::high_resolution_clock::now();
+#if !KVFS_THREAD_SAFE
+  (void) readers;
+  // without threads the reads come between the writes
+  std::string buffer(size, '\0');
+  for (int i = 0; i < kWrites; ++i) {
+    WriteOnce(fs, fd, &data, i, &shared);
+    torn += ReadOnce(fs, fd, &buffer) ? 0 : 1;
+    ++reads;
+  }
+#else
+  std::atomic<bool> done{false};
+  std::atomic<unsigned> started{0};
+  std::vector<std::thread> workers;
+  for (unsigned r = 0; r < readers; ++r) {
+    workers.emplace_back([&] {
+      // each reader has a descriptor of its own
+      int reader_fd = fs->Open(name.c_str(), O_RDONLY, 0);
+      std::string buffer(size, '\0');
+      bool first = true;
+      while (!done.load()) {
+        if (!ReadOnce(fs, reader_fd, &buffer)) {
+          torn.fetch_add(1);
+        }
+        reads.fetch_add(1);
+        if (first) {
+          started.fetch_add(1);
+          first = false;
+        }
+      }
+      fs->Close(reader_fd);
+    });
+  }
+  // the writes only count once every reader is reading
+  while (started.load() < readers) {
+    std::this_thread::yield();
+  }
+  for (int i = 0; i < kWrites || reads.load() < kMinReads; ++i) {
+    WriteOnce(fs, fd, &data, i, &shared);
+  }
+  done = true;
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+#endif
+  auto finish = std::chrono::high_resolution_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  Report("with " + std::to_string(readers) + " readers", size, shared, reads.load(), torn.load(), elapsed);
+  fs->Close(fd);
+  return torn.load() == 0 && reads.load() > 0;
+}
+
+int main() {
+  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>();
+#if !KVFS_THREAD_SAFE
+  std::cout << "Built without BuildWithThreadSafety, reads and writes take turns on a single thread\n";
+  unsigned readers = 1;
+#else
+  unsigned readers = std::max(std::thread::hardware_concurrency(), 1u) * 2;
+#endif
+  // below and above the size at which the blocks of a read are fetched concurrently
+  bool passed = RunRound(fs_.get(), 64 * 1024, readers, "/small");
+  passed = RunRound(fs_.get(), 1024 * 1024, readers, "/large") && passed;
+  fs_->DestroyFS();
+  fs_.reset();
+  if (!passed) {
+    std::cout << "FAILED: torn reads, or no reads during the writes\n";
+  }
+  return passed ? 0 : 1;
+}
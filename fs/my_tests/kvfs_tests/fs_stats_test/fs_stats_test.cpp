@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   fs_stats_test.cpp
+ */
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <random>
+
+// random reads and writes of whole blocks, timed, followed by the stats kept of them; build with and
+// without BuildWithStats to see what keeping them costs
+const size_t kFileSize = 16 << 20;
+const size_t kBlockSize = 4096;
+const int kOps = 100000;
+
+void Report(const kvfs_stats &stats, kvfs_stats_op op) {
+  const kvfs::LatencyHistogram &latency = stats.ops[op].latency;
+  std::cout << "  " << kvfs_stats_op_name(op) << ": " << stats.ops[op].calls << " calls, " << stats.ops[op].errors
+            << " failed, " << latency.Count() << " timed, p50 " << latency.Percentile(0.5) << "ns, p99 " << latency.Percentile(0.99) << "ns\n";
+}
+
+int main() {
+  std::unique_ptr<kvfs::KVFS> kvfs = std::make_unique<kvfs::KVFS>();
+  FS *fs = kvfs.get();
+  std::string data(kFileSize, 'a');
+  int fd = fs->Open("/file", O_CREAT | O_RDWR, 0644);
+  fs->Write(fd, data.data(), data.size());
+  kvfs->GetStats();
+
+  std::mt19937_64 random(1);
+  std::string buffer(kBlockSize, 'b');
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < kOps; ++i) {
+    off_t offset = static_cast<off_t>(random() % (kFileSize / kBlockSize) * kBlockSize);
+    if (random() % 2) {
+      fs->PRead(fd, &buffer[0], buffer.size(), offset);
+    } else {
+      fs->PWrite(fd, buffer.data(), buffer.size(), offset);
+    }
+  }
+  auto finish = std::chrono::high_resolution_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << kOps << " random reads and writes of " << kBlockSize << " bytes: " << elapsed << "us, "
+            << (elapsed ? kOps * 1000000ll / elapsed : 0) << " ops/s"
+            << (KVFS_STATS ? "" : " (built without BuildWithStats)") << "\n";
+
+  kvfs_stats stats = kvfs->GetStats("/tmp/kvfs_stats.json", KVFS_STATS_JSON);
+  std::cout << "read amplification " << stats.ReadAmplification() << ", write amplification "
+            << stats.WriteAmplification() << "\n";
+  for (kvfs_stats_op op : {KVFS_OP_PREAD, KVFS_OP_PWRITE, KVFS_OP_STORE_GET, KVFS_OP_STORE_PUT,
+                           KVFS_OP_STORE_WRITE_BATCH}) {
+    Report(stats, op);
+  }
+
+  // the snapshot started the counts over
+  fs->PRead(fd, &buffer[0], buffer.size(), 0);
+  stats = kvfs->GetStats("/tmp/kvfs_stats.prom", KVFS_STATS_PROMETHEUS);
+  std::cout << "after one more read:\n";
+  Report(stats, KVFS_OP_PREAD);
+  std::cout << "stats written to /tmp/kvfs_stats.json and /tmp/kvfs_stats.prom\n";
+
+  fs->Close(fd);
+  fs->DestroyFS();
+  kvfs.reset();
+  return 0;
+}
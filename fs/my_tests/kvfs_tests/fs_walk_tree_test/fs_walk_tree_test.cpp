@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2019 Afshin Sabahi. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ *
+ *      Author: Afshin Sabahi
+ *      File:   fs_walk_tree_test.cpp
+ */
+
+#include <kvfs/fs.h>
+#include <kvfs/kvfs.h>
+#include <atomic>
+
+// generated tree: kFanOut directories in every directory down to kDepth, kFiles files in each of them
+const int kDepth = 5;
+const int kFanOut = 6;
+const int kFiles = 10;
+
+size_t CreateTree(FS *fs, const std::string &dir, int level) {
+  size_t created = 0;
+  for (int i = 0; i < kFiles; ++i) {
+    std::string name = dir + "/file" + std::to_string(i);
+    int fd = fs->Open(name.c_str(), O_CREAT | O_WRONLY, 0644);
+    fs->Write(fd, name.c_str(), name.size());
+    fs->Close(fd);
+    ++created;
+  }
+  if (level == kDepth) {
+    return created;
+  }
+  for (int i = 0; i < kFanOut; ++i) {
+    std::string name = dir + "/dir" + std::to_string(i);
+    fs->MkDir(name.c_str(), 0755);
+    created += 1 + CreateTree(fs, name, level + 1);
+  }
+  return created;
+}
+
+// what a scanner does without WalkTree: one stream per directory and a Stat per name
+size_t ReadDirWalk(FS *fs, const std::string &dir) {
+  size_t visited = 0;
+  std::vector<std::string> subdirs;
+  kvfsDIR *stream = fs->OpenDir(dir.c_str());
+  kvfs_dirent *entry;
+  while ((entry = fs->ReadDir(stream)) != nullptr) {
+    std::string name = dir + "/" + entry->d_name;
+    kvfs_stat buf{};
+    fs->Stat(name.c_str(), &buf);
+    ++visited;
+    if (S_ISDIR(buf.st_mode)) {
+      subdirs.push_back(name);
+    }
+  }
+  fs->CloseDir(stream);
+  for (const std::string &subdir : subdirs) {
+    visited += ReadDirWalk(fs, subdir);
+  }
+  return visited;
+}
+
+int main() {
+  std::unique_ptr<FS> fs_ = std::make_unique<kvfs::KVFS>();
+  fs_->MkDir("/tree", 0755);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  size_t created = CreateTree(fs_.get(), "/tree", 1);
+  auto finish = std::chrono::high_resolution_clock::now();
+  std::cout << "Created " << created << " entries, " << kDepth << " levels of " << kFanOut
+            << " directories with " << kFiles << " files each, for "
+            << std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() << "us\n";
+
+  start = std::chrono::high_resolution_clock::now();
+  size_t visited = ReadDirWalk(fs_.get(), "/tree");
+  finish = std::chrono::high_resolution_clock::now();
+  auto baseline = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+  std::cout << "OpenDir/ReadDir/Stat visited " << visited << " entries for " << baseline << "us\n";
+
+  unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+  for (unsigned threads = 1; threads <= cores * 2; threads *= 2) {
+    std::atomic<size_t> entries{0};
+    std::atomic<uint64_t> bytes{0};
+    kvfs_walk_options options;
+    options.threads = threads;
+    start = std::chrono::high_resolution_clock::now();
+    fs_->WalkTree("/tree", [&](const kvfs_walk_entry &entry) {
+      entries.fetch_add(1, std::memory_order_relaxed);
+      bytes.fetch_add(entry.stat->st_size, std::memory_order_relaxed);
+      return KVFS_WALK_CONTINUE;
+    }, options);
+    finish = std::chrono::high_resolution_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count();
+    std::cout << "WalkTree with " << threads << " threads visited " << entries.load() << " entries ("
+              << bytes.load() << " bytes) for " << elapsed << "us, "
+              << (elapsed ? entries.load() * 1000000 / elapsed : 0) << " entries/s, "
+              << (elapsed ? static_cast<double>(baseline) / elapsed : 0) << "x ReadDir\n";
+  }
+
+  fs_->DestroyFS();
+  fs_.reset();
+  return 0;
+}
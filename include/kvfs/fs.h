@@ -14,15 +14,23 @@
 #include <memory>
 #include <dirent.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <kvfs_config.h>
 #include <kvfs/kvfs_dirent.h>
 
+namespace kvfs {
+struct kvfsSession;
+}
+
 /**
  * Use this abstract class to create an instance of KVFS
  * Example:
  * std::unique_ptr<FS> fs_ = std::make_unique<KVFS>(// optional mount path );
  * or use shared ptr if necessary.
  * If no mount path is given, the filesystem is mounted at "/tmp/db/"
+ * A mount path can be followed by kvfs_mount_options, e.g. to choose when access times are written.
+ * Reads, writes, opens, stats and fsyncs can also be submitted in batches and run in the background
+ * with kvfs::AsyncQueue, see kvfs/async_queue.h.
  */
 class FS {
  public:
@@ -84,6 +92,25 @@ class FS {
     *      An I/O error occurred.
     */
   virtual int ChDir(const char *path) = 0;
+  /**
+   * @brief Working directory, credentials and last error are kept per session, and every thread calling
+   * into the filesystem uses a session of its own, starting at "/" with the credentials of the process.
+   * A server that runs the requests of one client on different threads creates a session for the client
+   * and attaches it on the thread serving each request, a session is used by one thread at a time.
+   * @param uid user id new entries are owned by and Access checks against.
+   * @param gid group id new entries are owned by and Access checks against.
+   * @return A session at "/" with the given credentials.
+   */
+  virtual std::shared_ptr<kvfs::kvfsSession> NewSession(uid_t uid, gid_t gid) = 0;
+  /**
+   * @brief Make the calling thread use the given session from now on.
+   * @param session A session from NewSession or GetSession, nullptr gives the thread a new one of its own.
+   */
+  virtual void AttachSession(std::shared_ptr<kvfs::kvfsSession> session) = 0;
+  /**
+   * @return The session the calling thread uses, its errorno_ holds the error of the last failed call.
+   */
+  virtual std::shared_ptr<kvfs::kvfsSession> GetSession() = 0;
 
   /**
     * @brief The opendir function opens and returns a directory stream for reading the directory
@@ -106,6 +133,57 @@ class FS {
    */
   virtual kvfs_dirent *ReadDir(kvfsDIR *dirstream) = 0;
 
+  /**
+   * This function reads as many entries as fit into buffer from the directory, in a single pass over it.
+   * The entries are packed the same way getdents64 packs them: each one is a kvfs_dirent cut short after
+   * the null terminated d_name, d_reclen is the length of the record and d_off is the position after it
+   * as returned by TellDir. Records are aligned for kvfs_dirent, so buffer must be aligned as well.
+   * Example:
+   * for (ssize_t pos = 0; pos < n;) {
+   *   auto *entry = reinterpret_cast<kvfs_dirent *>(buffer + pos);
+   *   pos += entry->d_reclen;
+   * }
+   * @param dirstream
+   * @param buffer
+   * @param bytes size of buffer.
+   * @return The number of bytes written to buffer, 0 at the end of the directory.
+   * The following errno error conditions are defined for this function:
+   * EINVAL
+   *    The buffer is too small to hold the next entry.
+   */
+  virtual ssize_t ReadDirBatch(kvfsDIR *dirstream, void *buffer, size_t bytes) = 0;
+
+  /**
+   * This function reads up to count entries from the directory together with their attributes,
+   * the same attributes Stat would return for each name, without looking any of them up again.
+   * @param dirstream
+   * @param entries array of at least count elements.
+   * @param count
+   * @param warm_cache if true, the metadata read is also kept in memory so that Stat, Open and the other
+   * calls that look up these names right after the listing don't have to go to the store.
+   * @return The number of entries written, 0 at the end of the directory.
+   */
+  virtual ssize_t ReadDirPlus(kvfsDIR *dirstream, kvfs_dirent_plus *entries, size_t count, bool warm_cache) = 0;
+
+  /**
+   * The telldir function returns the file position of the directory stream dirstream.
+   * You can use this value with seekdir to restore the directory stream to that position.
+   * A position stays valid while entries are added to or removed from the directory:
+   * it refers to the name, not to an index, and a removed name resumes at the entry after it.
+   * @param dirstream
+   * @return -1 at the end of the directory.
+   */
+  virtual long TellDir(kvfsDIR *dirstream) = 0;
+
+  /**
+   * The seekdir function sets the file position of the directory stream dirstream to pos.
+   * The value pos must be the result of a previous call to telldir on a stream of the same directory,
+   * or 0 to go back to the first entry.
+   * @param dirstream
+   * @param pos
+   */
+  virtual void SeekDir(kvfsDIR *dirstream, long pos) = 0;
+
   /**
    * This function closes the directory stream dirstream. It returns 0 on success and -1 on failure.
    * The following errno error conditions are defined for this function:
@@ -146,6 +224,19 @@ class FS {
    */
   virtual int Link(const char *oldname, const char *newname) = 0;
 
+  /**
+   * The linkat function works like link, except that relative names are resolved against the
+   * directories open as olddirfd and newdirfd instead of the current working directory.
+   * If a name is absolute, or its directory descriptor is AT_FDCWD, it is treated exactly as link does.
+   * Only the components after the open directory are looked up, the path to it is not resolved again.
+   * @return On top of the errors of link:
+   * EBADF
+   *    olddirfd or newdirfd is not a valid file descriptor.
+   * ENOTDIR
+   *    A relative name is given and the matching descriptor is not associated with a directory.
+   */
+  virtual int LinkAt(int olddirfd, const char *oldname, int newdirfd, const char *newname) = 0;
+
   /**
    * The symlink function makes a symbolic link to oldname named newname.
    * @param path1
@@ -164,6 +255,13 @@ class FS {
    */
   virtual int SymLink(const char *path1, const char *path2) = 0;
 
+  /**
+   * The symlinkat function works like symlink, except that a relative path2 is created
+   * in the directory open as dirfd. path1 is stored as is, just like symlink does.
+   * @return On top of the errors of symlink, EBADF and ENOTDIR as described for linkat.
+   */
+  virtual int SymLinkAt(const char *path1, int dirfd, const char *path2) = 0;
+
   /**
    * The readlink function gets the value of the symbolic link filename.
    * The file name that the link points to is copied into buffer.
@@ -209,6 +307,15 @@ class FS {
    */
   virtual int UnLink(const char *filename) = 0;
 
+  /**
+   * The unlinkat function works like unlink, except that a relative filename is resolved
+   * against the directory open as dirfd.
+   * @param flags If AT_REMOVEDIR is set, it behaves like rmdir and filename must name a directory.
+   * @return On top of the errors of unlink, EBADF and ENOTDIR as described for linkat.
+   * ENOTDIR is also returned if AT_REMOVEDIR is set and filename is not a directory.
+   */
+  virtual int UnLinkAt(int dirfd, const char *filename, int flags) = 0;
+
   /**
    * The rmdir function deletes a directory. The directory must be empty before it can be removed;
    * in other words, it can only contain entries for . and ...
@@ -227,6 +334,36 @@ class FS {
    */
   virtual int Remove(const char *filename) = 0;
 
+  /**
+   * This function removes filename and, if it is a directory, everything below it, like rm -r.
+   * Only the entry of filename is removed before it returns, in a single atomic write, after which
+   * the tree can no longer be reached by its path. The entries and data below it are deleted in
+   * the background, and continue to be after the next mount if it is unmounted before they are done.
+   * Directory streams and files already open inside the tree are not stopped from using it.
+   * The following errno error conditions are defined for this function:
+   * ENOENT
+   *    The file named by filename does not exist.
+   * EINVAL
+   *    filename is the root directory.
+   */
+  virtual int RemoveTree(const char *filename) = 0;
+
+  /**
+   * This function calls visitor for root and every entry below it, similar to nftw with FTW_PHYS:
+   * symbolic links are reported, not followed. The whole walk reads one consistent snapshot of the store,
+   * changes made while it runs are not seen.
+   * Directories are read in parallel by options.threads threads, each taking work from the others when
+   * it runs out, so visitor is called concurrently and must be thread safe. A directory is always visited
+   * before its entries, there is no other ordering.
+   * The visitor returns one of kvfs_walk_action. An exception thrown by visitor stops the walk and is
+   * rethrown by WalkTree.
+   * @return 0 once every entry has been visited, KVFS_WALK_STOP if visitor ended the walk.
+   * The following errno error conditions are defined for this function:
+   * ENOENT
+   *    The file named by root does not exist.
+   */
+  virtual int WalkTree(const char *root, const kvfs_walk_visitor &visitor, const kvfs_walk_options &options) = 0;
+
   /**
    * The rename function renames the file oldname to newname. The file formerly accessible under
    * the name oldname is afterwards accessible as newname instead. (If the file had any other names aside from oldname,
@@ -276,6 +413,13 @@ class FS {
    */
   virtual int Rename(const char *oldname, const char *newname) = 0;
 
+  /**
+   * The renameat function works like rename, except that relative names are resolved against the
+   * directories open as olddirfd and newdirfd.
+   * @return On top of the errors of rename, EBADF and ENOTDIR as described for linkat.
+   */
+  virtual int RenameAt(int olddirfd, const char *oldname, int newdirfd, const char *newname) = 0;
+
   /**
    * The mkdir function creates a new, empty directory with name filename.
    * @param filename
@@ -299,6 +443,34 @@ class FS {
    */
   virtual int MkDir(const char *filename, mode_t mode) = 0;
 
+  /**
+   * This function creates count files in the directory dir, each with the name, mode and contents given
+   * by its entry, as if each was opened with O_CREAT | O_EXCL, written and closed.
+   * The directory is resolved once and the files are written in a few large batches, with the directory
+   * updated once per batch, so ingesting many small files costs far less than the per-file calls.
+   * Every entry is checked before anything is written, if one fails nothing is created.
+   * The following errno error conditions are defined for this function:
+   * ENOENT
+   *    dir does not exist.
+   * ENOTDIR
+   *    dir is not a directory.
+   * EEXIST
+   *    A name already exists in dir or is given twice.
+   * EINVAL
+   *    A name is empty, contains a slash or is . or ..
+   * ENAMETOOLONG
+   *    A name is longer than NAME_MAX.
+   * @return 0 on success.
+   */
+  virtual int CreateFilesBatch(const char *dir, const kvfs_create_entry *entries, size_t count) = 0;
+
+  /**
+   * The mkdirat function works like mkdir, except that a relative filename is created
+   * in the directory open as dirfd.
+   * @return On top of the errors of mkdir, EBADF and ENOTDIR as described for linkat.
+   */
+  virtual int MkDirAt(int dirfd, const char *filename, mode_t mode) = 0;
+
   /**
    * The stat function returns information about the attributes of the file named by
    * filename in the structure pointed to by buf.
@@ -314,6 +486,38 @@ class FS {
    */
   virtual int Stat(const char *filename, kvfs_stat *buf) = 0;
 
+  /**
+   * The fstatat function works like stat, except that a relative filename is resolved
+   * against the directory open as dirfd.
+   * @return On top of the errors of stat, EBADF and ENOTDIR as described for linkat.
+   */
+  virtual int StatAt(int dirfd, const char *filename, kvfs_stat *buf) = 0;
+
+  /**
+   * This function works like calling stat on each of the count paths, but the paths are resolved together:
+   * a directory shared by several of them is looked up once, and the entries of each level of all the
+   * paths are fetched from the store with a single multi-get.
+   * @param bufs The stat of paths[i] is stored in bufs[i].
+   * @param errors errors[i] is set to 0, or to the negated errno stat would have failed with for paths[i],
+   * a failing path does not fail the others.
+   * @return The number of paths that were found.
+   */
+  virtual ssize_t StatMany(const char *const *paths, size_t count, kvfs_stat *bufs, int *errors) = 0;
+
+  /**
+   * This function reads up to sizes[i] bytes from the start of each regular file paths[i] into buffers[i],
+   * as if each was opened with O_RDONLY | O_NOATIME, read and closed.
+   * The paths are resolved as in StatMany and the blocks of all the files are fetched with multi-gets.
+   * @param read read[i] is set to the number of bytes read for paths[i], or to the negated errno,
+   * EISDIR for a directory and EINVAL for anything else that is not a regular file.
+   * @return The number of files that were read.
+   */
+  virtual ssize_t ReadFilesMany(const char *const *paths,
+                                size_t count,
+                                void *const *buffers,
+                                const size_t *sizes,
+                                ssize_t *read) = 0;
+
   /**
    * The chmod function sets the access permission bits for the file named by filename to mode.
    * @param filename If filename is a symbolic link, chmod changes the permissions of the file pointed to by the link,
@@ -470,6 +674,20 @@ EROFS
    */
   virtual int Open(const char *filename, int flags, mode_t mode) = 0;
 
+  /**
+   * The openat function works like open, except that a relative filename is resolved against the
+   * directory open as dirfd (by OpenDir or Open), instead of the current working directory.
+   * A directory opened once can be used to create or open any number of files inside of it,
+   * each only costs the lookup of its own name.
+   * @param dirfd AT_FDCWD makes it behave exactly like open.
+   * @return On top of the errors of open:
+   * EBADF
+   *    filename is relative and dirfd is neither AT_FDCWD nor a valid file descriptor.
+   * ENOTDIR
+   *    filename is relative and dirfd is not associated with a directory.
+   */
+  virtual int OpenAt(int dirfd, const char *filename, int flags, mode_t mode) = 0;
+
   /**
    * The function close closes the file descriptor filedes. Closing a file has the following consequences:
 
@@ -684,6 +902,24 @@ EINVAL
 
    */
   virtual int FSync(int filedes) = 0;
+
+  /**
+   * When a call to the fdatasync function returns, it is ensured that all of the file data is written to the device. For all pending I/O operations, the parts guaranteeing data integrity finished.
+
+Not all systems implement the fdatasync operation. On systems missing this functionality fdatasync is emulated by a call to fsync since the performed actions are a superset of those required by fdatasync.
+   * @param filedes
+   * @return
+   * The return value of the function is zero if no error occurred. Otherwise it is -1 and the global variable errno is set to the following values:
+
+EBADF
+
+    The descriptor fildes is not valid.
+EINVAL
+
+    No synchronization is possible since the system does not implement this.
+
+   */
+  virtual int FDataSync(int filedes) = 0;
   /**
    * The pread function is similar to the read function. The first three arguments are identical, and the return values and error codes also correspond.
 
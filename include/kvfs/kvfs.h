@@ -19,8 +19,20 @@
 #include <kvfs_leveldb/kvfs_leveldb_store.h>
 #endif
 #include <inodes/open_files_cache.h>
+#include <inodes/open_inode_table.h>
 #include <inodes/inode_cache.h>
+#include <inodes/dentry_cache.h>
+#include <inodes/timestamp_cache.h>
 #include <kvfs/super.h>
+#include <kvfs/block_fetcher.h>
+#include <kvfs/counting_store.h>
+#include <kvfs/stats.h>
+#include <kvfs/group_commit.h>
+#include <kvfs/inode_allocator.h>
+#include <kvfs/inode_locks.h>
+#include <kvfs/session.h>
+#include <kvfs/tree_reclaimer.h>
+#include <kvfs/tree_walker.h>
 #include <time.h>
 #include <fcntl.h>
 #include <kvfs/fs_error.h>
@@ -30,6 +42,8 @@
 #include <mutex>
 #include <iostream>
 #include <array>
+#include <unordered_set>
+#include <unordered_map>
 #include <algorithm>
 #include <string.h>
 #include <cstring>
@@ -43,26 +57,63 @@ namespace kvfs {
 
 class KVFS : public FS {
  public:
-  explicit KVFS(const std::string &mount_path);
+  explicit KVFS(const std::string &mount_path, const kvfs_mount_options &options = kvfs_mount_options());
   KVFS();
   ~KVFS();
 
+  /**
+   * Calls made to the store since the mount, GetStats does not reset these.
+   * All zero if built without BuildWithStats.
+   */
+  kvfs_store_calls StoreCalls() const;
+
+  /**
+   * The calls, latencies and bytes counted since the previous call, or since the mount for the first
+   * one; each call starts the counts over. Calls, failures and bytes are exact, latencies are those of a
+   * random sample of the calls. If path is given the snapshot is also written to it in format, replacing
+   * the file.
+   * All zero if built without BuildWithStats.
+   */
+  kvfs_stats GetStats(const char *path = nullptr, kvfs_stats_format format = KVFS_STATS_JSON);
+
  protected:
   char *GetCWD(char *buffer, size_t size) override;
   std::string GetCurrentDirName() override;
+  std::shared_ptr<kvfsSession> NewSession(uid_t uid, gid_t gid) override;
+  void AttachSession(std::shared_ptr<kvfsSession> session) override;
+  std::shared_ptr<kvfsSession> GetSession() override;
   int ChDir(const char *path) override;
   kvfsDIR *OpenDir(const char *path) override;
   kvfs_dirent *ReadDir(kvfsDIR *dirstream) override;
+  ssize_t ReadDirBatch(kvfsDIR *dirstream, void *buffer, size_t bytes) override;
+  ssize_t ReadDirPlus(kvfsDIR *dirstream, kvfs_dirent_plus *entries, size_t count, bool warm_cache) override;
+  long TellDir(kvfsDIR *dirstream) override;
+  void SeekDir(kvfsDIR *dirstream, long pos) override;
   int CloseDir(kvfsDIR *dirstream) override;
   int Link(const char *oldname, const char *newname) override;
+  int LinkAt(int olddirfd, const char *oldname, int newdirfd, const char *newname) override;
   int SymLink(const char *path1, const char *path2) override;
+  int SymLinkAt(const char *path1, int dirfd, const char *path2) override;
   ssize_t ReadLink(const char *filename, char *buffer, size_t size) override;
   int UnLink(const char *filename) override;
+  int UnLinkAt(int dirfd, const char *filename, int flags) override;
   int RmDir(const char *filename) override;
   int Remove(const char *filename) override;
+  int RemoveTree(const char *filename) override;
+  int WalkTree(const char *root, const kvfs_walk_visitor &visitor, const kvfs_walk_options &options) override;
   int Rename(const char *oldname, const char *newname) override;
+  int RenameAt(int olddirfd, const char *oldname, int newdirfd, const char *newname) override;
   int MkDir(const char *filename, mode_t mode) override;
+  int MkDirAt(int dirfd, const char *filename, mode_t mode) override;
+  int CreateFilesBatch(const char *dir, const kvfs_create_entry *entries, size_t count) override;
   int Stat(const char *filename, kvfs_stat *buf) override;
+  int StatAt(int dirfd, const char *filename, kvfs_stat *buf) override;
+  ssize_t StatMany(const char *const *paths, size_t count, kvfs_stat *bufs, int *errors) override;
+  ssize_t ReadFilesMany(const char *const *paths,
+                        size_t count,
+                        void *const *buffers,
+                        const size_t *sizes,
+                        ssize_t *read) override;
   int ChMod(const char *filename, mode_t mode) override;
   int Access(const char *filename, int how) override;
   int UTime(const char *filename, const struct utimbuf *times) override;
@@ -70,6 +121,7 @@ class KVFS : public FS {
   int Mknod(const char *filename, mode_t mode, dev_t dev) override;
   void TuneFS() override;
   int Open(const char *filename, int flags, mode_t mode) override;
+  int OpenAt(int dirfd, const char *filename, int flags, mode_t mode) override;
   int Close(int filedes) override;
   ssize_t Read(int filedes, void *buffer, size_t size) override;
   ssize_t Write(int filedes, const void *buffer, size_t size) override;
@@ -82,6 +134,7 @@ class KVFS : public FS {
                         unsigned int flags) override;
   void Sync() override;
   int FSync(int filedes) override;
+  int FDataSync(int filedes) override;
   ssize_t PRead(int filedes, void *buffer, size_t size, off_t offset) override;
   ssize_t PWrite(int filedes, const void *buffer, size_t size, off_t offset) override;
   void DestroyFS() override;
@@ -89,20 +142,26 @@ class KVFS : public FS {
 
  private:
   std::filesystem::path root_path;
+  // before the store, which records its calls in it
+  std::shared_ptr<Stats> stats_;
   std::shared_ptr<KVStore> store_;
 //  std::unique_ptr<InodeCache> inode_cache_;
   std::unique_ptr<OpenFilesCache> open_fds_;
+  std::unique_ptr<DentryCache> dentry_cache_;
+  std::unique_ptr<InodeAllocator> inode_allocator_;
+  std::unique_ptr<TreeReclaimer> tree_reclaimer_;
+  kvfs_mount_options options_;
+  std::unique_ptr<TimestampCache> timestamps_;
+  // inodes of the open files, shared by their descriptors
+  std::unique_ptr<OpenInodeTable> open_inodes_;
   kvfsSuperBlock super_block_{};
-  int8_t errorno_;
-  std::filesystem::path cwd_name_;
-  std::filesystem::path pwd_;
-  kvfsInodeValue current_md_{};
-  kvfsInodeKey current_key_{};
-  uint32_t next_free_fd_{};
-  std::vector<uint32_t> free_fds{};
-#if KVFS_THREAD_SAFE
-  std::unique_ptr<std::mutex> mutex_;
-#endif
+  // working directory, credentials and last error of each thread
+  std::unique_ptr<SessionTable> sessions_;
+  std::unique_ptr<InodeLocks> locks_;
+  // fetches the blocks of reads of at least KVFS_PARALLEL_READ_MIN bytes concurrently
+  std::unique_ptr<BlockFetcher> block_fetcher_;
+  // syncs of the store for fsyncs and O_SYNC writes, one for all the callers that arrive together
+  std::unique_ptr<GroupCommit> group_commit_;
   // Private Methods
  private:
   void FSInit();
@@ -110,26 +169,68 @@ class KVFS : public FS {
   std::pair<std::filesystem::path,
             std::pair<kvfsInodeKey, kvfsInodeValue>> ResolvePath(const std::filesystem::path &input);
   std::filesystem::path GetSymLinkContentsPath(const kvfsInodeValue &data);
-  bool FreeUpInodeNumber(const kvfs_file_inode_t &inode);
+  bool FreeUpInodeNumber(const kvfs_file_inode_t &inode, KVStore::WriteBatch *batch);
   kvfs_file_inode_t GetFreeInode();
-  uint32_t GetFreeFD();
+  int InsertOpenFile(kvfsFileHandle fh);
+  ssize_t PReadHandle(kvfsFileHandle *fh, void *buffer, size_t size, off_t offset);
+  ssize_t PWriteHandle(kvfsFileHandle *fh, const void *buffer, size_t size, off_t offset);
   ssize_t WriteBlocks(kvfsBlockKey blck_key_, size_t blcks_to_write_, const void *buffer, size_t buffer_size_);
+  ssize_t PackBlocks(KVStore::WriteBatch *batch,
+                     kvfsBlockKey blck_key_,
+                     size_t blcks_to_write_,
+                     const void *buffer,
+                     size_t buffer_size_);
   std::pair<ssize_t, const void *> FillBlock(kvfsBlockValue *blck_,
                                              const void *buffer,
                                              size_t buffer_size_,
                                              kvfs_off_t offset);
   std::pair<ssize_t, void *> ReadBlock(kvfsBlockValue *blck_, void *buffer, size_t size, off_t offset);
-  ssize_t ReadBlocks(kvfsBlockKey blck_key_, size_t blcks_to_read_, size_t buffer_size_, void *buffer);
+  ssize_t ReadBlocks(kvfsBlockKey blck_key_,
+                     size_t blcks_to_read_,
+                     size_t buffer_size_,
+                     void *buffer,
+                     const KVStore::Snapshot *snapshot);
   std::pair<std::filesystem::path,
             std::pair<kvfs::kvfsInodeKey, kvfs::kvfsInodeValue>> RealPath(const std::filesystem::path &input);
-  void FreeUpFD(uint32_t filedes);
+  std::pair<std::filesystem::path,
+            std::pair<kvfs::kvfsInodeKey, kvfs::kvfsInodeValue>> ResolveAt(int dirfd,
+                                                                         const std::filesystem::path &input);
+  KVStoreResult LookupEntry(const kvfsInodeKey &key);
+  void EntryCreated(const kvfsInodeKey &key);
+  void EntryRemoved(const kvfsInodeKey &key);
+  void EntryUpdated(const kvfsInodeKey &key);
+  void BuildDirectoryFilter(kvfs_file_inode_t dir);
+  void TouchAtime(kvfsFileHandle *fh);
+  void Reload(const kvfsInodeKey &key, kvfsInodeValue *md);
+  kvfsSession *CurrentSession();
+  void WriteBackInode(kvfsOpenInode *inode);
+  int SyncFile(int filedes, bool metadata);
+  // make the pending blocks and inode of a file durable, leaving out the times unless metadata is set;
+  // the guard is released before the sync
+  void SyncInode(kvfsOpenInode *inode, InodeLocks::Guard *guard, bool metadata);
+  void WriteBackOpenInodes();
+  void SetOwner(kvfsInodeValue *md);
+  void FlushTimestamps();
+  // TellDir without counting a call of it, for the reads of the stream
+  long DirPosition(kvfsDIR *dirstream);
+  bool ReadDirEntry(kvfsDIR *dirstream, kvfsInodeValue *md);
+  void ResolveMany(const char *const *paths, size_t count, std::vector<kvfsInodeValue> *mds, int *errors);
 };
 
 }  // namespace kvfs
 
 struct __kvfs_dir_stream {
   uint32_t file_descriptor_;
+  // the view ptr_ iterates, released after it
+  std::shared_ptr<const kvfs::KVStore::Snapshot> snapshot_;
   std::unique_ptr<kvfs::KVStore::Iterator> ptr_;
+  // inode of the directory, the keys of its entries start with it
+  kvfs_file_inode_t inode_;
+  // dentry cache generation of the directory when the iterator was created, entries read from it are
+  // cached only if nothing in the directory was changed since
+  uint64_t generation_;
+  // ReadDir returns a pointer to this
+  kvfs_dirent entry_;
 };
 
 #endif //KVFS_FILESYSTEM_H
\ No newline at end of file